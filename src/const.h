@@ -2,6 +2,11 @@
 #define CONST_H
 
 // #define SPATIAL_TEST
+// #define SPATIAL_BENCH // compare spatial backends and exit, instead of opening a window
+
+// node positions in 8 bytes instead of 16, as offsets from the viewport centre
+// #define NODE_POSITIONS_FLOAT
+// #define NODE_POSITIONS_QUANTISED // fixed point, 1/256 apart
 
 #include "types.h"
 
@@ -0,0 +1,177 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+// bump allocator over blocks it keeps for good. small frees go on a free
+// list per size and are handed out again, bigger ones wait for reset(),
+// which gives everything back at once in O(1) and starts over in the same
+// blocks. once those cover the biggest round, nothing more is allocated.
+// one thread at a time, unless shared.
+class Arena {
+public:
+    static constexpr std::size_t kBlockSize = std::size_t(1) << 16;
+    static constexpr std::size_t kGranule = 16;
+    static constexpr std::size_t kSizeClasses = 16; // free lists up to 256 bytes
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+    };
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    std::vector<Block> blocks_;
+    std::size_t next_block_ = 0; // the first block not yet used this round
+    std::byte* cursor_ = nullptr;
+    std::byte* end_ = nullptr;
+    std::array<FreeNode*, kSizeClasses> free_{};
+
+    bool shared_ = false;
+    std::atomic_flag lock_;
+
+    void lock() {
+        if (!shared_) return;
+        while (lock_.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void unlock() {
+        if (shared_) lock_.clear(std::memory_order_release);
+    }
+
+    static std::size_t round_up(std::size_t bytes) {
+        return (std::max(bytes, kGranule) + kGranule - 1) & ~(kGranule - 1);
+    }
+
+    void take_block(std::size_t bytes) {
+        while (next_block_ < blocks_.size() && blocks_[next_block_].size < bytes) {
+            ++next_block_;
+        }
+
+        if (next_block_ == blocks_.size()) {
+            std::size_t size = std::max(kBlockSize, bytes);
+            blocks_.push_back({std::make_unique_for_overwrite<std::byte[]>(size), size});
+        }
+
+        Block& block = blocks_[next_block_++];
+        cursor_ = block.data.get();
+        end_ = cursor_ + block.size;
+    }
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(std::size_t bytes, std::size_t align) {
+        assert(align <= kGranule);
+        bytes = round_up(bytes);
+        lock();
+
+        void* out;
+        std::size_t size_class = bytes/kGranule - 1;
+        if (size_class < kSizeClasses && free_[size_class]) {
+            out = free_[size_class];
+            free_[size_class] = free_[size_class]->next;
+        } else {
+            if (static_cast<std::size_t>(end_ - cursor_) < bytes) take_block(bytes);
+            out = cursor_;
+            cursor_ += bytes;
+        }
+
+        unlock();
+        return out;
+    }
+
+    void deallocate(void* p, std::size_t bytes) {
+        std::size_t size_class = round_up(bytes)/kGranule - 1;
+        if (size_class >= kSizeClasses) return;
+
+        lock();
+        free_[size_class] = new (p) FreeNode{free_[size_class]};
+        unlock();
+    }
+
+    // for when containers in it are passed between threads, every allocation
+    // and free takes a spinlock. only switch while nothing is using it
+    void set_shared(bool shared) {
+        shared_ = shared;
+    }
+
+    // everything allocated so far is gone, the blocks stay
+    void reset() {
+        next_block_ = 0;
+        cursor_ = end_ = nullptr;
+        free_.fill(nullptr);
+    }
+
+    std::size_t capacity() const {
+        std::size_t total = 0;
+        for (const Block& block : blocks_) {
+            total += block.size;
+        }
+        return total;
+    }
+};
+
+
+// allocator for standard containers over an Arena, or plain new and delete
+// without one. moving a container takes its arena along, copying one does
+// not, so a copy handed out lives as long as anything else on the heap
+template<typename T>
+struct ArenaAllocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    Arena* arena = nullptr;
+
+    ArenaAllocator() = default;
+    ArenaAllocator(Arena* arena) : arena(arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(std::size_t n) {
+        if (!arena) return std::allocator<T>().allocate(n);
+        return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        if (!arena) return std::allocator<T>().deallocate(p, n);
+        arena->deallocate(p, n*sizeof(T));
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const {
+        return {};
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+};
+
+
+template<typename T>
+using ArenaList = std::list<T, ArenaAllocator<T>>;
+
+
+#endif
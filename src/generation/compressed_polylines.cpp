@@ -0,0 +1,216 @@
+#include "compressed_polylines.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+
+//  SECTION: varints
+
+static std::uint64_t zigzag(std::int64_t v) {
+    return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63);
+}
+
+
+static std::int64_t unzigzag(std::uint64_t v) {
+    return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+}
+
+
+static void put_varint(std::vector<std::uint8_t>& bytes, std::uint64_t v) {
+    while (v >= 0x80) {
+        bytes.push_back(static_cast<std::uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    bytes.push_back(static_cast<std::uint8_t>(v));
+}
+
+
+static std::uint64_t get_varint(const std::uint8_t*& p) {
+    std::uint64_t v = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        v |= static_cast<std::uint64_t>(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return v | static_cast<std::uint64_t>(*p++) << shift;
+}
+
+
+
+//  SECTION: CompressedPolylines
+
+CompressedPolylines::CompressedPolylines(DVector2 origin, double step) :
+    origin_(origin),
+    step_(step)
+{
+    assert(step_ > 0.0);
+}
+
+
+std::int32_t CompressedPolylines::quantise(double v, double origin) const {
+    double q = std::round((v - origin)/step_);
+    assert(std::abs(q) <= std::numeric_limits<std::int32_t>::max());
+    return static_cast<std::int32_t>(q);
+}
+
+
+std::size_t CompressedPolylines::add(const Info& info, std::span<const DVector2> nodes) {
+    Entry entry {info, static_cast<std::uint32_t>(blocks_.size())};
+    entry.info.size = nodes.size();
+
+    std::int32_t x = 0, y = 0;
+    for (std::size_t k = 0; k < nodes.size(); ++k) {
+        std::int32_t qx = quantise(nodes[k].x, origin_.x);
+        std::int32_t qy = quantise(nodes[k].y, origin_.y);
+
+        if (k % kBlockNodes == 0) {
+            blocks_.push_back({static_cast<std::uint32_t>(bytes_.size()), qx, qy});
+        } else {
+            put_varint(bytes_, zigzag(std::int64_t(qx) - x));
+            put_varint(bytes_, zigzag(std::int64_t(qy) - y));
+        }
+        x = qx;
+        y = qy;
+    }
+
+    entries_.push_back(entry);
+    return entries_.size() - 1;
+}
+
+
+std::size_t CompressedPolylines::decode_block(std::size_t entry, std::size_t block, std::int32_t* out) const {
+    const Entry& e = entries_[entry];
+    const Block& b = blocks_[e.first_block + block];
+    std::size_t count = std::min<std::size_t>(kBlockNodes, e.info.size - block*kBlockNodes);
+
+    const std::uint8_t* p = bytes_.data() + b.offset;
+    std::int32_t x = b.x, y = b.y;
+    out[0] = x;
+    out[1] = y;
+    for (std::size_t k = 1; k < count; ++k) {
+        x += static_cast<std::int32_t>(unzigzag(get_varint(p)));
+        y += static_cast<std::int32_t>(unzigzag(get_varint(p)));
+        out[2*k] = x;
+        out[2*k + 1] = y;
+    }
+
+    return count;
+}
+
+
+template<typename V>
+void CompressedPolylines::decode_into(std::size_t i, std::vector<TVector2<V>>& out) const {
+    std::size_t n = entries_[i].info.size;
+    std::size_t blocks = (n + kBlockNodes - 1)/kBlockNodes;
+
+    // one block of integers at a time, kept per thread so decoding allocates
+    // nothing once warm
+    thread_local std::vector<std::int32_t> q;
+    q.resize(2*n);
+    for (std::size_t b = 0; b < blocks; ++b) {
+        decode_block(i, b, q.data() + 2*b*kBlockNodes);
+    }
+
+    out.resize(n);
+    const std::int32_t* src = q.data();
+    double ox = origin_.x, oy = origin_.y, step = step_;
+    for (std::size_t k = 0; k < n; ++k) {
+        out[k].x = static_cast<V>(ox + src[2*k]*step);
+        out[k].y = static_cast<V>(oy + src[2*k + 1]*step);
+    }
+}
+
+
+void CompressedPolylines::decode(std::size_t i, std::vector<DVector2>& out) const {
+    decode_into(i, out);
+}
+
+
+void CompressedPolylines::decode(std::size_t i, std::vector<FVector2>& out) const {
+    decode_into(i, out);
+}
+
+
+DVector2 CompressedPolylines::node(std::size_t i, std::size_t k) const {
+    assert(k < entries_[i].info.size);
+
+    std::int32_t q[2*kBlockNodes];
+    decode_block(i, k/kBlockNodes, q);
+
+    std::size_t at = k % kBlockNodes;
+    return {origin_.x + q[2*at]*step_, origin_.y + q[2*at + 1]*step_};
+}
+
+
+std::size_t CompressedPolylines::size() const {
+    return entries_.size();
+}
+
+
+const CompressedPolylines::Info& CompressedPolylines::info(std::size_t i) const {
+    return entries_[i].info;
+}
+
+
+std::size_t CompressedPolylines::memory_bytes() const {
+    return sizeof(*this)
+        + bytes_.capacity()*sizeof(std::uint8_t)
+        + blocks_.capacity()*sizeof(Block)
+        + entries_.capacity()*sizeof(Entry);
+}
+
+
+const DVector2& CompressedPolylines::origin() const {
+    return origin_;
+}
+
+
+double CompressedPolylines::step() const {
+    return step_;
+}
+
+
+void CompressedPolylines::shrink_to_fit() {
+    bytes_.shrink_to_fit();
+    blocks_.shrink_to_fit();
+    entries_.shrink_to_fit();
+}
+
+
+void CompressedPolylines::clear() {
+    bytes_.clear();
+    blocks_.clear();
+    entries_.clear();
+}
+
+
+
+//  SECTION: compress_streamlines
+
+template<typename T>
+CompressedPolylines compress_streamlines(TRoadGenerator<T>& generator, Box<double> viewport, double step) {
+    CompressedPolylines out(middle(viewport.min, viewport.max), step);
+    std::vector<DVector2> nodes;
+
+    for (RoadType road : generator.get_road_types()) {
+        for (Direction dir : {Major, Minor}) {
+            int count = generator.get_streamlines(road, dir).size();
+            for (int index = 0; index < count; ++index) {
+                nodes.clear();
+                for (const TVector2<T>& p : generator.get_polyline(road, dir, index)) {
+                    nodes.push_back(DVector2(p));
+                }
+                out.add({road, dir, index, 0}, nodes);
+            }
+        }
+    }
+
+    out.shrink_to_fit();
+    return out;
+}
+
+
+template CompressedPolylines compress_streamlines(TRoadGenerator<float>&, Box<double>, double);
+template CompressedPolylines compress_streamlines(TRoadGenerator<double>&, Box<double>, double);
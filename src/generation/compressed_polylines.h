@@ -0,0 +1,100 @@
+#ifndef COMPRESSED_POLYLINES_H
+#define COMPRESSED_POLYLINES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "../types.h"
+#include "generator.h"
+#include "integrator.h"
+#include "node_store.h"
+
+
+// finished streamlines packed for keeping around, at a few bytes a node.
+// positions are quantised to step from the origin, and each node is stored
+// as the zig-zag varint of its move from the last. every kBlockNodes nodes
+// a block starts over from an absolute position, so any node can be found
+// by decoding at most a block, and blocks decode independently. decoding
+// is a serial pass over the bytes into integers, then a flat loop scaling
+// those into positions, which the compiler vectorises.
+// read only once built, so any number of threads can decode at once
+class CompressedPolylines {
+public:
+    static constexpr std::size_t kBlockNodes = 32;
+
+    struct Info {
+        RoadType road;
+        Direction dir;
+        int index;          // in get_streamlines(road, dir)
+        std::uint32_t size; // nodes
+    };
+
+private:
+    struct Block {
+        std::uint32_t offset; // into bytes_, of the node after the anchor
+        std::int32_t x;       // the block's first node, quantised
+        std::int32_t y;
+    };
+
+    struct Entry {
+        Info info;
+        std::uint32_t first_block;
+    };
+
+    DVector2 origin_;
+    double step_;
+
+    std::vector<std::uint8_t> bytes_;
+    std::vector<Block> blocks_;
+    std::vector<Entry> entries_;
+
+    std::int32_t quantise(double v, double origin) const;
+
+    // the block's nodes, quantised, x and y interleaved. returns how many
+    std::size_t decode_block(std::size_t entry, std::size_t block, std::int32_t* out) const;
+
+    template<typename V>
+    void decode_into(std::size_t i, std::vector<TVector2<V>>& out) const;
+
+public:
+    CompressedPolylines(DVector2 origin, double step = QuantisedPositions::kStep);
+
+    // appends a streamline, returning its index here
+    std::size_t add(const Info& info, std::span<const DVector2> nodes);
+
+    std::size_t size() const;
+    const Info& info(std::size_t i) const;
+
+    // streamline i's nodes, each within step/2 of where it was on both axes
+    void decode(std::size_t i, std::vector<DVector2>& out) const;
+    void decode(std::size_t i, std::vector<FVector2>& out) const;
+
+    // one node, decoding no more than its block
+    DVector2 node(std::size_t i, std::size_t k) const;
+
+    // everything it holds, in bytes
+    std::size_t memory_bytes() const;
+
+    const DVector2& origin() const;
+    double step() const;
+
+    // gives back what adding reserved beyond what it holds
+    void shrink_to_fit();
+
+    void clear();
+};
+
+
+// every streamline the generator has, joins included, in road type,
+// direction and index order, quantised around the middle of the viewport
+template<typename T>
+CompressedPolylines compress_streamlines(
+    TRoadGenerator<T>& generator,
+    Box<double> viewport,
+    double step = QuantisedPositions::kStep
+);
+
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+
+
+// minimal lazy generator coroutine. nothing runs until the first next(),
+// and each next() resumes up to the following co_yield.
+template<typename T>
+class Generator {
+public:
+    struct promise_type {
+        std::optional<T> current;
+
+        Generator get_return_object() {
+            return Generator(handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        std::suspend_always yield_value(T value) {
+            current = std::move(value);
+            return {};
+        }
+
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        // the largest frame freed on a thread is kept for the next one, so a
+        // generator restarted over and over only allocates the first time
+        static void* operator new(std::size_t size) {
+            FrameCache& cache = frame_cache();
+            if (cache.frame && cache.size >= size) return std::exchange(cache.frame, nullptr);
+            return ::operator new(size);
+        }
+
+        static void operator delete(void* frame, std::size_t size) {
+            FrameCache& cache = frame_cache();
+            if (cache.frame && cache.size >= size) {
+                ::operator delete(frame);
+                return;
+            }
+            ::operator delete(cache.frame);
+            cache.frame = frame;
+            cache.size = size;
+        }
+    };
+
+    using handle = std::coroutine_handle<promise_type>;
+
+    Generator() = default;
+
+    Generator(Generator&& other) noexcept :
+        handle_(std::exchange(other.handle_, nullptr))
+    {}
+
+    Generator& operator=(Generator&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    Generator(const Generator&) = delete;
+    Generator& operator=(const Generator&) = delete;
+
+    ~Generator() {
+        destroy();
+    }
+
+    // resume to the next co_yield, false once the coroutine has finished
+    bool next() {
+        if (done()) return false;
+
+        handle_.promise().current.reset();
+        handle_.resume();
+        return !handle_.done();
+    }
+
+    bool done() const {
+        return !handle_ || handle_.done();
+    }
+
+    const T& value() const {
+        return handle_.promise().current.value();
+    }
+
+private:
+    struct FrameCache {
+        void* frame = nullptr;
+        std::size_t size = 0;
+
+        ~FrameCache() { ::operator delete(frame); }
+    };
+
+    static FrameCache& frame_cache() {
+        thread_local FrameCache cache;
+        return cache;
+    }
+
+    handle handle_ = nullptr;
+
+    explicit Generator(handle h) : handle_(h) {}
+
+    void destroy() {
+        if (handle_) handle_.destroy();
+        handle_ = nullptr;
+    }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#include "epoch.h"
+
+#include <atomic>
+#include <cassert>
+#include <limits>
+
+
+namespace {
+
+constexpr int kMaxThreads = 256;
+constexpr epoch_t kIdle = std::numeric_limits<epoch_t>::max();
+
+// one per thread that has ever pinned, padded so pins do not share lines
+struct alignas(64) ThreadSlot {
+    std::atomic<epoch_t> pinned = kIdle;
+    std::atomic<bool> claimed = false;
+};
+
+std::atomic<epoch_t> global_epoch = 1;
+ThreadSlot slots[kMaxThreads];
+std::atomic<int> slots_used = 0; // high water, safe_epoch only scans these
+
+
+// claims a slot on the thread's first pin and gives it back at thread exit
+struct SlotHandle {
+    ThreadSlot* slot = nullptr;
+    int depth = 0;
+
+    SlotHandle() {
+        for (int i = 0; i < kMaxThreads; ++i) {
+            bool expected = false;
+            if (!slots[i].claimed.compare_exchange_strong(expected, true)) continue;
+
+            slot = &slots[i];
+
+            int used = slots_used.load();
+            while (used < i + 1 && !slots_used.compare_exchange_weak(used, i + 1)) {}
+            return;
+        }
+        assert(false && "more pinning threads than epoch slots");
+    }
+
+    ~SlotHandle() {
+        if (!slot) return;
+        slot->pinned.store(kIdle);
+        slot->claimed.store(false);
+    }
+};
+
+thread_local SlotHandle this_thread;
+
+}
+
+
+EpochGuard::EpochGuard(bool active) : active_(active) {
+    if (!active_) return;
+
+    SlotHandle& handle = this_thread;
+    if (handle.depth++ > 0) return;
+
+    // seq_cst, so the pin is visible before anything the reader loads after.
+    // pinning an epoch that has just ended is only more conservative
+    handle.slot->pinned.store(global_epoch.load());
+}
+
+
+EpochGuard::~EpochGuard() {
+    if (!active_) return;
+
+    SlotHandle& handle = this_thread;
+    if (--handle.depth > 0) return;
+
+    handle.slot->pinned.store(kIdle, std::memory_order_release);
+}
+
+
+epoch_t advance_epoch() {
+    return global_epoch.fetch_add(1);
+}
+
+
+epoch_t safe_epoch() {
+    epoch_t safe = global_epoch.load();
+
+    int used = slots_used.load();
+    for (int i = 0; i < used; ++i) {
+        epoch_t pinned = slots[i].pinned.load();
+        if (pinned < safe) safe = pinned;
+    }
+
+    return safe;
+}
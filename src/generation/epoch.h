@@ -0,0 +1,37 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <cstdint>
+
+
+// epoch based reclamation, for structures that readers walk without locking
+// while a single writer replaces parts of them. readers pin the current
+// epoch for as long as they hold ids into the structure. the writer tags
+// whatever it unlinks with advance_epoch() once the unlinking is published,
+// and only reuses it once safe_epoch() has moved past that tag.
+using epoch_t = std::uint64_t;
+
+
+// pins the calling thread for its lifetime, nested guards are free. an
+// inactive guard does nothing, for structures no other thread is writing
+class EpochGuard {
+private:
+    bool active_;
+
+public:
+    explicit EpochGuard(bool active = true);
+    ~EpochGuard();
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+
+// ends the current epoch and returns it, to tag what was just unlinked
+epoch_t advance_epoch();
+
+// anything tagged below this can no longer be reached by any reader
+epoch_t safe_epoch();
+
+
+#endif
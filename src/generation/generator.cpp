@@ -2,10 +2,18 @@
 #include "integrator.h"
 #include "node_storage.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <list>
+#include <sstream>
+#include <thread>
+
+#include "parallel.h"
+#include "snapshot.h"
+#include "spsc_queue.h"
 
 GeneratorParameters::GeneratorParameters(
         int max_seed_retries,
@@ -39,39 +47,117 @@ GeneratorParameters::GeneratorParameters(
 
 //  SECTION: RoadGenerator
 
-bool RoadGenerator::in_bounds(const DVector2& p) const {
-    return viewport_.contains(p);
+// the grids get a level per road type sized to its d_test, the radius
+// every integration step queries
+template<typename T>
+std::vector<double> TRoadGenerator<T>::grid_cell_sizes() const {
+    std::vector<double> cell_sizes;
+    for (const auto& [_, params] : params_) {
+        cell_sizes.push_back(params.d_test);
+    }
+    return cell_sizes;
+}
+
+
+template<typename T>
+std::unique_ptr<TSpatialIndex<T>> TRoadGenerator<T>::make_spatial_index() const {
+    switch (spatial_backend_) {
+        case HashGridIndex:
+            return std::make_unique<HashGrid>(&nodes_, grid_cell_sizes());
+        case LinearQuadTreeIndex:
+            return std::make_unique<TLinearQuadtree<T>>(&nodes_, Box<T>(viewport_), kLinearQuadTreeDepth, kQuadTreeLeafCapacity);
+        case QuadTreeIndex:
+        default:
+            return std::make_unique<Spatial>(&nodes_, Box<T>(viewport_), quadtree_cell_size(), kQuadTreeLeafCapacity);
+    }
+}
+
+
+// the quadtree's leaves are sized to the finest road spacing, not to the
+// viewport, so a map tens of kilometres across is as fast to query
+template<typename T>
+double TRoadGenerator<T>::quadtree_cell_size() const {
+    double d_sep = std::numeric_limits<double>::max();
+    for (const auto& [_, params] : params_) {
+        d_sep = std::min(d_sep, params.d_sep);
+    }
+    return d_sep/kQuadTreeCellsPerSep;
+}
+
+
+template<typename T>
+bool TRoadGenerator<T>::in_bounds(const Vec& p) const {
+    return viewport_.contains(DVector2(p));
+}
+
+
+template<typename T>
+bool TRoadGenerator<T>::has_nearby_point(const Vec& p, T radius, Direction dir) const {
+    if (segment_separation_) return has_nearby_segment(p, radius, dir);
+
+    if (!concurrent_ || snapshot_reads_) {
+        return spatial_->has_nearby_point(p, radius, dir);
+    }
+
+    std::shared_lock lock(spatial_mutex_);
+    return spatial_->has_nearby_point(p, radius, dir);
+}
+
+
+template<typename T>
+bool TRoadGenerator<T>::has_nearby_point(const Vec& p, T radius, Direction dir, SpatialCursor& cursor) const {
+    if (segment_separation_) return has_nearby_segment(p, radius, dir);
+
+    if (!concurrent_ || snapshot_reads_) {
+        return spatial_->has_nearby_point(p, radius, dir, cursor);
+    }
+
+    std::shared_lock lock(spatial_mutex_);
+    return spatial_->has_nearby_point(p, radius, dir, cursor);
+}
+
+
+// the segment grid has no snapshot reads, so pipelined mode always locks
+template<typename T>
+bool TRoadGenerator<T>::has_nearby_segment(const Vec& p, T radius, Direction dir) const {
+    if (!concurrent_) {
+        return segments_->has_nearby_segment(p, radius, dir);
+    }
+
+    std::shared_lock lock(spatial_mutex_);
+    return segments_->has_nearby_segment(p, radius, dir);
 }
 
 
-void RoadGenerator::add_candidate_seed(node_id id, Direction dir) {
-    DVector2 seed = nodes_[id].pos;
+template<typename T>
+void TRoadGenerator<T>::add_candidate_seed(node_id id, Direction dir) {
+    Vec seed = nodes_.pos(id);
     seeds_[dir].push(seed);
 }
 
 
-std::optional<DVector2> 
-RoadGenerator::get_seed(RoadType road, Direction dir) {
-    seed_queue& candidate_queue = seeds_[dir];
+template<typename T>
+std::optional<TVector2<T>>
+TRoadGenerator<T>::get_seed(RoadType road, Direction dir) {
+    SeedQueue& candidate_queue = seeds_[dir];
 
-    DVector2 seed;
+    Vec seed;
     while (!candidate_queue.empty()) {
-        DVector2 seed = candidate_queue.front();
-        candidate_queue.pop();
-        if (!spatial_.has_nearby_point(seed, params_.at(road).d_sep, dir)) {
+        Vec seed = candidate_queue.pop();
+        if (!has_nearby_point(seed, params_.at(road).d_sep, dir)) {
             return seed;
         } 
     }
 
 
     for (int count=0; count<params_.at(road).max_seed_retries; count++) {
-        seed = DVector2 {
+        seed = Vec(DVector2 {
             dist_(gen_)*viewport_.width()  + viewport_.min.x,
             dist_(gen_)*viewport_.height() + viewport_.min.y
-        };
+        });
 
 
-        if (!spatial_.has_nearby_point(seed, params_.at(road).d_sep, dir)) {
+        if (!has_nearby_point(seed, params_.at(road).d_sep, dir)) {
             return seed;
         } 
     }
@@ -79,20 +165,20 @@ RoadGenerator::get_seed(RoadType road, Direction dir) {
 }
 
 
-void RoadGenerator::extend_streamline(
+// moves the front dl along the field, keeping the way it was going. false
+// if the field gives out there. replay() steps with this too, which is what
+// brings it out on exactly the same points
+template<typename T>
+bool TRoadGenerator<T>::integration_step(
+    const NumericalFieldIntegrator& integrator,
     Integration& res,
-    const RoadType& road, 
-    const Direction& dir
-) const {
-    if (res.status != Continue) {
-        res.status = Abort;
-        return;
-    };
-
-    DVector2 delta = integrator_->integrate(
+    Direction dir,
+    double dl
+) {
+    Vec delta = integrator.integrate(
         res.integration_front, 
         dir, 
-        params_.at(road).dl
+        dl
     );
 
     if (res.negate) 
@@ -102,29 +188,47 @@ void RoadGenerator::extend_streamline(
         delta = delta*-1.0;
     }
 
-    if (dot_product(delta, delta) < 0.01) {
+    if (dot_product(delta, delta) < 0.01) return false;
+
+    res.integration_front = res.integration_front + delta;
+    res.delta = delta;
+    return true;
+}
+
+
+template<typename T>
+void TRoadGenerator<T>::extend_streamline(
+    Integration& res,
+    const RoadType& road, 
+    const Direction& dir
+) const {
+    if (res.status != Continue) {
+        res.status = Abort;
+        return;
+    };
+
+    if (!integration_step(*integrator_, res, dir, params_.at(road).dl)) {
         res.status = Abort;
         return;
     }
 
-    res.integration_front = res.integration_front + delta;
-    res.delta = delta;
     if (!in_bounds(res.integration_front)) {
         res.status = Abort;
         return;
     }
 
     res.status = Continue;
-    if (spatial_.has_nearby_point(res.integration_front, params_.at(road).d_test, dir)) {
+    if (has_nearby_point(res.integration_front, params_.at(road).d_test, dir, res.cursor)) {
         res.status = Terminate;
     }
 }
 
 
-std::optional<std::list<DVector2>>
-RoadGenerator::generate_streamline(RoadType road, DVector2 seed_point, Direction dir) {
-    Integration forward  (seed_point, false);
-    Integration backward (seed_point, true );
+template<typename T>
+std::optional<ArenaList<TVector2<T>>>
+TRoadGenerator<T>::generate_streamline(RoadType road, Vec seed_point, Direction dir, StreamlineRecipe& recipe) {
+    Integration forward  (seed_point, false, &trace_arena_);
+    Integration backward (seed_point, true,  &trace_arena_);
 
     // circle logic
     bool points_diverged = false;
@@ -150,24 +254,35 @@ RoadGenerator::generate_streamline(RoadType road, DVector2 seed_point, Direction
         }
 
 
-        DVector2 ends_diff = forward.points.back() - backward.points.front();
+        Vec ends_diff = forward.points.back() - backward.points.front();
         double sep2 = dot_product(ends_diff, ends_diff);
 
         if (points_diverged && sep2 < params_.at(road).d_circle2) {
-            join = true;
+            // an end that stopped against another road this step stays an
+            // end, joining past it would bury it inside the circle
+            join = forward.status == Continue && backward.status == Continue;
             break;
         } else if (!points_diverged && sep2 > params_.at(road).d_circle2) {
             points_diverged = true;
         }
     }
 
+    recipe = StreamlineRecipe{};
+    recipe.seed = DVector2(seed_point);
+    recipe.forward = forward.points.size() - 1;
+    recipe.backward = backward.points.size() - 1;
+    recipe.road = road;
+    recipe.dir = dir;
+    recipe.traced = true;
+    recipe.circle = join;
+
     backward.points.pop_back(); // remove shared start point
 
     if (join) {
         forward.points.push_back(backward.points.back()); // join up streamlines
     }
 
-    std::list<DVector2> result;
+    Points result(&trace_arena_);
 
     result.splice(result.end(), backward.points);
     result.splice(result.end(), forward.points);
@@ -178,45 +293,462 @@ RoadGenerator::generate_streamline(RoadType road, DVector2 seed_point, Direction
 }
 
 
-int RoadGenerator::generate_streamlines(RoadType road) {
-    Direction dir = Major;
+// generate_streamline() with the step counts it came to in place of the
+// spacing checks, then simplified and joined as it was
+template<typename T>
+std::vector<TVector2<T>> TRoadGenerator<T>::replay(
+    const StreamlineRecipe& recipe,
+    const NumericalFieldIntegrator& integrator,
+    const GeneratorParameters& params
+) {
+    assert(recipe.traced);
+
+    Vec seed(recipe.seed);
+    Integration forward  (seed, false, {});
+    Integration backward (seed, true,  {});
+
+    for (std::uint32_t i = 0; i < recipe.forward; ++i) {
+        integration_step(integrator, forward, recipe.dir, params.dl);
+        forward.points.push_back(forward.integration_front);
+    }
+
+    for (std::uint32_t i = 0; i < recipe.backward; ++i) {
+        integration_step(integrator, backward, recipe.dir, params.dl);
+        backward.points.push_front(backward.integration_front);
+    }
+
+    backward.points.pop_back();
+    if (recipe.circle) {
+        forward.points.push_back(backward.points.back());
+    }
+
+    Points points;
+    points.splice(points.end(), backward.points);
+    points.splice(points.end(), forward.points);
+    douglas_peucker(params.epsilon, params.node_sep2, points, points.begin(), points.end());
+
+    if (recipe.joined_front) points.push_front(Vec(recipe.front_join));
+    if (recipe.joined_back) points.push_back(Vec(recipe.back_join));
+
+    return {points.begin(), points.end()};
+}
+
+
+// seed -> trace -> simplify -> push. returns the new streamline's index, or
+// nothing if it came out too short.
+template<typename T>
+std::optional<int>
+TRoadGenerator<T>::trace_streamline(RoadType road, Vec seed, Direction dir) {
+    StreamlineRecipe recipe;
+    std::optional<Points> new_streamline
+        = generate_streamline(road, seed, dir, recipe);
+
+    if (!new_streamline.has_value()) return {};
+
+    simplify_streamline(road, new_streamline.value());
+
+    if (new_streamline.value().size() < min_streamline_size_) return {};
+
+    return push_streamline(road, new_streamline.value(), dir, &recipe);
+}
 
-    std::optional<DVector2> seed = get_seed(road, dir);
-    int k = 0;
-    while (seed.has_value()) {
-        std::optional<std::list<DVector2>> new_streamline
-            = generate_streamline(road, seed.value(), dir);
 
-        if (new_streamline.has_value()) {
-            simplify_streamline(road, new_streamline.value());
+template<typename T>
+void TRoadGenerator<T>::begin_generation() {
+    clear();
+
+    spatial_->reset(Box<T>(viewport_));
+    nodes_.reset(middle(viewport_.min, viewport_.max));
+
+    std::sort(road_types_.begin(), road_types_.end());
+
+    state_.started = true;
+    pipeline_ = pipelined_ ? pipelined() : pipeline();
+}
+
+
+// the one generation pipeline. yields every committed streamline, then every
+// streamline whose endpoints were joined once its road type is finished.
+template<typename T>
+Generator<CommittedStreamline> TRoadGenerator<T>::pipeline() {
+    for (; state_.road_idx < road_types_.size(); ++state_.road_idx) {
+        RoadType road = road_types_[state_.road_idx];
+
+        while (!state_.truncate) {
+            std::optional<Vec> seed = get_seed(road, state_.dir);
+            if (!seed.has_value()) break;
+
+            std::optional<int> index = trace_streamline(road, seed.value(), state_.dir);
+            if (!index.has_value()) continue;
 
-            if (new_streamline.value().size() >= min_streamline_size_) {
-                push_streamline(road, new_streamline.value(), dir);
-                k += 1;
-                dir = flip(dir);
+            Direction dir = state_.dir;
+            state_.committed += 1;
+            state_.dir = flip(state_.dir);
+
+            co_yield CommittedStreamline{road, dir, index.value()};
+        }
+
+        // no braced list here, its backing array would not survive a co_yield
+        state_.connecting = true;
+        Direction dirs[2] = {Major, Minor};
+        for (Direction dir : dirs) {
+            for (int index : connect_roads(road, dir)) {
+                co_yield CommittedStreamline{road, dir, index};
             }
         }
-        
-        seed = get_seed(road, dir);
+        state_.connecting = false;
+        state_.dir = Major; // the next road starts on major, a resumed one where it was
+
+        if (state_.truncate) break;
+    }
+
+    state_.done = true;
+}
+
+
+//  SECTION: pipelined generation
+
+void QueueStats::sample(std::size_t occupancy) {
+    high_water = std::max(high_water, occupancy);
+    total += occupancy;
+    samples += 1;
+}
+
+
+double QueueStats::mean() const {
+    return samples ? static_cast<double>(total)/samples : 0.0;
+}
+
+
+std::ostream& operator<<(std::ostream& os, const PipelineStats& stats) {
+    auto stage = [&os](const char* name, const StageStats& s) {
+        double busy_ms = std::chrono::duration<double, std::milli>(s.busy).count();
+        double idle_ms = std::chrono::duration<double, std::milli>(s.idle).count();
+        os << name << ": " << s.items << " items, "
+           << busy_ms << "ms busy ("
+           << (s.items ? busy_ms*1000.0/s.items : 0.0) << "us/item), "
+           << idle_ms << "ms idle" << std::endl;
     };
 
+    stage("trace", stats.trace);
+    stage("simplify", stats.simplify);
+    stage("insert", stats.insert);
+
+    os << "traced queue: mean " << stats.traced.mean()
+       << ", high water " << stats.traced.high_water << std::endl;
+    os << "simplified queue: mean " << stats.simplified.mean()
+       << ", high water " << stats.simplified.high_water << std::endl;
+    os << "conflicts: " << stats.conflicts << std::endl;
+
+    return os;
+}
+
+
+// queues and threads for one road type. destroying it stops and joins the
+// stage threads, including when the pipeline coroutine is dropped early.
+template<typename T>
+struct TRoadGenerator<T>::PipelineRun {
+    SPSCQueue<TracedStreamline> traced;
+    SPSCQueue<TracedStreamline> simplified;
+    SPSCQueue<ReturnedSeed> seeds;
+
+    std::atomic<int> committed = 0;
+    std::atomic<int> in_flight = 0;
+    std::atomic<bool> stop = false;      // stop tracing, drain what is in flight
+    std::atomic<bool> abandoned = false; // the insert stage has gone away
+
+    // [first, last) node ids of every commit, insert stage only
+    std::vector<std::pair<node_id, node_id>> commit_log;
+
+    std::thread trace_thread;
+    std::thread simplify_thread;
+
+    PipelineRun() :
+        traced(kPipelineQueueCapacity),
+        simplified(kPipelineQueueCapacity),
+        seeds(4*kPipelineQueueCapacity)
+    {}
+
+    ~PipelineRun() {
+        stop.store(true);
+        abandoned.store(true);
+        if (trace_thread.joinable()) trace_thread.join();
+        if (simplify_thread.joinable()) simplify_thread.join();
+    }
+};
+
+
+// same loop as pipeline(), but the insert stage runs here while streamline
+// N+1 is traced and N+2 simplified on the stage threads. a trace is only
+// committed if nothing committed since it started would have stopped it,
+// otherwise its seed goes back to be traced again.
+template<typename T>
+Generator<CommittedStreamline> TRoadGenerator<T>::pipelined() {
+    for (; state_.road_idx < road_types_.size(); ++state_.road_idx) {
+        RoadType road = road_types_[state_.road_idx];
+
+        concurrent_ = true;
+        snapshot_reads_ = !segment_separation_ && spatial_->set_concurrent(true);
+        trace_arena_.set_shared(true);
+        PipelineRun run;
+        run.trace_thread = std::thread(&TRoadGenerator::trace_stage, this, std::ref(run), road);
+        run.simplify_thread = std::thread(&TRoadGenerator::simplify_stage, this, std::ref(run), road);
+
+        StageStats& stats = pipeline_stats_.insert;
+        TracedStreamline t;
+        while (true) {
+            clock::time_point wait_start = clock::now();
+            while (!run.simplified.pop(t)) {
+                std::this_thread::yield();
+            }
+            clock::time_point start = clock::now();
+            stats.idle += start - wait_start;
+            pipeline_stats_.simplified.sample(run.simplified.size() + 1);
+
+            if (t.last) break;
+
+            if (state_.truncate) {
+                run.stop.store(true);
+            }
+
+            if (conflicts(run, road, t)) {
+                pipeline_stats_.conflicts += 1;
+                while (!run.seeds.push(ReturnedSeed{t.seed, t.dir})) {
+                    std::this_thread::yield();
+                }
+                run.in_flight.fetch_sub(1, std::memory_order_release);
+                stats.busy += clock::now() - start;
+                continue;
+            }
+
+            int index;
+            {
+                std::unique_lock lock(spatial_mutex_, std::defer_lock);
+                if (!snapshot_reads_) lock.lock();
+
+                node_id first = node_count();
+                index = commit_streamline(road, t.points, t.dir, &t.recipe);
+                run.commit_log.emplace_back(first, node_count());
+            }
+            run.committed.fetch_add(1, std::memory_order_release);
+
+            const Streamline& s = streamlines_[road].get_streamlines(t.dir)[index];
+            if (s.front() != s.back()) {
+                for (node_id id : {s.front(), s.back()}) {
+                    while (!run.seeds.push(ReturnedSeed{nodes_.pos(id), flip(t.dir)})) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+
+            // the seeds are visible to the trace stage before this leaves flight
+            run.in_flight.fetch_sub(1, std::memory_order_release);
+
+            state_.committed += 1;
+            stats.items += 1;
+            stats.busy += clock::now() - start;
+
+            co_yield CommittedStreamline{road, t.dir, index};
+        }
+
+        run.stop.store(true);
+        run.trace_thread.join();
+        run.simplify_thread.join();
+        concurrent_ = false;
+        snapshot_reads_ = false;
+        spatial_->set_concurrent(false);
+        trace_arena_.set_shared(false);
+
+        // keep leftover candidates, as the sequential pipeline would
+        ReturnedSeed returned;
+        while (run.seeds.pop(returned)) {
+            seeds_[returned.dir].push(returned.pos);
+        }
+
+        state_.connecting = true;
+        Direction dirs[2] = {Major, Minor};
+        for (Direction dir : dirs) {
+            for (int index : connect_roads(road, dir)) {
+                co_yield CommittedStreamline{road, dir, index};
+            }
+        }
+        state_.connecting = false;
+
+        if (state_.truncate) break;
+    }
+
+    state_.done = true;
+}
+
+
+template<typename T>
+void TRoadGenerator<T>::trace_stage(PipelineRun& run, RoadType road) {
+    StageStats& stats = pipeline_stats_.trace;
+    Direction dir = Major;
+
+    auto take_returned_seeds = [this, &run]() {
+        ReturnedSeed returned;
+        while (run.seeds.pop(returned)) {
+            seeds_[returned.dir].push(returned.pos);
+        }
+    };
+
+    while (!run.stop.load(std::memory_order_relaxed)) {
+        clock::time_point start = clock::now();
+
+        // read in_flight before the seeds it guards
+        bool settled = run.in_flight.load(std::memory_order_acquire) == 0;
+        take_returned_seeds();
+
+        std::optional<Vec> seed = get_seed(road, dir);
+        if (!seed.has_value()) {
+            stats.busy += clock::now() - start;
+            if (settled) break; // nothing in flight that could add seeds
+
+            clock::time_point wait_start = clock::now();
+            while (run.in_flight.load(std::memory_order_acquire) != 0
+                    && run.seeds.size() == 0
+                    && !run.stop.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+            stats.idle += clock::now() - wait_start;
+            continue;
+        }
+
+        TracedStreamline t {
+            dir,
+            seed.value(),
+            run.committed.load(std::memory_order_acquire),
+            {},
+            {},
+            {}
+        };
+
+        std::optional<Points> points = generate_streamline(road, t.seed, dir, t.recipe);
+        stats.busy += clock::now() - start;
+
+        if (!points.has_value()) continue;
+
+        t.trace = std::move(points.value());
+        run.in_flight.fetch_add(1, std::memory_order_relaxed);
+        stats.items += 1;
+
+        clock::time_point wait_start = clock::now();
+        while (!run.traced.push(std::move(t))) {
+            if (run.abandoned.load(std::memory_order_relaxed)) return;
+
+            // so the insert stage never blocks on a full seed queue
+            take_returned_seeds();
+            std::this_thread::yield();
+        }
+        stats.idle += clock::now() - wait_start;
+
+        dir = flip(dir);
+    }
+
+    TracedStreamline last {dir, {}, 0, {}, {}, {}, true};
+    while (!run.traced.push(std::move(last))) {
+        if (run.abandoned.load(std::memory_order_relaxed)) return;
+        take_returned_seeds();
+        std::this_thread::yield();
+    }
+}
+
+
+template<typename T>
+void TRoadGenerator<T>::simplify_stage(PipelineRun& run, RoadType road) {
+    StageStats& stats = pipeline_stats_.simplify;
+
+    TracedStreamline t;
+    while (true) {
+        clock::time_point wait_start = clock::now();
+        while (!run.traced.pop(t)) {
+            if (run.abandoned.load(std::memory_order_relaxed)) return;
+            std::this_thread::yield();
+        }
+        clock::time_point start = clock::now();
+        stats.idle += start - wait_start;
+        pipeline_stats_.traced.sample(run.traced.size() + 1);
+
+        if (!t.last) {
+            // the trace is kept whole for conflicts(), so simplify a copy
+            t.points = Points(t.trace.begin(), t.trace.end(), t.trace.get_allocator());
+            simplify_streamline(road, t.points);
+            stats.items += 1;
+            stats.busy += clock::now() - start;
+
+            if (t.points.size() < min_streamline_size_) {
+                run.in_flight.fetch_sub(1, std::memory_order_release);
+                continue;
+            }
+        }
+
+        bool last = t.last;
+        while (!run.simplified.push(std::move(t))) {
+            if (run.abandoned.load(std::memory_order_relaxed)) return;
+            std::this_thread::yield();
+        }
+        if (last) break;
+    }
+}
+
+
+// whether anything committed after t started tracing comes within d_test of
+// it, or within d_sep of its seed, i.e. whether tracing against the current
+// state could have produced it. judged on the whole trace, segment by
+// segment, as simplification can leave a road's kept nodes clear of a node
+// the steps between them came close to. insert stage only.
+template<typename T>
+bool TRoadGenerator<T>::conflicts(const PipelineRun& run, RoadType road, const TracedStreamline& t) const {
+    const GeneratorParameters& params = params_.at(road);
+
+    // nothing further than d_test from every step matters
+    Box<T> reach;
+    for (const Vec& p : t.trace) {
+        reach |= p;
+    }
+    Vec margin(T(params.d_test), T(params.d_test));
+    reach = Box<T>(reach.min - margin, reach.max + margin);
+
+    for (std::size_t i = t.epoch; i < run.commit_log.size(); ++i) {
+        auto [first, last] = run.commit_log[i];
+        if (nodes_.dir(first) != t.dir) continue;
+
+        for (node_id id = first; id < last; ++id) {
+            // with segment separation the road runs on to the next node,
+            // otherwise it is only the node itself
+            Vec pos = nodes_.pos(id);
+            Vec next = segment_separation_ && id + 1 < last ? nodes_.pos(id+1) : pos;
+
+            if (segment_distance2(t.seed, pos, next) < params.d_sep2) return true;
+
+            Box<T> committed = Box<T>(pos, pos) | next;
+            if (committed.min.x > reach.max.x || committed.max.x < reach.min.x
+                    || committed.min.y > reach.max.y || committed.max.y < reach.min.y) {
+                continue;
+            }
 
-    connect_roads(road, Major);
-    connect_roads(road, Minor);
+            for (auto p = t.trace.begin(), q = std::next(p); q != t.trace.end(); ++p, ++q) {
+                if (segment_distance2(*p, *q, pos, next) < params.d_test2) return true;
+            }
+        }
+    }
 
-    return k;
+    return false;
 }
 
 
-void RoadGenerator::simplify_streamline(RoadType road, std::list<DVector2>& points) const {
+template<typename T>
+void TRoadGenerator<T>::simplify_streamline(RoadType road, Points& points) const {
     assert(params_.at(road).epsilon > 0.0);
     douglas_peucker(params_.at(road).epsilon, params_.at(road).node_sep2, points, points.begin(), points.end());
 }
 
 
-void RoadGenerator::douglas_peucker(const double& epsilon, const double& min_sep2, 
-        std::list<DVector2>& points,
-        std::list<DVector2>::iterator begin, std::list<DVector2>::iterator end) const 
+template<typename T>
+void TRoadGenerator<T>::douglas_peucker(const double& epsilon, const double& min_sep2, 
+        Points& points,
+        typename Points::iterator begin, typename Points::iterator end)
 {
     // must be 3> elements 
     int count = 0;
@@ -225,11 +757,11 @@ void RoadGenerator::douglas_peucker(const double& epsilon, const double& min_sep
 
     auto last_elem = std::prev(end);
 
-    const DVector2& first_pos = *begin;
-    const DVector2& last_pos  = *last_elem;
+    const Vec& first_pos = *begin;
+    const Vec& last_pos  = *last_elem;
 
     double d_max = 0.0;
-    std::list<DVector2>::iterator index;
+    typename Points::iterator index;
 
 
     for (auto it=std::next(begin); it != last_elem; ++it) {
@@ -249,7 +781,7 @@ void RoadGenerator::douglas_peucker(const double& epsilon, const double& min_sep
             auto next = std::next(it);
 
             auto prev = std::prev(it);
-            DVector2 diff = *it - *prev;
+            Vec diff = *it - *prev;
             double dist2 = dot_product(diff, diff);
 
             if (dist2 < min_sep2) points.erase(it);
@@ -260,151 +792,166 @@ void RoadGenerator::douglas_peucker(const double& epsilon, const double& min_sep
 }
 
 
-void RoadGenerator::push_streamline(RoadType road, std::list<DVector2>& points, Direction dir) {
+// appends the nodes, indexes them and adds the streamline, without seeding.
+// without a recipe it is kept as drawn
+template<typename T>
+int TRoadGenerator<T>::commit_streamline(RoadType road, Points& points, Direction dir, const StreamlineRecipe* recipe) {
     int new_streamline_id = streamlines_[road].size(dir);
+    int global_streamline_id = streamline_count();
     int new_node_id = node_count();
-    Streamline out;
-    for (const DVector2& vec : points) {
+
+    StreamlineRecipe& made = recipes_.emplace_back(recipe ? *recipe : StreamlineRecipe{});
+    made.road = road;
+    made.dir = dir;
+    made.bounds = {};
+
+    Streamline out{Streamline::allocator_type(&streamline_arena_)};
+    for (const Vec& vec : points) {
+        made.bounds |= DVector2(vec);
         nodes_.push_back(StreamlineNode{
-            vec,
-            new_streamline_id,
-            dir
+            DVector2(vec),
+            global_streamline_id,
+            dir,
+            road
         });
         out.push_back(new_node_id);
         ++new_node_id;
     }
 
-    spatial_.insert_streamline(out, dir);
-   
-    if (out.front() != out.back()) {
-        add_candidate_seed(out.front(), flip(dir));
-        add_candidate_seed(out.back(), flip(dir));
+    spatial_->insert_streamline(out);
+    if (segment_separation_) {
+        segments_->insert_streamline(out);
     }
 
     streamlines_[road].add(out, dir);
+    return new_streamline_id;
 }
 
-// standard joining candidate algorithm
-std::optional<node_id>
-RoadGenerator::joining_candidate(const double& rad, const double& max_node_sep2, const double& theta_max, 
-    const DVector2& pos, const DVector2& road_direction, const std::unordered_set<node_id>& forbidden) const 
-{
-    std::list<node_id> nearby = 
-        spatial_.nearby_points(pos, rad, Major | Minor);
-
-    std::optional<node_id> best_node;
-    double min_dist2 = std::numeric_limits<double>::infinity();
-
-    for (const node_id& candidate_id : nearby) {
-        if (forbidden.contains(candidate_id)) continue;
 
-        DVector2 join_vector = nodes_[candidate_id].pos-pos;
-        
-        if (dot_product(join_vector, road_direction) < 0) continue; // opposite directions.
-
-        double d2 = dot_product(join_vector, join_vector);
-
-        if (d2 < max_node_sep2)
-            return candidate_id;
-
-
-        double theta = std::abs(vector_angle(road_direction, join_vector));
+template<typename T>
+int TRoadGenerator<T>::push_streamline(RoadType road, Points& points, Direction dir, const StreamlineRecipe* recipe) {
+    int index = commit_streamline(road, points, dir, recipe);
+    const Streamline& s = streamlines_[road].get_streamlines(dir)[index];
 
-        if (theta < theta_max && d2 < min_dist2) {
-            min_dist2 = d2;
-            best_node = candidate_id;
-        }
+    if (s.front() != s.back()) {
+        add_candidate_seed(s.front(), flip(dir));
+        add_candidate_seed(s.back(), flip(dir));
     }
 
-    return best_node;
+    return index;
 }
 
-void RoadGenerator::connect_roads(RoadType road, Direction dir) {
-    int k = 0;
-    for (Streamline& s : streamlines_[road].get_streamlines(dir)) {
-        if (s.front() == s.back()) continue; // ignore circles
+// standard joining candidate algorithm: the nearest node ahead of the road
+// that is either within node_sep or inside the joining cone. the road's own
+// streamline is pruned by the index, so it never joins onto itself
+template<typename T>
+std::optional<node_id>
+TRoadGenerator<T>::joining_candidate(const double& rad, const double& max_node_sep2, const double& theta_max, 
+    const Vec& pos, const Vec& road_direction, int own_streamline) const 
+{
+    SpatialFilter filter(Major | Minor);
+    filter.exclude_streamline = own_streamline;
+
+    return spatial_->nearest_point(pos, rad, filter, [&](node_id candidate_id) {
+        Vec join_vector = nodes_.pos(candidate_id)-pos;
         
-        DVector2 front_pos = nodes_[s.front()].pos;
-        DVector2 back_pos = nodes_[s.back()].pos;
+        if (dot_product(join_vector, road_direction) < 0) return false; // opposite directions.
 
-        std::unordered_set<node_id> front_forbidden;
-        std::unordered_set<node_id> back_forbidden;
+        if (dot_product(join_vector, join_vector) < max_node_sep2) return true;
 
+        return std::abs(vector_angle(road_direction, join_vector)) < theta_max;
+    });
+}
 
-        // first min_streamline_size_ nodes
-        Streamline::iterator last_front_forbidden = std::next(s.begin(), min_streamline_size_-1);
-        for (auto it = s.begin(); it != last_front_forbidden; ++it) {
-            front_forbidden.insert(*it);
-        }
+template<typename T>
+typename TRoadGenerator<T>::EndJoins TRoadGenerator<T>::find_joins(RoadType road, const Streamline& s) const {
+    if (s.front() == s.back()) return {}; // ignore circles
 
-        // DVector2 front_direction = front_pos - nodes_[*std::prev(last_forbidden)].pos;
-        DVector2 front_direction = front_pos - nodes_[*last_front_forbidden].pos;
-        
+    const GeneratorParameters& params = params_.at(road);
 
+    Vec front_pos = nodes_.pos(s.front());
+    Vec back_pos = nodes_.pos(s.back());
 
-        Streamline::iterator last_back_forbidden = std::prev(s.end(), min_streamline_size_);
-        for (auto it = std::prev(s.end()); it != last_back_forbidden; ++it) {
-            back_forbidden.insert(*it);
-        }
+    // min_streamline_size_ nodes in from each end
+    Streamline::const_iterator last_front = std::next(s.begin(), min_streamline_size_-1);
+    Vec front_direction = front_pos - nodes_.pos(*last_front);
+
+    Streamline::const_iterator last_back = std::prev(s.end(), min_streamline_size_);
+    Vec back_direction = back_pos - nodes_.pos(*last_back);
 
+    // inner nodes always belong to s itself, its ends may be joins
+    int own_streamline = nodes_.streamline(*last_front);
 
-        DVector2 back_direction = back_pos - nodes_[*last_back_forbidden].pos;
+    return {
+        joining_candidate(params.d_lookahead, params.node_sep2, params.theta_max,
+            front_pos, front_direction, own_streamline),
+        joining_candidate(params.d_lookahead, params.node_sep2, params.theta_max,
+            back_pos, back_direction, own_streamline)
+    };
+}
 
 
-        std::optional<node_id> front_join 
-            = joining_candidate(params_.at(road).d_lookahead, params_.at(road).node_sep2, params_.at(road).theta_max,
-                    front_pos, front_direction, front_forbidden);    
-        std::optional<node_id> back_join
-            = joining_candidate(params_.at(road).d_lookahead, params_.at(road).node_sep2, params_.at(road).theta_max,
-                    back_pos, back_direction, back_forbidden);
+// returns the indices of the streamlines that were joined. a join only
+// adds an id to the end of its own streamline, the nodes and the index
+// stay as they are, so every candidate can be found at once on as many
+// threads as there is work for. the indices are good until the next call
+template<typename T>
+const std::vector<int>& TRoadGenerator<T>::connect_roads(RoadType road, Direction dir) {
+    std::vector<Streamline>& sls = streamlines_[road].get_streamlines(dir);
+    joined_.clear();
+    int k = 0;
 
-        if (front_join.has_value()) {
-            // connect(s, s.front(), front_join.value());
-            s.push_front(front_join.value());
+    joins_.assign(sls.size(), EndJoins{});
+    parallel_for(sls.size(), chunk_count(sls.size(), kJoinGrain), [&](int, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            joins_[i] = find_joins(road, sls[i]);
+        }
+    });
+
+    for (std::size_t i = 0; i < sls.size(); ++i) {
+        Streamline& s = sls[i];
+        const EndJoins& found = joins_[i];
+        StreamlineRecipe& recipe = recipes_[nodes_.streamline(s.front())];
+
+        if (found.front.has_value()) {
+            // connect(s, s.front(), found.front.value());
+            s.push_front(found.front.value());
+            recipe.joined_front = true;
+            recipe.front_join = DVector2(nodes_.pos(found.front.value()));
+            recipe.bounds |= recipe.front_join;
             ++k;
         }
 
-        if (back_join.has_value()) {
-            // connect(s, s.back(), back_join.value());
-            s.push_back(back_join.value());
+        if (found.back.has_value()) {
+            // connect(s, s.back(), found.back.value());
+            s.push_back(found.back.value());
+            recipe.joined_back = true;
+            recipe.back_join = DVector2(nodes_.pos(found.back.value()));
+            recipe.bounds |= recipe.back_join;
             ++k;
         }
 
+        if (found.front.has_value() || found.back.has_value()) {
+            joined_.push_back(static_cast<int>(i));
+        }
     }
 
     std::cout << "Connected " << k << " roads" <<std::endl;
+    return joined_;
 }
 
 
-// void RoadGenerator::add_intersections(RoadType road, Direction dir, Streamline& s) {
-//     const double& sep = params_.at(road).node_sep;
-//
-//     for (auto it = s.begin(); it != s.end(); ++it) {
-//         std::list<node_id> nearby_opposite_dir = spatial_.nearby_points(nodes_[*it].pos, sep, flip(dir));
-//         if (nearby_opposite_dir.empty()) continue;
-//
-//         // create shared point
-//         std::optional<node_id> closest;
-//         double d_min = 
-//
-//         for (const node_id& id : nearby_opposite_dir) {
-//             if (dot_product(const TVector2<T> &a, const TVector2<T> &b))
-//         }
-//     }
-// }
-
-
-RoadGenerator::RoadGenerator(
+template<typename T>
+TRoadGenerator<T>::TRoadGenerator(
         std::unique_ptr<NumericalFieldIntegrator>& integrator,
         std::unordered_map<RoadType, GeneratorParameters> parameters,
         Box<double> viewport
         ) :
     viewport_(viewport),
     integrator_(std::move(integrator)),
-    nodes_(std::vector<StreamlineNode>{}),
     params_(parameters),
     dist_(0.0, 1.0),
-    spatial_(Spatial(&nodes_, viewport_, kQuadTreeDepth, kQuadTreeLeafCapacity))
+    spatial_(std::make_unique<Spatial>(&nodes_, Box<T>(viewport_), quadtree_cell_size(), kQuadTreeLeafCapacity))
 {
     road_types_.reserve(parameters.size());
     streamlines_.reserve(parameters.size());
@@ -415,41 +962,104 @@ RoadGenerator::RoadGenerator(
         params.d_test = std::min(params.d_test, params.d_sep);
         road_types_.push_back(key);
     }
+
+    nodes_.reset(middle(viewport_.min, viewport_.max));
+    segments_ = std::make_unique<SegmentGrid>(&nodes_, grid_cell_sizes());
+
+    std::sort(road_types_.begin(), road_types_.end());
 }
 
 
+template<typename T>
 const std::vector<RoadType>&
-RoadGenerator::get_road_types() const {
+TRoadGenerator<T>::get_road_types() const {
     return road_types_;
 }
 
 
+template<typename T>
 const std::unordered_map<RoadType, GeneratorParameters>&
-RoadGenerator::get_parameters() const {
+TRoadGenerator<T>::get_parameters() const {
     return params_;
 }
 
 
-const StreamlineNode&
-RoadGenerator::get_node(node_id i) const {
+template<typename T>
+StreamlineNode
+TRoadGenerator<T>::get_node(node_id i) const {
     assert(0 <= i && i < nodes_.size());
     return nodes_[i];
 }
 
 
+template<typename T>
 const std::vector<Streamline>& 
-RoadGenerator::get_streamlines(RoadType road, Direction dir) {
+TRoadGenerator<T>::get_streamlines(RoadType road, Direction dir) {
     return streamlines_[road].get_streamlines(dir);
 }
 
 
-int RoadGenerator::node_count() const {
+template<typename T>
+std::vector<TVector2<T>>
+TRoadGenerator<T>::get_polyline(RoadType road, Direction dir, int index) {
+    const Streamline& s = get_streamlines(road, dir)[index];
+
+    std::vector<Vec> out;
+    out.reserve(s.size());
+    for (const node_id& id : s) {
+        out.push_back(nodes_.pos(id));
+    }
+    return out;
+}
+
+
+template<typename T>
+const std::vector<StreamlineRecipe>& TRoadGenerator<T>::get_recipes() const {
+    return recipes_;
+}
+
+
+template<typename T>
+RoadGraph TRoadGenerator<T>::road_graph() {
+    std::vector<const Streamline*> all;
+    for (const RoadType& road : road_types_) {
+        for (Direction dir : {Major, Minor}) {
+            for (const Streamline& s : get_streamlines(road, dir)) {
+                all.push_back(&s);
+            }
+        }
+    }
+
+    return build_road_graph(nodes_, all);
+}
+
+
+// junctions closer than the simplification tolerance are one, and dead
+// ends shorter than the finest road spacing are overshoot from joining
+template<typename T>
+RoadGraph TRoadGenerator<T>::road_network() {
+    GraphCleanup cleanup;
+    cleanup.merge_radius = std::numeric_limits<double>::max();
+    cleanup.min_stub_length = std::numeric_limits<double>::max();
+    for (const auto& [_, params] : params_) {
+        cleanup.merge_radius = std::min(cleanup.merge_radius, params.epsilon);
+        cleanup.min_stub_length = std::min(cleanup.min_stub_length, params.d_sep);
+    }
+
+    std::vector<RoadGraph::vertex_id> remap;
+    return clean_road_graph(road_graph(), cleanup, remap);
+}
+
+
+template<typename T>
+int TRoadGenerator<T>::node_count() const {
     return nodes_.size();
 }
 
 
-int RoadGenerator::streamline_count() const {
-    int count;
+template<typename T>
+int TRoadGenerator<T>::streamline_count() const {
+    int count = 0;
     for (const RoadType& road : road_types_) {
         if (!streamlines_.contains(road)) continue;
         count += streamlines_.at(road).size(Major);
@@ -459,53 +1069,301 @@ int RoadGenerator::streamline_count() const {
 }
 
 
-void RoadGenerator::set_viewport(Box<double> new_viewport) {
+template<typename T>
+void TRoadGenerator<T>::set_viewport(Box<double> new_viewport) {
     viewport_ = std::move(new_viewport);
 }
 
 
-bool RoadGenerator::generation_step(RoadType road, Direction dir) {
-    std::optional<DVector2> seed = get_seed(road, dir);
-    if (!seed.has_value()) {
-        return false;
-    }
+template<typename T>
+void TRoadGenerator<T>::set_seed(unsigned seed) {
+    gen_.seed(seed);
+    dist_.reset();
+}
 
 
-    std::optional<std::list<DVector2>> new_streamline
-        = generate_streamline(road, seed.value(), dir);
+template<typename T>
+void TRoadGenerator<T>::set_spatial_backend(SpatialBackend backend) {
+    clear();
+    spatial_backend_ = backend;
+    spatial_ = make_spatial_index();
+}
 
-    if (!new_streamline.has_value()) {
-        return false;
+
+template<typename T>
+void TRoadGenerator<T>::set_segment_separation(bool segments) {
+    clear();
+    segment_separation_ = segments;
+}
+
+
+template<typename T>
+void TRoadGenerator<T>::set_pipelined(bool pipelined) {
+    pipelined_ = pipelined;
+}
+
+
+template<typename T>
+const PipelineStats& TRoadGenerator<T>::get_pipeline_stats() const {
+    return pipeline_stats_;
+}
+
+
+template<typename T>
+std::optional<CommittedStreamline> TRoadGenerator<T>::generation_step() {
+    if (!state_.started) {
+        begin_generation();
     }
 
-    push_streamline(road, new_streamline.value(), dir);
-    return true;
+    if (!pipeline_.next()) return {};
+
+    return pipeline_.value();
 }
 
 
-void RoadGenerator::generate() {
-    clear();
+template<typename T>
+void TRoadGenerator<T>::generate() {
+    generate(clock::time_point::max());
+}
 
-    spatial_.reset(viewport_);
 
-    std::sort(road_types_.begin(), road_types_.end());
+// road types are traced in priority order, so when the deadline hits the
+// current road type is connected up as far as it got and the rest are dropped.
+template<typename T>
+GenerationProgress TRoadGenerator<T>::generate(clock::time_point deadline) {
+    begin_generation();
 
-    for (auto r : road_types_) {
-        generate_streamlines(r);
+    while (pipeline_.next()) {
+        if (clock::now() >= deadline) {
+            state_.truncate = true;
+        }
     }
 
     std::cout << "node count: " << node_count() << std::endl;
     std::cout << "streamline count: " << streamline_count() << std::endl;
+    if (pipelined_) std::cout << pipeline_stats_;
+
+    return get_progress();
+}
+
+
+// continues from wherever the last call stopped, starting a new generation
+// if none is in progress.
+template<typename T>
+GenerationProgress TRoadGenerator<T>::generate_for(std::chrono::nanoseconds budget) {
+    clock::time_point deadline = clock::now() + budget;
+
+    if (!state_.started) {
+        begin_generation();
+    }
+
+    while (clock::now() < deadline && pipeline_.next());
+
+    return get_progress();
+}
+
+
+template<typename T>
+GenerationProgress TRoadGenerator<T>::get_progress() const {
+    return GenerationProgress {
+        static_cast<int>(state_.road_idx),
+        static_cast<int>(road_types_.size()),
+        state_.committed,
+        state_.done
+    };
 }
 
 
-void RoadGenerator::clear() {
-    // empty everything
-    seeds_.clear();
-    seeds_.reserve(2);
+template<typename T>
+void TRoadGenerator<T>::clear() {
+    // stops any pipeline stage threads before their state goes
+    pipeline_ = {};
+    concurrent_ = false;
+    snapshot_reads_ = false;
+    spatial_->set_concurrent(false);
+    trace_arena_.set_shared(false);
+
+    // empty everything, keeping what it was kept in
+    for (auto& [_, seeds] : seeds_) {
+        seeds.clear();
+    }
 
     nodes_.clear();
 
-    streamlines_.clear();
-    spatial_.clear();
+    for (auto& [_, streamlines] : streamlines_) {
+        streamlines.clear();
+    }
+    recipes_.clear();
+    spatial_->clear();
+    segments_->clear();
+
+    // nothing is left in either
+    streamline_arena_.reset();
+    trace_arena_.reset();
+
+    state_ = GenerationState{};
+    pipeline_stats_ = {};
 }
+
+
+//  SECTION: snapshots
+
+template<typename T>
+bool TRoadGenerator<T>::save(const std::string& path) {
+    // in flight traces and half joined roads are not in any of the state
+    if (concurrent_ || state_.connecting) {
+        std::cout << "cannot snapshot while streamlines are in flight" << std::endl;
+        return false;
+    }
+
+    SnapshotWriter out;
+    std::size_t n = nodes_.size();
+
+    std::vector<typename NodeStore::coord> xs(n), ys(n);
+    std::vector<int> node_streamlines(n);
+    std::vector<Direction> node_dirs(n);
+    std::vector<std::uint8_t> node_roads(n);
+    for (node_id id = 0; id < n; ++id) {
+        xs[id] = nodes_.stored_x(id);
+        ys[id] = nodes_.stored_y(id);
+        node_streamlines[id] = nodes_.streamline(id);
+        node_dirs[id] = nodes_.dir(id);
+        node_roads[id] = static_cast<std::uint8_t>(nodes_.road(id));
+    }
+
+    std::vector<SnapshotStreamline> streamlines;
+    std::vector<node_id> ids;
+    for (RoadType road : road_types_) {
+        for (Direction dir : {Major, Minor}) {
+            for (const Streamline& s : get_streamlines(road, dir)) {
+                streamlines.push_back({ids.size(), static_cast<std::uint32_t>(s.size()), road, dir});
+                ids.insert(ids.end(), s.begin(), s.end());
+            }
+        }
+    }
+
+    std::vector<DVector2> seeds[2];
+    Direction dirs[2] = {Major, Minor};
+    for (int d = 0; d < 2; ++d) {
+        const SeedQueue& queue = seeds_[dirs[d]];
+        for (std::size_t i = queue.head; i < queue.items.size(); ++i) {
+            seeds[d].push_back(DVector2(queue.items[i]));
+        }
+    }
+
+    std::ostringstream random;
+    random << gen_ << ' ' << dist_;
+    std::string random_text = random.str();
+
+    SnapshotHeader sections {};
+    sections.xs = out.add<typename NodeStore::coord>(xs);
+    sections.ys = out.add<typename NodeStore::coord>(ys);
+    sections.node_streamlines = out.add<int>(node_streamlines);
+    sections.node_dirs = out.add<Direction>(node_dirs);
+    sections.node_roads = out.add<std::uint8_t>(node_roads);
+    sections.streamlines = out.add<SnapshotStreamline>(streamlines);
+    sections.ids = out.add<node_id>(ids);
+    sections.recipes = out.add<StreamlineRecipe>(recipes_);
+    sections.major_seeds = out.add<DVector2>(seeds[0]);
+    sections.minor_seeds = out.add<DVector2>(seeds[1]);
+    sections.random = out.add_bytes(random_text.data(), random_text.size());
+
+    // sections first, adding them can move the header
+    SnapshotHeader& h = out.header();
+    h.scalar_size = sizeof(T);
+    h.position_format = NodeStore::Positions::kFormat;
+    h.road_count = road_types_.size();
+    h.viewport = viewport_;
+    h.origin = nodes_.origin();
+    h.node_count = n;
+    h.road_idx = static_cast<std::int32_t>(state_.road_idx);
+    h.committed = state_.committed;
+    h.dir = state_.dir;
+    h.started = state_.started;
+    h.done = state_.done;
+
+    h.xs = sections.xs;
+    h.ys = sections.ys;
+    h.node_streamlines = sections.node_streamlines;
+    h.node_dirs = sections.node_dirs;
+    h.node_roads = sections.node_roads;
+    h.streamlines = sections.streamlines;
+    h.ids = sections.ids;
+    h.recipes = sections.recipes;
+    h.major_seeds = sections.major_seeds;
+    h.minor_seeds = sections.minor_seeds;
+    h.random = sections.random;
+
+    return out.write(path);
+}
+
+
+template<typename T>
+bool TRoadGenerator<T>::load(const GeneratorSnapshot& snapshot) {
+    const SnapshotHeader& h = snapshot.header();
+    if (h.scalar_size != sizeof(T)
+            || h.position_format != NodeStore::Positions::kFormat
+            || h.road_count != road_types_.size()) {
+        std::cout << "snapshot was saved by a different generator" << std::endl;
+        return false;
+    }
+
+    clear();
+    viewport_ = h.viewport;
+    spatial_->reset(Box<T>(viewport_));
+    nodes_.reset(h.origin);
+
+    auto xs = snapshot.stored_xs<typename NodeStore::Positions>();
+    auto ys = snapshot.stored_ys<typename NodeStore::Positions>();
+    for (node_id id = 0; id < h.node_count; ++id) {
+        nodes_.push_back_stored(xs[id], ys[id], snapshot.streamline(id), snapshot.dir(id), snapshot.road(id));
+    }
+
+    // a streamline's own nodes went in together, so each run of them is
+    // indexed as its commit was, without the joins added after
+    spatial_->insert_nodes(0, h.node_count);
+    if (segment_separation_) {
+        Streamline run{Streamline::allocator_type(&streamline_arena_)};
+        for (node_id id = 0; id < h.node_count; ++id) {
+            if (!run.empty() && nodes_.streamline(run.back()) != nodes_.streamline(id)) {
+                segments_->insert_streamline(run);
+                run.clear();
+            }
+            run.push_back(id);
+        }
+        if (!run.empty()) segments_->insert_streamline(run);
+    }
+
+    for (const SnapshotStreamline& s : snapshot.streamlines()) {
+        std::span<const node_id> ids = snapshot.ids(s);
+        Streamline out(ids.begin(), ids.end(), Streamline::allocator_type(&streamline_arena_));
+        streamlines_[s.road].add(out, s.dir);
+    }
+
+    std::span<const StreamlineRecipe> recipes = snapshot.recipes();
+    recipes_.assign(recipes.begin(), recipes.end());
+
+    for (Direction dir : {Major, Minor}) {
+        for (const DVector2& seed : snapshot.seeds(dir)) {
+            seeds_[dir].push(Vec(seed));
+        }
+    }
+
+    std::istringstream random{std::string(snapshot.random_state())};
+    random >> gen_ >> dist_;
+
+    state_.started = h.started;
+    state_.done = h.done;
+    state_.road_idx = h.road_idx;
+    state_.committed = h.committed;
+    state_.dir = h.dir;
+    if (state_.started && !state_.done) {
+        pipeline_ = pipelined_ ? pipelined() : pipeline();
+    }
+
+    return true;
+}
+
+
+template class TRoadGenerator<float>;
+template class TRoadGenerator<double>;
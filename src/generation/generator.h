@@ -1,20 +1,32 @@
 #ifndef GENERATOR_H
 #define GENERATOR_H
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
-#include <queue>
 #include <random>
+#include <shared_mutex>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "../types.h"
+#include "arena.h"
+#include "coroutine.h"
+#include "hash_grid.h"
 #include "integrator.h"
+#include "linear_quadtree.h"
 #include "node_storage.h"
+#include "road_graph.h"
+#include "segment_grid.h"
 
 #include "../const.h"
 
 
+class GeneratorSnapshot;
+
+
 enum IntegrationStatus {
     Continue,
     Terminate,
@@ -22,18 +34,20 @@ enum IntegrationStatus {
 };
 
 
-struct Integration {
+template<typename T>
+struct TIntegration {
     IntegrationStatus status;
-    std::optional<DVector2> delta;
-    DVector2 integration_front;
+    std::optional<TVector2<T>> delta;
+    TVector2<T> integration_front;
     bool negate; 
-    std::list<DVector2> points;
+    ArenaList<TVector2<T>> points;
+    TSpatialCursor<T> cursor; // each step is dl from the last, so queries start near there
 
-    Integration(DVector2 seed, bool negate) :
+    TIntegration(TVector2<T> seed, bool negate, ArenaAllocator<TVector2<T>> alloc) :
         status(Continue),
         integration_front(seed),
         negate(negate),
-        points({seed})
+        points({seed}, alloc)
     {}
 };
 
@@ -71,75 +85,274 @@ struct GeneratorParameters {
 };
 
 
-class RoadGenerator {
+// which SpatialIndex the generator keeps its nodes in
+enum SpatialBackend {
+    QuadTreeIndex,
+    HashGridIndex,
+    LinearQuadTreeIndex // morton ordered, fastest to load a saved map into
+};
+
+
+// a streamline that has been pushed (or re-pushed, once its endpoints are
+// joined) into get_streamlines(road, dir)[index]
+struct CommittedStreamline {
+    RoadType road;
+    Direction dir;
+    int index;
+};
+
+
+// what it takes to trace a committed streamline again without its nodes:
+// the seed, how many steps it got each way and what its ends were joined
+// to. replayed on the field it was traced on, it comes back node for node.
+// drawn streamlines have no seed, so they are not traced
+struct StreamlineRecipe {
+    DVector2 seed;
+    DVector2 front_join;
+    DVector2 back_join;
+    Box<double> bounds;         // of its nodes, joins included
+    std::uint32_t forward = 0;  // integration steps from the seed
+    std::uint32_t backward = 0;
+    RoadType road;
+    Direction dir;
+    bool traced = false;
+    bool circle = false;        // its ends were joined into a loop
+    bool joined_front = false;
+    bool joined_back = false;
+};
+
+
+struct GenerationProgress {
+    int road_idx;       // road type currently being traced
+    int road_count;
+    int streamlines;    // streamlines committed so far
+    bool done;
+};
+
+
+// counters for one stage of the pipelined mode
+struct StageStats {
+    long items = 0;
+    std::chrono::nanoseconds busy{0};  // working on items
+    std::chrono::nanoseconds idle{0};  // waiting on the queue either side
+};
+
+
+// occupancy of a queue between stages, sampled whenever it is popped
+struct QueueStats {
+    std::size_t high_water = 0;
+    std::size_t samples = 0;
+    std::size_t total = 0;
+
+    void sample(std::size_t occupancy);
+    double mean() const;
+};
+
+
+struct PipelineStats {
+    StageStats trace;
+    StageStats simplify;
+    StageStats insert;
+    QueueStats traced;      // trace -> simplify
+    QueueStats simplified;  // simplify -> insert
+    long conflicts = 0;     // traces invalidated by a commit made while they were in flight
+};
+
+std::ostream& operator<<(std::ostream& os, const PipelineStats& stats);
+
+
+// traces in T throughout, float or double. the parameters and the road graph
+// are in doubles either way, and so is a StreamlineNode, so the two
+// instantiations only differ inside. which one is built picks the precision
+template<typename T>
+class TRoadGenerator {
+    public:
+        using clock = std::chrono::steady_clock;
+        using Vec = TVector2<T>;
+        using NodeStore = TNodeStore<T>;
+        using SpatialIndex = TSpatialIndex<T>;
+        using SpatialCursor = TSpatialCursor<T>;
+        using NumericalFieldIntegrator = TNumericalFieldIntegrator<T>;
+
     private:
-        using seed_queue = std::queue<DVector2>;
-        static constexpr int kQuadTreeDepth = 10; // area of 3 pixels at 1920x1080
+        using Integration = TIntegration<T>;
+        using Spatial = TSpatial<T>;
+        using HashGrid = THashGrid<T>;
+        using SegmentGrid = TSegmentGrid<T>;
+        using Points = ArenaList<Vec>;
+
+        // fifo that keeps its capacity when cleared
+        struct SeedQueue {
+            std::vector<Vec> items;
+            std::size_t head = 0;
+
+            bool empty() const { return head == items.size(); }
+            void push(const Vec& seed) { items.push_back(seed); }
+
+            Vec pop() {
+                Vec seed = items[head++];
+                if (empty()) clear();
+                return seed;
+            }
+
+            void clear() {
+                items.clear();
+                head = 0;
+            }
+        };
+        static constexpr double kQuadTreeCellsPerSep = 8.0; // leaf cells across the smallest d_sep
         static constexpr int kQuadTreeLeafCapacity = 10;
+        static constexpr int kLinearQuadTreeDepth = 16;
 
 
         std::unique_ptr<NumericalFieldIntegrator> integrator_;
         std::vector<RoadType> road_types_;
         std::unordered_map<RoadType, GeneratorParameters> params_;
-        std::unordered_map<Direction, seed_queue> seeds_;
+        std::unordered_map<Direction, SeedQueue> seeds_;
         std::default_random_engine gen_;
         std::uniform_real_distribution<double> dist_;
-        std::vector<StreamlineNode> nodes_;
-        int min_streamline_size_ = 5;
+        NodeStore nodes_;
+
+        // the streamlines' and the traces' lists, reset by clear() with their
+        // blocks kept, so regenerating settles into allocating nothing. only
+        // the inserting thread adds to streamlines, traces are handed between
+        // the pipelined stages, so their arena is shared while those run
+        Arena streamline_arena_;
+        Arena trace_arena_;
+        std::size_t min_streamline_size_ = 5;
         Box<double> viewport_;
 
 #ifdef SPATIAL_TEST
     public:
 #endif
-        Spatial spatial_;
+        SpatialBackend spatial_backend_ = QuadTreeIndex;
+        std::unique_ptr<SpatialIndex> spatial_;
 #ifdef SPATIAL_TEST
     private:
 #endif
         std::unordered_map<RoadType, Streamlines> streamlines_;
-
-
-        bool in_bounds(const DVector2& p) const;
+        std::vector<StreamlineRecipe> recipes_; // by streamline id
+
+        // separation against the segments between nodes rather than the
+        // nodes, which holds however far simplification spaces them
+        bool segment_separation_ = false;
+        std::unique_ptr<SegmentGrid> segments_;
+
+        // endpoint joins are found in parallel, then committed in order
+        static constexpr std::size_t kJoinGrain = 64; // streamlines per thread
+
+        struct EndJoins {
+            std::optional<node_id> front;
+            std::optional<node_id> back;
+        };
+        std::vector<EndJoins> joins_;
+        std::vector<int> joined_;
+
+        // resumable generation state, owned by the pipeline coroutine
+        struct GenerationState {
+            bool started = false;
+            bool done = false;
+            bool truncate = false; // stop tracing, connect the current road and finish
+            bool connecting = false; // joining the current road's ends
+            std::size_t road_idx = 0;
+            Direction dir = Major;
+            int committed = 0;
+        };
+        GenerationState state_;
+        Generator<CommittedStreamline> pipeline_;
+
+        // pipelined mode. the trace and simplify stages run on their own
+        // threads, so spatial_ is only read under spatial_mutex_ meanwhile,
+        // unless it takes snapshot reads and the tracer never waits at all.
+        static constexpr int kPipelineQueueCapacity = 64;
+
+        struct TracedStreamline {
+            Direction dir;
+            Vec seed;
+            int epoch;              // commits visible when tracing started
+            Points trace;           // every integration step, what conflicts() judges
+            Points points;          // simplified from trace, what is committed
+            StreamlineRecipe recipe;
+            bool last = false;      // no more streamlines for this road type
+        };
+
+        struct ReturnedSeed {
+            Vec pos;
+            Direction dir;
+        };
+
+        struct PipelineRun;
+
+        bool pipelined_ = false;
+        bool concurrent_ = false;
+        bool snapshot_reads_ = false; // spatial_ is in concurrent mode, no locking
+        mutable std::shared_mutex spatial_mutex_;
+        PipelineStats pipeline_stats_;
+
+
+        std::vector<double> grid_cell_sizes() const;
+        std::unique_ptr<SpatialIndex> make_spatial_index() const;
+
+        bool in_bounds(const Vec& p) const;
+        bool has_nearby_point(const Vec& p, T radius, Direction dir) const;
+        bool has_nearby_point(const Vec& p, T radius, Direction dir, SpatialCursor& cursor) const;
+        bool has_nearby_segment(const Vec& p, T radius, Direction dir) const;
 
 
         void add_candidate_seed(node_id id, Direction dir);
-        std::optional<DVector2> get_seed(RoadType road, Direction dir);
+        std::optional<Vec> get_seed(RoadType road, Direction dir);
 
 
+        static bool integration_step(
+            const NumericalFieldIntegrator& integrator,
+            Integration& res,
+            Direction dir,
+            double dl
+        );
         void extend_streamline(
             Integration& res,
             const RoadType& road,
             const Direction& dir
         ) const;
-        std::optional<std::list<DVector2>>
-        generate_streamline(RoadType road, DVector2 seed_point, Direction dir);
-        int generate_streamlines(RoadType road);
+        std::optional<Points>
+        generate_streamline(RoadType road, Vec seed_point, Direction dir, StreamlineRecipe& recipe);
+        std::optional<int> trace_streamline(RoadType road, Vec seed, Direction dir);
+
+        void begin_generation();
+        Generator<CommittedStreamline> pipeline();
+
+        Generator<CommittedStreamline> pipelined();
+        void trace_stage(PipelineRun& run, RoadType road);
+        void simplify_stage(PipelineRun& run, RoadType road);
+        bool conflicts(const PipelineRun& run, RoadType road, const TracedStreamline& t) const;
 
         
-        void simplify_streamline(RoadType road, std::list<DVector2>& points) const;
-        void douglas_peucker(
+        void simplify_streamline(RoadType road, Points& points) const;
+        static void douglas_peucker(
             const double& epsilon,
             const double& min_sep2,
-            std::list<DVector2>& points,
-            std::list<DVector2>::iterator begin,
-            std::list<DVector2>::iterator end
-        ) const;
+            Points& points,
+            typename Points::iterator begin,
+            typename Points::iterator end
+        );
 
 
 #ifdef SPATIAL_TEST
     public:
 #endif
-        void push_streamline(RoadType road, std::list<DVector2>& points, Direction dir);
+        int push_streamline(RoadType road, Points& points, Direction dir, const StreamlineRecipe* recipe = nullptr);
+        int commit_streamline(RoadType road, Points& points, Direction dir, const StreamlineRecipe* recipe = nullptr);
 
         std::optional<node_id> 
-        joining_candidate(const double& rad, const double& max_node_sep, const double& theta_max, const DVector2& pos, 
-            const DVector2& road_direction, const std::unordered_set<node_id>& forbidden) const;
-        void connect_roads(RoadType road, Direction dir);
+        joining_candidate(const double& rad, const double& max_node_sep, const double& theta_max, const Vec& pos, 
+            const Vec& road_direction, int own_streamline) const;
+        EndJoins find_joins(RoadType road, const Streamline& s) const;
+        const std::vector<int>& connect_roads(RoadType road, Direction dir);
         // void connect(Streamline& s, const node_id& endpoint, const node_id& other);
-        void add_intersections(RoadType road, Direction dir, Streamline& s);
 
 
     public:
-        RoadGenerator(
+        TRoadGenerator(
                 std::unique_ptr<NumericalFieldIntegrator>& integrator,
                 std::unordered_map<RoadType, GeneratorParameters>,
                 Box<double> viewport
@@ -148,19 +361,74 @@ class RoadGenerator {
         // getters
         const std::vector<RoadType>& get_road_types() const;
         const std::unordered_map<RoadType, GeneratorParameters>& get_parameters() const;
-        const StreamlineNode& get_node(node_id i) const;
+        StreamlineNode get_node(node_id i) const;
         const std::vector<Streamline>&  get_streamlines(RoadType road, Direction dir);
+        std::vector<Vec> get_polyline(RoadType road, Direction dir, int index);
+
+        // how every streamline was made, by streamline id
+        const std::vector<StreamlineRecipe>& get_recipes() const;
+
+        // the nodes a traced recipe's streamline had, traced again by
+        // integrator, which has to be the same kind over the same field
+        static std::vector<Vec> replay(
+            const StreamlineRecipe& recipe,
+            const NumericalFieldIntegrator& integrator,
+            const GeneratorParameters& params
+        );
+
+        // every streamline, split where roads cross, as a planar graph
+        RoadGraph road_graph();
+
+        // road_graph() with near junctions merged, stubs cut, chains collapsed
+        RoadGraph road_network();
         int node_count() const;
         int streamline_count() const;
 
+        // smallest leaf the quadtree backend splits down to
+        double quadtree_cell_size() const;
+
 
         void set_viewport(Box<double> new_viewport);
 
+        // restarts the random seed points, so generations after the same
+        // seed come out the same
+        void set_seed(unsigned seed);
+
+        // overlap tracing, simplification and insertion on separate threads
+        void set_pipelined(bool pipelined);
+        const PipelineStats& get_pipeline_stats() const;
+
+        // swaps the index, discarding anything generated so far
+        void set_spatial_backend(SpatialBackend backend);
+
+        // test spacing against whole segments, so node_sep can be raised
+        // without roads creeping closer. discards anything generated so far
+        void set_segment_separation(bool segments);
+
 
         void generate();
-        bool generation_step(RoadType road, Direction dir);
+        GenerationProgress generate(clock::time_point deadline);
+        GenerationProgress generate_for(std::chrono::nanoseconds budget);
+        GenerationProgress get_progress() const;
+        std::optional<CommittedStreamline> generation_step();
+
+
+        // everything needed to carry on from here, or to look at the map
+        // without generating it, written to path, see snapshot.h. between
+        // steps, but not while a pipelined road is running or being joined
+        bool save(const std::string& path);
+
+        // takes up a snapshot saved by a generator of the same precision
+        // and road types, and carries on generating from where it was. the
+        // index is rebuilt from the nodes
+        bool load(const GeneratorSnapshot& snapshot);
 
 
         void clear();
 };
+
+
+using RoadGenerator = TRoadGenerator<double>;
+
+
 #endif
@@ -0,0 +1,250 @@
+#include "hash_grid.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+
+
+template<typename T>
+THashGrid<T>::THashGrid(const NodeStore* all_nodes, std::vector<double> cell_sizes) :
+    TSpatialIndex<T>(all_nodes)
+{
+    assert(!cell_sizes.empty());
+
+    std::sort(cell_sizes.begin(), cell_sizes.end());
+    cell_sizes.erase(std::unique(cell_sizes.begin(), cell_sizes.end()), cell_sizes.end());
+
+    for (double size : cell_sizes) {
+        assert(size > 0.0);
+        levels_.push_back(GridLevel{size, 1.0/size, {}, {}});
+    }
+}
+
+
+template<typename T>
+std::uint64_t THashGrid<T>::cell_key(std::int64_t cx, std::int64_t cy) {
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(cx)) << 32)
+        | static_cast<std::uint32_t>(cy);
+}
+
+
+template<typename T>
+const typename THashGrid<T>::GridLevel& THashGrid<T>::level_for(double radius) const {
+    // levels_ is ascending, take the last one that fits inside the radius
+    for (std::size_t i = levels_.size(); i-- > 1;) {
+        if (levels_[i].cell_size <= radius) return levels_[i];
+    }
+    return levels_.front();
+}
+
+
+template<typename T>
+void THashGrid<T>::insert_streamline(const Streamline& s) {
+    if (s.size() == 0) return;
+
+    Streamline::const_iterator end = s.end();
+
+    // if the streamline is a circle, index the shared node once
+    if (s.front() == s.back() && s.size() > 2) {
+        std::advance(end, -1);
+    }
+
+    for (GridLevel& level : levels_) {
+        for (auto it = s.begin(); it != end; ++it) {
+            StreamlineNode node = (*this->all_nodes_)[*it];
+
+            std::uint64_t key = cell_key(
+                std::floor(node.pos.x*level.inv_cell_size),
+                std::floor(node.pos.y*level.inv_cell_size)
+            );
+
+            auto [found, inserted] = level.lookup.try_emplace(key, 0);
+            if (inserted && !level.free_cells.empty()) {
+                found->second = level.free_cells.back();
+                level.free_cells.pop_back();
+            } else if (inserted) {
+                found->second = level.cells.size();
+                level.cells.emplace_back();
+            }
+
+            GridCell& cell = level.cells[found->second];
+            road_mask roads = road_bits(node.road, node.dir);
+            cell.entries.push_back(LeafEntry{Vec(node.pos), *it, node.streamline_id, roads});
+            cell.summary.add(roads, node.streamline_id);
+        }
+    }
+}
+
+
+template<typename T>
+void THashGrid<T>::release_cell(GridLevel& level, std::uint64_t key, std::uint32_t index) {
+    GridCell& cell = level.cells[index];
+    cell.entries.clear();
+    cell.summary = NodeSummary{};
+
+    level.free_cells.push_back(index);
+    level.lookup.erase(key);
+}
+
+
+template<typename T>
+void THashGrid<T>::remove_nodes(std::span<const node_id> ids) {
+    for (GridLevel& level : levels_) {
+        for (node_id id : ids) {
+            Vec pos = this->all_nodes_->pos(id);
+
+            std::uint64_t key = cell_key(
+                std::floor(pos.x*level.inv_cell_size),
+                std::floor(pos.y*level.inv_cell_size)
+            );
+
+            auto found = level.lookup.find(key);
+            if (found == level.lookup.end()) continue;
+
+            GridCell& cell = level.cells[found->second];
+            auto it = std::find_if(cell.entries.begin(), cell.entries.end(),
+                [id](const LeafEntry& e) { return e.id == id; });
+            if (it == cell.entries.end()) continue;
+
+            *it = cell.entries.back();
+            cell.entries.pop_back();
+
+            if (cell.entries.empty()) {
+                release_cell(level, key, found->second);
+                continue;
+            }
+
+            cell.summary = NodeSummary{};
+            for (const LeafEntry& e : cell.entries) {
+                cell.summary.add(e.roads, e.streamline);
+            }
+        }
+    }
+}
+
+
+template<typename T>
+std::size_t THashGrid<T>::remove_region(const Box<T>& region, const SpatialFilter& filter, 
+    std::vector<node_id>& removed) 
+{
+    std::size_t before = removed.size();
+    if (region.is_empty()) return 0;
+
+    // every level holds every node, so the ids are only collected once
+    bool first = true;
+    for (GridLevel& level : levels_) {
+        std::int64_t x0 = std::floor(region.min.x*level.inv_cell_size);
+        std::int64_t x1 = std::floor(region.max.x*level.inv_cell_size);
+        std::int64_t y0 = std::floor(region.min.y*level.inv_cell_size);
+        std::int64_t y1 = std::floor(region.max.y*level.inv_cell_size);
+
+        auto remove_from = [&](std::uint64_t key, std::uint32_t index) {
+            GridCell& cell = level.cells[index];
+            if (!filter.admits(cell.summary)) return;
+
+            auto gone = [&](const LeafEntry& e) {
+                return region.contains(e.pos) && filter.admits(e.roads, e.streamline);
+            };
+
+            auto kept = std::stable_partition(cell.entries.begin(), cell.entries.end(),
+                [&](const LeafEntry& e) { return !gone(e); });
+            if (kept == cell.entries.end()) return;
+
+            if (first) {
+                for (auto it = kept; it != cell.entries.end(); ++it) removed.push_back(it->id);
+            }
+            cell.entries.erase(kept, cell.entries.end());
+
+            if (cell.entries.empty()) {
+                release_cell(level, key, index);
+                return;
+            }
+
+            cell.summary = NodeSummary{};
+            for (const LeafEntry& e : cell.entries) {
+                cell.summary.add(e.roads, e.streamline);
+            }
+        };
+
+        // a big region on a fine level covers more cells than there are,
+        // then it is cheaper to walk the occupied ones
+        double covered = double(x1 - x0 + 1)*double(y1 - y0 + 1);
+        if (covered > level.lookup.size()) {
+            std::vector<std::pair<std::uint64_t, std::uint32_t>> hits;
+            for (const auto& [key, index] : level.lookup) {
+                std::int64_t cx = static_cast<std::int32_t>(key >> 32);
+                std::int64_t cy = static_cast<std::int32_t>(key & 0xffffffff);
+                if (cx < x0 || cx > x1 || cy < y0 || cy > y1) continue;
+                hits.emplace_back(key, index);
+            }
+            for (auto [key, index] : hits) remove_from(key, index);
+        } else {
+            for (std::int64_t cy = y0; cy <= y1; ++cy) {
+                for (std::int64_t cx = x0; cx <= x1; ++cx) {
+                    std::uint64_t key = cell_key(cx, cy);
+                    auto found = level.lookup.find(key);
+                    if (found != level.lookup.end()) remove_from(key, found->second);
+                }
+            }
+        }
+
+        first = false;
+    }
+
+    return removed.size() - before;
+}
+
+
+template<typename T>
+void THashGrid<T>::clear() {
+    for (GridLevel& level : levels_) {
+        level.lookup.clear();
+        level.cells.clear();
+        level.free_cells.clear();
+    }
+}
+
+
+// the grid is unbounded, so there is nothing to resize
+template<typename T>
+void THashGrid<T>::reset(Box<T> new_dims) {
+    clear();
+}
+
+
+template<typename T>
+bool THashGrid<T>::visit_nearby(const Vec& centre, const T& radius, const SpatialFilter& filter, NodeVisitor visitor) const {
+    const GridLevel& level = level_for(radius);
+    T radius2 = radius*radius;
+
+    std::int64_t x0 = std::floor((centre.x - radius)*level.inv_cell_size);
+    std::int64_t x1 = std::floor((centre.x + radius)*level.inv_cell_size);
+    std::int64_t y0 = std::floor((centre.y - radius)*level.inv_cell_size);
+    std::int64_t y1 = std::floor((centre.y + radius)*level.inv_cell_size);
+
+    for (std::int64_t cy = y0; cy <= y1; ++cy) {
+        for (std::int64_t cx = x0; cx <= x1; ++cx) {
+            auto found = level.lookup.find(cell_key(cx, cy));
+            if (found == level.lookup.end()) continue;
+
+            const GridCell& cell = level.cells[found->second];
+            if (!filter.admits(cell.summary)) continue;
+
+            for (const LeafEntry& e : cell.entries) {
+                if (!filter.admits(e.roads, e.streamline)) continue;
+
+                Vec diff = e.pos - centre;
+                if (dot_product(diff, diff) > radius2) continue;
+
+                if (!visitor || visitor(e.id)) return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+template class THashGrid<float>;
+template class THashGrid<double>;
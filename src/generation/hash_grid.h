@@ -0,0 +1,63 @@
+#ifndef HASH_GRID_H
+#define HASH_GRID_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "../types.h"
+#include "node_storage.h"
+
+
+// sparse uniform grid over the nodes, with one level per radius class. a
+// query uses the level with the largest cells no bigger than its radius, so
+// it only ever looks at a few cells no matter how dense the map gets.
+template<typename T>
+class THashGrid : public TSpatialIndex<T> {
+public:
+    using typename TSpatialIndex<T>::Vec;
+    using typename TSpatialIndex<T>::NodeStore;
+    using LeafEntry = TLeafEntry<T>;
+
+private:
+    struct GridCell {
+        std::vector<LeafEntry> entries;
+        NodeSummary summary;
+    };
+
+    struct GridLevel {
+        double cell_size;
+        double inv_cell_size;
+        std::unordered_map<std::uint64_t, std::uint32_t> lookup; // cell key -> cells index
+        std::vector<GridCell> cells;
+        std::vector<std::uint32_t> free_cells; // emptied by removal, for reuse
+    };
+
+    std::vector<GridLevel> levels_; // ascending cell size
+
+    static std::uint64_t cell_key(std::int64_t cx, std::int64_t cy);
+    const GridLevel& level_for(double radius) const;
+
+    static void release_cell(GridLevel& level, std::uint64_t key, std::uint32_t index);
+
+public:
+    THashGrid(const NodeStore* all_nodes, std::vector<double> cell_sizes);
+
+    void insert_streamline(const Streamline& s) override;
+
+    void remove_nodes(std::span<const node_id> ids) override;
+    std::size_t remove_region(const Box<T>& region, const SpatialFilter& filter, 
+        std::vector<node_id>& removed) override;
+
+    void clear() override;
+    void reset(Box<T> new_dims) override;
+
+protected:
+    bool visit_nearby(const Vec& centre, const T& radius, const SpatialFilter& filter, NodeVisitor visitor) const override;
+};
+
+
+using HashGrid = THashGrid<double>;
+
+
+#endif
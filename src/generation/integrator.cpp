@@ -9,14 +9,16 @@ Direction flip(Direction dir) {
     return Major;
 }
 
-NumericalFieldIntegrator::NumericalFieldIntegrator(
-        TensorField* field) : field_(field) {}
+template<typename T>
+TNumericalFieldIntegrator<T>::TNumericalFieldIntegrator(
+        const TTensorField<T>* field) : field_(field) {}
 
 
-DVector2 
-NumericalFieldIntegrator::get_vector(
-    const DVector2& x, const Direction& dir) const {
-    Tensor t = field_->sample(x);
+template<typename T>
+TVector2<T> 
+TNumericalFieldIntegrator<T>::get_vector(
+    const TVector2<T>& x, const Direction& dir) const {
+    TTensor<T> t = field_->sample(x);
 
     if (dir == Major) {
         return t.get_major_eigenvector();
@@ -26,20 +28,28 @@ NumericalFieldIntegrator::get_vector(
 }
 
 
-RK4::RK4 (TensorField* field) 
-    : NumericalFieldIntegrator(field) {}
+template<typename T>
+TRK4<T>::TRK4 (const TTensorField<T>* field) 
+    : TNumericalFieldIntegrator<T>(field) {}
 
 
 
-DVector2 
-RK4::integrate(const DVector2& x, 
-    const Direction& dir, const double& dl) const { 
+template<typename T>
+TVector2<T> 
+TRK4<T>::integrate(const TVector2<T>& x, 
+    const Direction& dir, const T& dl) const { 
     // return integration delta
-    DVector2 dx = {dl, dl};
+    TVector2<T> dx = {dl, dl};
 
-    DVector2 k1 = get_vector(x, dir);
-    DVector2 k2 = get_vector(x + dx/2.0, dir);
-    DVector2 k4 = get_vector(x + dx, dir);
+    TVector2<T> k1 = this->get_vector(x, dir);
+    TVector2<T> k2 = this->get_vector(x + dx/2.0, dir);
+    TVector2<T> k4 = this->get_vector(x + dx, dir);
 
     return k1 + k2*4.0 + k4/6.0;
 }
+
+
+template class TNumericalFieldIntegrator<float>;
+template class TNumericalFieldIntegrator<double>;
+template class TRK4<float>;
+template class TRK4<double>;
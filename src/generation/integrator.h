@@ -12,34 +12,40 @@ enum Direction : char {
 
 Direction flip(Direction dir);
 
-class NumericalFieldIntegrator {
+template<typename T>
+class TNumericalFieldIntegrator {
 private:
-    TensorField* field_;
+    const TTensorField<T>* field_;
 
 protected:
-    DVector2 get_vector(const DVector2& x, const Direction& dir) const;
+    TVector2<T> get_vector(const TVector2<T>& x, const Direction& dir) const;
 
 public:
-    NumericalFieldIntegrator(TensorField* field);
-    virtual ~NumericalFieldIntegrator() = default;
+    TNumericalFieldIntegrator(const TTensorField<T>* field);
+    virtual ~TNumericalFieldIntegrator() = default;
 
-    virtual DVector2 
+    virtual TVector2<T> 
     integrate(
-        const DVector2& x, 
+        const TVector2<T>& x, 
         const Direction& d, 
-        const double& dl
+        const T& dl
     ) const = 0;
 };
 
 
-class RK4 : public NumericalFieldIntegrator {
+template<typename T>
+class TRK4 : public TNumericalFieldIntegrator<T> {
 public:
-    RK4(TensorField* _field);
+    TRK4(const TTensorField<T>* _field);
 
-    DVector2 
+    TVector2<T> 
     integrate(
-        const DVector2& x, 
+        const TVector2<T>& x, 
         const Direction& d, 
-        const double& dl
+        const T& dl
     ) const override;
 };
+
+
+using NumericalFieldIntegrator = TNumericalFieldIntegrator<double>;
+using RK4 = TRK4<double>;
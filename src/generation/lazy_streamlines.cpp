@@ -0,0 +1,116 @@
+#include "lazy_streamlines.h"
+
+#include <cassert>
+#include <map>
+#include <utility>
+
+
+//  SECTION: LazyStreamlines
+
+template<typename T>
+TLazyStreamlines<T>::TLazyStreamlines(
+        TRoadGenerator<T>& generator,
+        std::shared_ptr<const TTensorField<T>> field,
+        std::size_t cache_capacity
+    ) :
+    field_(std::move(field)),
+    integrator_(field_.get()),
+    params_(generator.get_parameters()),
+    recipes_(generator.get_recipes()),
+    capacity_(cache_capacity)
+{
+    assert(capacity_ > 0);
+
+    // a streamline's index among its road type and direction, counted the
+    // way the generator added them
+    std::map<std::pair<RoadType, Direction>, int> index;
+    for (std::size_t id = 0; id < recipes_.size(); ++id) {
+        const StreamlineRecipe& r = recipes_[id];
+        int i = index[{r.road, r.dir}]++;
+
+        if (!r.traced) {
+            drawn_[id] = std::make_shared<const Polyline>(generator.get_polyline(r.road, r.dir, i));
+        }
+    }
+}
+
+
+template<typename T>
+std::size_t TLazyStreamlines<T>::size() const {
+    return recipes_.size();
+}
+
+
+template<typename T>
+const StreamlineRecipe& TLazyStreamlines<T>::recipe(std::size_t id) const {
+    return recipes_[id];
+}
+
+
+template<typename T>
+std::shared_ptr<const typename TLazyStreamlines<T>::Polyline>
+TLazyStreamlines<T>::polyline(std::size_t id) {
+    assert(id < recipes_.size());
+
+    if (auto it = drawn_.find(id); it != drawn_.end()) return it->second;
+
+    if (auto it = cache_.find(id); it != cache_.end()) {
+        stats_.hits += 1;
+        lru_.splice(lru_.begin(), lru_, it->second.used);
+        return it->second.polyline;
+    }
+
+    stats_.misses += 1;
+    const StreamlineRecipe& r = recipes_[id];
+    auto out = std::make_shared<const Polyline>(
+        TRoadGenerator<T>::replay(r, integrator_, params_.at(r.road))
+    );
+
+    if (cache_.size() == capacity_) {
+        cache_.erase(lru_.back());
+        lru_.pop_back();
+    }
+    lru_.push_front(id);
+    cache_.emplace(id, Cached{out, lru_.begin()});
+
+    return out;
+}
+
+
+template<typename T>
+void TLazyStreamlines<T>::streamlines_in(const Box<double>& region, std::vector<std::size_t>& out) const {
+    for (std::size_t id = 0; id < recipes_.size(); ++id) {
+        const Box<double>& b = recipes_[id].bounds;
+        if (b.min.x <= region.max.x && region.min.x <= b.max.x
+                && b.min.y <= region.max.y && region.min.y <= b.max.y) {
+            out.push_back(id);
+        }
+    }
+}
+
+
+template<typename T>
+std::size_t TLazyStreamlines<T>::stored_bytes() const {
+    std::size_t total = recipes_.capacity()*sizeof(StreamlineRecipe);
+    for (const auto& [_, polyline] : drawn_) {
+        total += polyline->capacity()*sizeof(Vec);
+    }
+    return total;
+}
+
+
+template<typename T>
+const typename TLazyStreamlines<T>::CacheStats& TLazyStreamlines<T>::get_cache_stats() const {
+    return stats_;
+}
+
+
+template<typename T>
+void TLazyStreamlines<T>::clear_cache() {
+    lru_.clear();
+    cache_.clear();
+}
+
+
+template class TLazyStreamlines<float>;
+template class TLazyStreamlines<double>;
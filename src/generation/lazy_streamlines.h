@@ -0,0 +1,85 @@
+#ifndef LAZY_STREAMLINES_H
+#define LAZY_STREAMLINES_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "../types.h"
+#include "generator.h"
+#include "integrator.h"
+#include "tensor_field.h"
+
+
+// a generated map kept as recipes rather than nodes, for archiving it or for
+// maps too big to hold whole. a streamline is traced again from its recipe
+// when it is asked for, over a snapshot of the field that nothing can edit,
+// and the last few asked for are kept. around a hundred bytes a streamline
+// against some kilobytes of nodes, for a trace per cache miss.
+// one thread at a time
+template<typename T>
+class TLazyStreamlines {
+public:
+    using Vec = TVector2<T>;
+    using Polyline = std::vector<Vec>;
+
+    struct CacheStats {
+        long hits = 0;
+        long misses = 0;
+    };
+
+private:
+    std::shared_ptr<const TTensorField<T>> field_;
+    TRK4<T> integrator_;
+    std::unordered_map<RoadType, GeneratorParameters> params_;
+    std::vector<StreamlineRecipe> recipes_;
+
+    // drawn streamlines have nothing to trace from, so they are kept as they are
+    std::unordered_map<std::size_t, std::shared_ptr<const Polyline>> drawn_;
+
+    // most recently used at the front
+    struct Cached {
+        std::shared_ptr<const Polyline> polyline;
+        typename std::list<std::size_t>::iterator used;
+    };
+    std::size_t capacity_;
+    std::list<std::size_t> lru_;
+    std::unordered_map<std::size_t, Cached> cache_;
+    CacheStats stats_;
+
+public:
+    // field has to be what generator traced on, as it was then. the
+    // generator can be cleared or go once this is made
+    TLazyStreamlines(
+        TRoadGenerator<T>& generator,
+        std::shared_ptr<const TTensorField<T>> field,
+        std::size_t cache_capacity
+    );
+    TLazyStreamlines(const TLazyStreamlines&) = delete;
+    TLazyStreamlines& operator=(const TLazyStreamlines&) = delete;
+
+    std::size_t size() const;
+    const StreamlineRecipe& recipe(std::size_t id) const;
+
+    // streamline id's nodes, as the generator had them once its roads were
+    // joined. stays valid after it is evicted
+    std::shared_ptr<const Polyline> polyline(std::size_t id);
+
+    // ids of the streamlines that may pass through region, e.g. a chunk
+    // about to be drawn or exported
+    void streamlines_in(const Box<double>& region, std::vector<std::size_t>& out) const;
+
+    // what the recipes and drawn streamlines take, not counting the cache
+    std::size_t stored_bytes() const;
+
+    const CacheStats& get_cache_stats() const;
+    void clear_cache();
+};
+
+
+using LazyStreamlines = TLazyStreamlines<double>;
+
+
+#endif
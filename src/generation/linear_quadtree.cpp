@@ -0,0 +1,441 @@
+#include "linear_quadtree.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+
+#include "morton.h"
+#include "parallel.h"
+
+
+//  SECTION: radix sort
+
+// stable lsd radix sort of keys on their top 32 bits, 8 bits a pass. each
+// pass histograms and scatters contiguous chunks in parallel.
+static void radix_sort(std::vector<std::uint64_t>& keys) {
+    constexpr int kRadix = 256;
+
+    std::size_t n = keys.size();
+    std::vector<std::uint64_t> scratch(n);
+
+    int chunks = chunk_count(n);
+    std::vector<std::array<std::size_t, kRadix>> counts(chunks);
+
+    for (int shift = 32; shift < 64; shift += 8) {
+        parallel_for(n, chunks, [&](int chunk, std::size_t begin, std::size_t end) {
+            std::array<std::size_t, kRadix>& count = counts[chunk];
+            count.fill(0);
+            for (std::size_t i = begin; i < end; ++i) {
+                ++count[(keys[i] >> shift) & 0xff];
+            }
+        });
+
+        // turn the counts into each chunk's first slot per digit, digit major
+        // so the scatter stays stable. nothing to do if one digit has it all.
+        std::size_t offset = 0;
+        bool trivial = false;
+        for (int digit = 0; digit < kRadix; ++digit) {
+            std::size_t digit_start = offset;
+            for (int c = 0; c < chunks; ++c) {
+                std::size_t count = counts[c][digit];
+                counts[c][digit] = offset;
+                offset += count;
+            }
+            if (offset - digit_start == n) trivial = true;
+        }
+        if (trivial) continue;
+
+        parallel_for(n, chunks, [&](int chunk, std::size_t begin, std::size_t end) {
+            std::array<std::size_t, kRadix>& slot = counts[chunk];
+            for (std::size_t i = begin; i < end; ++i) {
+                scratch[slot[(keys[i] >> shift) & 0xff]++] = keys[i];
+            }
+        });
+
+        keys.swap(scratch);
+    }
+}
+
+
+//  SECTION: LinearQuadtree
+
+template<typename T>
+TLinearQuadtree<T>::CircleQuery::CircleQuery(const SpatialFilter& filter, const Vec& centre, const T& radius, NodeVisitor visitor) :
+    filter(filter),
+    visitor(visitor),
+    centre(centre),
+    radius2(radius*radius)
+{
+    Vec circumscribed_diag = {radius, radius};
+    Vec inscribed_diag = circumscribed_diag/M_SQRT2;
+
+    outer_bbox = Box(centre - circumscribed_diag, centre + circumscribed_diag);
+    inner_bbox = Box(centre - inscribed_diag, centre + inscribed_diag);
+}
+
+
+template<typename T>
+TLinearQuadtree<T>::TLinearQuadtree(const NodeStore* all_nodes, Box<T> dims, int depth, int leaf_capacity) :
+    TSpatialIndex<T>(all_nodes),
+    dimensions_(dims),
+    depth_(depth),
+    leaf_capacity_(leaf_capacity)
+{
+    assert(depth_ > 0 && depth_ <= 16);
+    build_nodes();
+}
+
+
+template<typename T>
+std::uint32_t TLinearQuadtree<T>::encode(const Vec& pos) const {
+    return morton_code(pos, dimensions_, depth_);
+}
+
+
+// quantising can land a point an ulp outside its cell, so cells are padded
+// by a little more than that to keep pruning conservative
+template<typename T>
+Box<T> TLinearQuadtree<T>::padded(const Box<T>& cell) const {
+    T pad = std::max(dimensions_.width(), dimensions_.height())*T(1e-6);
+    Vec slack = {pad, pad};
+
+    return Box(cell.min - slack, cell.max + slack);
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::resort() {
+    std::size_t n = codes_.size();
+    std::vector<std::uint64_t> keys(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        keys[i] = (static_cast<std::uint64_t>(encode({xs_[i], ys_[i]})) << 32) | i;
+    }
+    radix_sort(keys);
+
+    std::vector<T> xs(n), ys(n);
+    std::vector<node_id> ids(n);
+    std::vector<int> streamlines(n);
+    std::vector<road_mask> roads(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        std::size_t from = keys[i] & 0xffffffff;
+        codes_[i] = keys[i] >> 32;
+        xs[i] = xs_[from];
+        ys[i] = ys_[from];
+        ids[i] = ids_[from];
+        streamlines[i] = streamlines_[from];
+        roads[i] = roads_[from];
+    }
+
+    xs_.swap(xs);
+    ys_.swap(ys);
+    ids_.swap(ids);
+    streamlines_.swap(streamlines);
+    roads_.swap(roads);
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::merge(std::span<const node_id> batch) {
+    std::size_t m = batch.size();
+    if (m == 0) return;
+
+    const NodeStore& nodes = *this->all_nodes_;
+
+    // code in the top half, offset in the batch below it
+    std::vector<std::uint64_t> keys(m);
+    parallel_for(m, chunk_count(m), [&](int, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            keys[i] = (static_cast<std::uint64_t>(encode(nodes.pos(batch[i]))) << 32) | i;
+        }
+    });
+
+    radix_sort(keys);
+
+    std::size_t n = codes_.size();
+    std::vector<std::uint32_t> codes(n + m);
+    std::vector<T> xs(n + m);
+    std::vector<T> ys(n + m);
+    std::vector<node_id> ids(n + m);
+    std::vector<int> streamlines(n + m);
+    std::vector<road_mask> roads(n + m);
+
+    // existing entries go first on equal codes
+    std::size_t i = 0, j = 0, k = 0;
+    while (j < m) {
+        std::uint32_t code = keys[j] >> 32;
+
+        if (i < n && codes_[i] <= code) {
+            codes[k] = codes_[i];
+            xs[k] = xs_[i];
+            ys[k] = ys_[i];
+            ids[k] = ids_[i];
+            streamlines[k] = streamlines_[i];
+            roads[k] = roads_[i];
+            ++i;
+        } else {
+            node_id id = batch[keys[j] & 0xffffffff];
+            Vec pos = nodes.pos(id);
+            codes[k] = code;
+            xs[k] = pos.x;
+            ys[k] = pos.y;
+            ids[k] = id;
+            streamlines[k] = nodes.streamline(id);
+            roads[k] = road_bits(nodes.road(id), nodes.dir(id));
+            ++j;
+        }
+        ++k;
+    }
+
+    std::copy(codes_.begin() + i, codes_.end(), codes.begin() + k);
+    std::copy(xs_.begin() + i, xs_.end(), xs.begin() + k);
+    std::copy(ys_.begin() + i, ys_.end(), ys.begin() + k);
+    std::copy(ids_.begin() + i, ids_.end(), ids.begin() + k);
+    std::copy(streamlines_.begin() + i, streamlines_.end(), streamlines.begin() + k);
+    std::copy(roads_.begin() + i, roads_.end(), roads.begin() + k);
+
+    codes_.swap(codes);
+    xs_.swap(xs);
+    ys_.swap(ys);
+    ids_.swap(ids);
+    streamlines_.swap(streamlines);
+    roads_.swap(roads);
+}
+
+
+// in place and in order, so the codes stay sorted
+template<typename T>
+template<typename F>
+void TLinearQuadtree<T>::compact(F&& keep) {
+    std::size_t k = 0;
+    for (std::size_t i = 0; i < codes_.size(); ++i) {
+        if (!keep(i)) continue;
+
+        codes_[k] = codes_[i];
+        xs_[k] = xs_[i];
+        ys_[k] = ys_[i];
+        ids_[k] = ids_[i];
+        streamlines_[k] = streamlines_[i];
+        roads_[k] = roads_[i];
+        ++k;
+    }
+
+    codes_.resize(k);
+    xs_.resize(k);
+    ys_.resize(k);
+    ids_.resize(k);
+    streamlines_.resize(k);
+    roads_.resize(k);
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::build_nodes() {
+    nodes_.clear();
+    build_rec(0, codes_.size(), 0, 0);
+}
+
+
+template<typename T>
+NodeSummary TLinearQuadtree<T>::build_rec(std::uint32_t begin, std::uint32_t end, std::uint32_t prefix, int level) {
+    std::uint32_t node_ptr = nodes_.size();
+    nodes_.push_back(LinearNode{begin, end, 0, prefix, static_cast<std::uint8_t>(level), {}});
+
+    NodeSummary summary;
+
+    if (end - begin > static_cast<std::uint32_t>(leaf_capacity_) && level < depth_) {
+        // children are contiguous runs of codes, split at each quadrant's first code
+        int shift = 2*(depth_ - level - 1);
+        std::uint32_t child_begin = begin;
+
+        for (std::uint32_t q = 0; q < 4; ++q) {
+            std::uint32_t child_prefix = (prefix << 2) | q;
+            std::uint32_t child_end = end;
+
+            if (q != 3) {
+                child_end = std::lower_bound(
+                    codes_.begin() + child_begin,
+                    codes_.begin() + end,
+                    (child_prefix + 1) << shift
+                ) - codes_.begin();
+            }
+
+            if (child_begin != child_end) {
+                summary.add(build_rec(child_begin, child_end, child_prefix, level + 1));
+            }
+            child_begin = child_end;
+        }
+    } else {
+        for (std::uint32_t i = begin; i < end; ++i) {
+            summary.add(roads_[i], streamlines_[i]);
+        }
+    }
+
+    nodes_[node_ptr].next = nodes_.size();
+    nodes_[node_ptr].summary = summary;
+    return summary;
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::insert_batch(std::span<const node_id> ids) {
+    Box<T> grown = dimensions_;
+    for (node_id id : ids) {
+        grown |= this->all_nodes_->pos(id);
+    }
+
+    // codes depend on the bounds, so anything outside means re-sorting it all
+    if (!(grown == dimensions_)) {
+        dimensions_ = grown;
+        resort();
+    }
+
+    merge(ids);
+    build_nodes();
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::insert_streamline(const Streamline& s) {
+    if (s.size() == 0) return;
+
+    batch_scratch_.assign(s.begin(), s.end());
+
+    // if the streamline is a circle, index the shared node once
+    if (s.front() == s.back() && s.size() > 2) {
+        batch_scratch_.pop_back();
+    }
+
+    insert_batch(batch_scratch_);
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::insert_nodes(node_id first, node_id last) {
+    if (first >= last) return;
+
+    batch_scratch_.resize(last - first);
+    std::iota(batch_scratch_.begin(), batch_scratch_.end(), first);
+
+    insert_batch(batch_scratch_);
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::remove_nodes(std::span<const node_id> ids) {
+    if (ids.empty()) return;
+
+    batch_scratch_.assign(ids.begin(), ids.end());
+    std::sort(batch_scratch_.begin(), batch_scratch_.end());
+
+    compact([&](std::size_t i) {
+        return !std::binary_search(batch_scratch_.begin(), batch_scratch_.end(), ids_[i]);
+    });
+    build_nodes();
+}
+
+
+template<typename T>
+std::size_t TLinearQuadtree<T>::remove_region(const Box<T>& region, const SpatialFilter& filter,
+    std::vector<node_id>& removed)
+{
+    std::size_t before = removed.size();
+
+    compact([&](std::size_t i) {
+        if (!region.contains({xs_[i], ys_[i]}) || !filter.admits(roads_[i], streamlines_[i])) return true;
+        removed.push_back(ids_[i]);
+        return false;
+    });
+    build_nodes();
+
+    return removed.size() - before;
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::clear() {
+    codes_.clear();
+    xs_.clear();
+    ys_.clear();
+    ids_.clear();
+    streamlines_.clear();
+    roads_.clear();
+    build_nodes();
+}
+
+
+template<typename T>
+void TLinearQuadtree<T>::reset(Box<T> new_dims) {
+    dimensions_ = new_dims;
+    clear();
+}
+
+
+template<typename T>
+std::size_t TLinearQuadtree<T>::size() const {
+    return codes_.size();
+}
+
+
+// every entry in [begin, end) is inside the circle, only the filter is left
+template<typename T>
+bool TLinearQuadtree<T>::visit_range(std::uint32_t begin, std::uint32_t end, CircleQuery& query) const {
+    for (std::uint32_t i = begin; i < end; ++i) {
+        if (!query.filter.admits(roads_[i], streamlines_[i])) continue;
+
+        if (!query.visitor || query.visitor(ids_[i])) return true;
+    }
+    return false;
+}
+
+
+template<typename T>
+bool TLinearQuadtree<T>::in_circle_rec(std::uint32_t node_ptr, const Box<T>& cell, CircleQuery& query) const {
+    const LinearNode& node = nodes_[node_ptr];
+
+    // terminate if bboxes dont intersect, or nothing below passes the filter
+    Box<T> bbox = padded(cell);
+    if (!query.filter.admits(node.summary) || (query.outer_bbox & bbox).is_empty()) {
+        return false;
+    }
+
+    // if bbox ⊆ query.inner_bbox, every entry is in the circle
+    if ((bbox | query.inner_bbox) == query.inner_bbox) {
+        // the summary only proves a hit when roads are all that is filtered
+        if (!query.visitor && query.filter.roads_only()) return node.begin != node.end;
+        return visit_range(node.begin, node.end, query);
+    }
+
+    if (node.next == node_ptr + 1) {
+        for (std::uint32_t i = node.begin; i < node.end; ++i) {
+            if (!query.filter.admits(roads_[i], streamlines_[i])) continue;
+
+            T dx = query.centre.x - xs_[i];
+            T dy = query.centre.y - ys_[i];
+            if (dx*dx + dy*dy > query.radius2) continue;
+
+            if (!query.visitor || query.visitor(ids_[i])) return true;
+        }
+        return false;
+    }
+
+    for (std::uint32_t child_ptr = node_ptr + 1; child_ptr < node.next; child_ptr = nodes_[child_ptr].next) {
+        Quadrant q = static_cast<Quadrant>(nodes_[child_ptr].prefix & 3);
+
+        if (in_circle_rec(child_ptr, cell.get_quadrant(q), query)) return true;
+    }
+
+    return false;
+}
+
+
+template<typename T>
+bool TLinearQuadtree<T>::visit_nearby(const Vec& centre, const T& radius, const SpatialFilter& filter, NodeVisitor visitor) const {
+    CircleQuery query(filter, centre, radius, visitor);
+    return in_circle_rec(0, dimensions_, query);
+}
+
+
+template class TLinearQuadtree<float>;
+template class TLinearQuadtree<double>;
@@ -0,0 +1,113 @@
+#ifndef LINEAR_QUADTREE_H
+#define LINEAR_QUADTREE_H
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "../types.h"
+#include "node_storage.h"
+
+
+// a cell of the linear quadtree. cells are stored in pre-order, which is also
+// morton order, so a cell's children are the subtrees in [this+1, next).
+struct LinearNode {
+    std::uint32_t begin;  // entries covered, [begin, end)
+    std::uint32_t end;
+    std::uint32_t next;   // one past the last cell of this subtree
+    std::uint32_t prefix; // morton code of the cell at its own level
+    std::uint8_t level;
+    NodeSummary summary;  // of the entries under this cell
+};
+
+
+// quadtree over node positions sorted by morton code, for loading large
+// networks in one go. entries are kept as structure of arrays in code order
+// and the cells are rebuilt from them in a single pass, so a bulk load is one
+// sort and an insert is a sort of the batch and a merge, rather than one
+// descent per node. removals compact the arrays and rebuild the cells, so it
+// suits maps that are loaded and then mostly read
+template<typename T>
+class TLinearQuadtree : public TSpatialIndex<T> {
+public:
+    using typename TSpatialIndex<T>::Vec;
+    using typename TSpatialIndex<T>::NodeStore;
+
+private:
+    struct CircleQuery {
+        SpatialFilter filter;
+        NodeVisitor visitor; // empty if only asking whether anything is there
+        Vec centre;
+        T radius2;
+        Box<T> outer_bbox; // circumscribed
+        Box<T> inner_bbox; // inscribed
+
+        CircleQuery(const SpatialFilter& filter, const Vec& centre, const T& radius, NodeVisitor visitor);
+    };
+
+    Box<T> dimensions_;
+    int depth_;
+    int leaf_capacity_;
+
+    // entries, sorted by code
+    std::vector<std::uint32_t> codes_;
+    std::vector<T> xs_;
+    std::vector<T> ys_;
+    std::vector<node_id> ids_;
+    std::vector<int> streamlines_;
+    std::vector<road_mask> roads_;
+
+    std::vector<LinearNode> nodes_;
+
+    std::vector<node_id> batch_scratch_;
+
+    std::uint32_t encode(const Vec& pos) const;
+    Box<T> padded(const Box<T>& cell) const;
+
+    // re-sorts every entry after dimensions_ has changed
+    void resort();
+
+    // sorts ids into code order and merges them in
+    void merge(std::span<const node_id> ids);
+
+    // keeps only the entries keep(i) is true for
+    template<typename F>
+    void compact(F&& keep);
+
+    void build_nodes();
+    NodeSummary build_rec(std::uint32_t begin, std::uint32_t end, std::uint32_t prefix, int level);
+
+    bool in_circle_rec(std::uint32_t node_ptr, const Box<T>& cell, CircleQuery& query) const;
+    bool visit_range(std::uint32_t begin, std::uint32_t end, CircleQuery& query) const;
+
+    // adds ids, growing the bounds first if any fall outside them
+    void insert_batch(std::span<const node_id> ids);
+
+public:
+    // dims is only where the bounds start, they grow to take in whatever is
+    // inserted outside them. depth is in levels below the root, at most 16
+    TLinearQuadtree(const NodeStore* all_nodes, Box<T> dims, int depth, int leaf_capacity);
+
+    void insert_streamline(const Streamline& s) override;
+
+    // one sort over the whole range, however many streamlines are in it
+    void insert_nodes(node_id first, node_id last) override;
+
+    void remove_nodes(std::span<const node_id> ids) override;
+    std::size_t remove_region(const Box<T>& region, const SpatialFilter& filter,
+        std::vector<node_id>& removed) override;
+
+    void clear() override;
+    void reset(Box<T> new_dims) override;
+
+    std::size_t size() const;
+
+protected:
+    bool visit_nearby(const Vec& centre, const T& radius, const SpatialFilter& filter, NodeVisitor visitor) const override;
+};
+
+
+using LinearQuadtree = TLinearQuadtree<double>;
+
+
+#endif
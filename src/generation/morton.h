@@ -0,0 +1,46 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "../types.h"
+
+
+// spreads the low 16 bits of v out to the even bits
+inline std::uint32_t part_1_by_1(std::uint32_t v) {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+
+// x on the even bits, so the 2 bits of each level read as a Quadrant
+inline std::uint32_t interleave(std::uint32_t x, std::uint32_t y) {
+    return part_1_by_1(x) | (part_1_by_1(y) << 1);
+}
+
+
+// code of pos on a 2^depth grid over bounds, positions outside are clamped
+// to the nearest cell. depth is at most 16
+template<typename T>
+inline std::uint32_t morton_code(const TVector2<T>& pos, const Box<T>& bounds, int depth) {
+    const double cells = static_cast<double>(1u << depth);
+
+    auto quantise = [cells](double v, double lo, double extent) {
+        double c = extent > 0.0 ? std::floor((v - lo)/extent*cells) : 0.0;
+        return static_cast<std::uint32_t>(std::clamp(c, 0.0, cells - 1.0));
+    };
+
+    return interleave(
+        quantise(pos.x, bounds.min.x, bounds.width()),
+        quantise(pos.y, bounds.min.y, bounds.height())
+    );
+}
+
+
+#endif
@@ -1,6 +1,12 @@
 #include "node_storage.h"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include <iterator>
+#include <limits>
+
+#include "morton.h"
 
 
 constexpr std::string out[4] = {"TL", "TR", "BL", "BR"};
@@ -35,42 +41,315 @@ int Streamlines::size(Direction dir) const {
     return streamlines_.at(dir).size();
 }
 
-//  SECTION: Spatial
+//  SECTION: SpatialIndex
+
+template<typename T>
+bool TSpatialIndex<T>::has_nearby_point(const Vec& centre, const T& radius, const SpatialFilter& filter) const {
+    return visit_nearby(centre, radius, filter, NodeVisitor());
+}
 
 
-const DVector2& Spatial::node_to_pos(const node_id& id) const {
-    return (*all_nodes_)[id].pos;
+template<typename T>
+bool TSpatialIndex<T>::has_nearby_point(const Vec& centre, const T& radius, const SpatialFilter& filter, 
+    SpatialCursor& cursor) const 
+{
+    return visit_nearby_from(cursor, centre, radius, filter, NodeVisitor());
 }
 
-char Spatial::node_to_dir(const node_id& id) const {
-    return (*all_nodes_)[id].dir;
+
+// morton keys of the batch, code in the top half and index in the bottom
+static thread_local std::vector<std::uint64_t> batch_keys;
+
+template<typename T>
+void TSpatialIndex<T>::has_nearby_points(std::span<const Vec> centres, const T& radius, const SpatialFilter& filter, 
+    std::vector<bool>& out) const 
+{
+    out.assign(centres.size(), false);
+    if (centres.empty()) return;
+
+    Box<T> bounds(centres.front(), centres.front());
+    for (const Vec& c : centres) {
+        bounds |= c;
+    }
+
+    std::vector<std::uint64_t>& keys = batch_keys;
+    keys.resize(centres.size());
+    for (std::size_t i = 0; i < centres.size(); ++i) {
+        keys[i] = (static_cast<std::uint64_t>(morton_code(centres[i], bounds, 16)) << 32) | i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    SpatialCursor cursor;
+    for (std::uint64_t key : keys) {
+        std::uint32_t i = static_cast<std::uint32_t>(key);
+        out[i] = visit_nearby_from(cursor, centres[i], radius, filter, NodeVisitor());
+    }
 }
 
-// array of 4 intervals representing [TopLeft, TopRight, BottomLeft, BottomRight]
-std::array<std::pair<char, std::list<node_id>>, 4> 
-Spatial::partition(const Box<double>& bbox, std::list<node_id>& s) {
-    DVector2 mid = middle(bbox.min, bbox.max);
 
-    auto is_right  = [&mid, this](const node_id& id) { return node_to_pos(id).x > mid.x; };
-    auto is_bottom = [&mid, this](const node_id& id) { return node_to_pos(id).y > mid.y; };
+template<typename T>
+bool TSpatialIndex<T>::visit_nearby_from(SpatialCursor& cursor, const Vec& centre, const T& radius,
+    const SpatialFilter& filter, NodeVisitor visitor) const 
+{
+    return visit_nearby(centre, radius, filter, visitor);
+}
 
-    std::array<std::pair<char, std::list<node_id>>, 4> out;
 
-    // 4 way partition
-    for (auto it=s.begin(); it!=s.end();) {
-        iter curr = it;
-        std::advance(it, 1);
-        
-        int q = is_right(*curr) + (is_bottom(*curr)<<1);
-        out[q].first |= node_to_dir(*curr);
-        out[q].second.splice(out[q].second.end(), s, curr);
+template<typename T>
+void TSpatialIndex<T>::remove_streamline(const Streamline& s) {
+    std::vector<node_id> ids(s.begin(), s.end());
+    remove_nodes(ids);
+}
+
+
+template<typename T>
+void TSpatialIndex<T>::insert_nodes(node_id first, node_id last) {
+    Streamline run;
+    for (node_id id = first; id < last; ++id) {
+        if (!run.empty() && all_nodes_->streamline(run.back()) != all_nodes_->streamline(id)) {
+            insert_streamline(run);
+            run.clear();
+        }
+        run.push_back(id);
     }
+    if (!run.empty()) insert_streamline(run);
+}
+
 
+template<typename T>
+std::size_t TSpatialIndex<T>::nearby_points(const Vec& centre, const T& radius, const SpatialFilter& filter, 
+    std::vector<node_id>& out) const 
+{
+    out.clear();
+    visit_nearby_points(centre, radius, filter, [&out](node_id id) { out.push_back(id); });
+    return out.size();
+}
+
+
+template<typename T>
+std::list<node_id> TSpatialIndex<T>::nearby_points(const Vec& centre, const T& radius, const SpatialFilter& filter) const {
+    std::list<node_id> out;
+    visit_nearby_points(centre, radius, filter, [&out](node_id id) { out.push_back(id); });
+    return out;
+}
+
+
+template<typename T>
+std::optional<node_id> TSpatialIndex<T>::nearest_point(const Vec& centre, const T& max_radius, const SpatialFilter& filter) const {
+    node_id out;
+    if (!visit_k_nearest(centre, 1, max_radius, filter, NodeVisitor(), &out)) return {};
     return out;
+}
+
+
+//  SECTION: nearest neighbours
+
+namespace {
+
+struct NearestCandidate {
+    double d2;
+    node_id id;
+
+    // ties go to the lower id, so results do not depend on visit order
+    bool operator<(const NearestCandidate& other) const {
+        return d2 < other.d2 || (d2 == other.d2 && id < other.id);
+    }
 };
 
 
-bool Spatial::is_leaf(const qnode_id& id) const {
+template<typename T>
+struct NearestCell {
+    T d2;
+    qnode_id id;
+    Box<T> bbox;
+
+    // reversed, the heap keeps the nearest cell on top
+    bool operator<(const NearestCell& other) const {
+        return d2 > other.d2;
+    }
+};
+
+
+// keeps the k best in a max heap, so front() is the one to beat
+void offer(std::vector<NearestCandidate>& best, std::size_t k, NearestCandidate c) {
+    if (best.size() == k) {
+        if (!(c < best.front())) return;
+        std::pop_heap(best.begin(), best.end());
+        best.pop_back();
+    }
+    best.push_back(c);
+    std::push_heap(best.begin(), best.end());
+}
+
+
+std::size_t write_nearest(std::vector<NearestCandidate>& best, node_id* out) {
+    std::sort_heap(best.begin(), best.end());
+    for (std::size_t i = 0; i < best.size(); ++i) {
+        out[i] = best[i].id;
+    }
+    return best.size();
+}
+
+// scratch for the queries, grown once per thread and reused after that
+thread_local std::vector<NearestCandidate> nearest_best;
+template<typename T>
+thread_local std::vector<NearestCell<T>> nearest_cells;
+
+}
+
+
+template<typename T>
+std::size_t TSpatialIndex<T>::visit_k_nearest(const Vec& centre, std::size_t k, const T& max_radius,
+    const SpatialFilter& filter, NodeVisitor predicate, node_id* out) const 
+{
+    if (k == 0) return 0;
+
+    std::vector<NearestCandidate>& best = nearest_best;
+    best.clear();
+
+    visit_nearby_points(centre, max_radius, filter, [&](node_id id) {
+        if (predicate && !predicate(id)) return;
+        Vec diff = this->all_nodes_->pos(id) - centre;
+        offer(best, k, {dot_product(diff, diff), id});
+    });
+
+    return write_nearest(best, out);
+}
+
+
+//  SECTION: LeafPool
+
+template<typename T>
+int TLeafPool<T>::size_class(std::uint32_t n) {
+    int k = 0;
+    while ((1u << k) < n) ++k;
+    return k;
+}
+
+
+template<typename T>
+block_id TLeafPool<T>::allocate(int size_class) {
+    assert(size_class < kSizeClasses);
+
+    std::vector<block_id>& free = free_[size_class];
+    if (!free.empty()) {
+        block_id block = free.back();
+        free.pop_back();
+        return block;
+    }
+
+    std::size_t block = xs_.size();
+    std::size_t capacity = std::size_t(1) << size_class;
+
+    // blocks may not straddle chunks, so if this one would, the rest of the
+    // chunk goes to the free lists as the largest aligned blocks that fit
+    std::size_t chunk_end = (block | (Array<T>::kChunkSize - 1)) + 1;
+    if (block + capacity > chunk_end) {
+        while (block < chunk_end) {
+            int k = std::min<int>(std::countr_zero(block), std::bit_width(chunk_end - block) - 1);
+            free_[k].push_back(block);
+            block += std::size_t(1) << k;
+        }
+    }
+
+    grow(block + capacity);
+    return block;
+}
+
+
+template<typename T>
+void TLeafPool<T>::grow(std::size_t new_size) {
+    xs_.resize(new_size);
+    ys_.resize(new_size);
+    ids_.resize(new_size);
+    streamlines_.resize(new_size);
+    roads_.resize(new_size);
+}
+
+
+template<typename T>
+void TLeafPool<T>::release(block_id block, int size_class) {
+    free_[size_class].push_back(block);
+}
+
+
+template<typename T>
+void TLeafPool<T>::clear() {
+    xs_.clear();
+    ys_.clear();
+    ids_.clear();
+    streamlines_.clear();
+    roads_.clear();
+
+    for (auto& free : free_) {
+        free.clear();
+    }
+}
+
+
+template<typename T>
+void TLeafPool<T>::set(std::uint32_t i, const LeafEntry& entry) {
+    xs_[i] = entry.pos.x;
+    ys_[i] = entry.pos.y;
+    ids_[i] = entry.id;
+    streamlines_[i] = entry.streamline;
+    roads_[i] = entry.roads;
+}
+
+
+template<typename T>
+TLeafEntry<T> TLeafPool<T>::get(std::uint32_t i) const {
+    return LeafEntry {
+        {xs_[i], ys_[i]},
+        ids_[i],
+        streamlines_[i],
+        roads_[i]
+    };
+}
+
+
+//  SECTION: Spatial
+
+
+template<typename T>
+TLeafEntry<T> TSpatial<T>::node_to_entry(const node_id& id) const {
+    return LeafEntry {
+        this->all_nodes_->pos(id),
+        id,
+        this->all_nodes_->streamline(id),
+        road_bits(this->all_nodes_->road(id), this->all_nodes_->dir(id))
+    };
+}
+
+
+template<typename T>
+std::array<TLeafEntry<T>*, 5>
+TSpatial<T>::partition(const Box<T>& bbox, LeafEntry* begin, LeafEntry* end) const {
+    Vec mid = middle(bbox.min, bbox.max);
+
+    auto is_top  = [&mid](const LeafEntry& e) { return !(e.pos.y > mid.y); };
+    auto is_left = [&mid](const LeafEntry& e) { return !(e.pos.x > mid.x); };
+
+    LeafEntry* bottom = std::partition(begin, end, is_top);
+    LeafEntry* top_right = std::partition(begin, bottom, is_left);
+    LeafEntry* bottom_right = std::partition(bottom, end, is_left);
+
+    return {begin, top_right, bottom, bottom_right, end};
+}
+
+
+template<typename T>
+NodeSummary TSpatial<T>::range_summary(const LeafEntry* begin, const LeafEntry* end) {
+    NodeSummary summary;
+    for (const LeafEntry* it = begin; it != end; ++it) {
+        summary.add(it->roads, it->streamline);
+    }
+    return summary;
+}
+
+
+template<typename T>
+bool TSpatial<T>::is_leaf(const qnode_id& id) const {
     const QuadNode& root_node = qnodes_[id];
     for (int i=0; i<4;++i) {
         if (root_node.children[i] != QNullNode) return false;
@@ -79,115 +358,339 @@ bool Spatial::is_leaf(const qnode_id& id) const {
 
 }
 
-void Spatial::subdivide(const qnode_id& head_ptr) {
-    const Box<double> bbox = qnodes_[head_ptr].bbox;
 
-    auto parts = partition(bbox, qnodes_[head_ptr].data);
+template<typename T>
+void TSpatial<T>::subdivide(const qnode_id& head_ptr, const Box<T>& bbox) {
+    // move the leaf data out, it is redistributed into new children
+    const QuadNode& head = qnodes_[head_ptr];
 
-    for (int i=0;i<4;++i) {
-        std::list<node_id>& sublist = parts[i].second;
-        if (sublist.empty()) continue;
+    subdivide_scratch_.clear();
+    for (std::uint32_t i = head.block; i < head.block + head.size; ++i) {
+        subdivide_scratch_.push_back(leaves_.get(i));
+    }
 
-        char& dirs = parts[i].first;
+    if (head.block != NullBlock) {
+        release_block(head.block, head.size_class);
+    }
+    qnodes_[head_ptr].block = NullBlock;
+    qnodes_[head_ptr].size = 0;
+
+    LeafEntry* begin = subdivide_scratch_.data();
+    LeafEntry* end = begin + subdivide_scratch_.size();
+    auto parts = partition(bbox, begin, end);
+
+    for (int i=0;i<4;++i) {
+        if (parts[i] == parts[i+1]) continue;
 
         Quadrant q = static_cast<Quadrant>(i);
-        Box<double> sub_bbox = qnodes_[head_ptr].bbox.get_quadrant(q);
 
-        qnode_id child_ptr = qnodes_.size();
-        qnodes_.emplace_back(sub_bbox, dirs);
-        qnodes_[child_ptr].data = std::move(sublist);
+        qnode_id child_ptr = new_qnode();
+        append_leaf_data(child_ptr, range_summary(parts[i], parts[i+1]), parts[i], parts[i+1]);
 
         qnodes_[head_ptr].children[q] = child_ptr;
     }
 }
 
 
-void Spatial::append_leaf_data(const qnode_id& leaf_ptr, const char& dirs, 
-    std::list<node_id>& data) 
+template<typename T>
+void TSpatial<T>::append_leaf_data(const qnode_id& leaf_ptr, const NodeSummary& summary, 
+    const LeafEntry* begin, const LeafEntry* end) 
 {
-    qnodes_[leaf_ptr].dirs |= dirs;
-    qnodes_[leaf_ptr].data.splice(qnodes_[leaf_ptr].data.end(), data);
+    if (begin == end) return;
+
+    QuadNode& leaf = qnodes_[leaf_ptr];
+    std::uint32_t new_size = leaf.size + (end - begin);
+
+    // grow into the next size class up
+    if (leaf.block == NullBlock || new_size > (1u << leaf.size_class)) {
+        int size_class = LeafPool::size_class(new_size);
+        block_id block = leaves_.allocate(size_class);
+
+        for (std::uint32_t i = 0; i < leaf.size; ++i) {
+            leaves_.set(block + i, leaves_.get(leaf.block + i));
+        }
+
+        if (leaf.block != NullBlock) {
+            release_block(leaf.block, leaf.size_class);
+        }
+
+        leaf.block = block;
+        leaf.size_class = size_class;
+    }
+
+    // past the end of any published copy of this leaf, so still unread
+    std::uint32_t i = leaf.block + leaf.size;
+    for (const LeafEntry* it = begin; it != end; ++it, ++i) {
+        leaves_.set(i, *it);
+    }
+
+    leaf.size = new_size;
+    leaf.summary.add(summary);
 }
 
 
-void Spatial::insert_rec(int depth, const qnode_id& head_ptr,
-    const char& dirs,
-    std::list<node_id>& list) 
+template<typename T>
+qnode_id TSpatial<T>::insert_rec(int depth, qnode_id head_ptr,
+    const Box<T>& bbox,
+    const NodeSummary& summary,
+    LeafEntry* begin,
+    LeafEntry* end) 
 {
+    head_ptr = writable(head_ptr);
+
     if (depth >= max_depth_) {
-        append_leaf_data(head_ptr, dirs, list);
-        return;
+        append_leaf_data(head_ptr, summary, begin, end);
+        return head_ptr;
     } else if (is_leaf(head_ptr)) {
-        if (qnodes_[head_ptr].data.size() + list.size() <= leaf_capacity_) {
-            append_leaf_data(head_ptr, dirs, list);
-            return;
+        if (qnodes_[head_ptr].size + (end - begin) <= leaf_capacity_) {
+            append_leaf_data(head_ptr, summary, begin, end);
+            return head_ptr;
         }
-        subdivide(head_ptr);
+        subdivide(head_ptr, bbox);
     }
 
-    qnodes_[head_ptr].dirs |= dirs;
+    qnodes_[head_ptr].summary.add(summary);
 
-    Box<double> bbox = qnodes_[head_ptr].bbox;
-    auto parts = partition(bbox, list);
+    auto parts = partition(bbox, begin, end);
     
     ++depth;
 
     for (int q=0; q<4;++q) {
-        auto& [sub_dirs, sublist] = parts[q];
-
-        if (sublist.empty()) continue;
+        if (parts[q] == parts[q+1]) continue;
 
         qnode_id child_ptr = qnodes_[head_ptr].children[q];
 
         if (child_ptr == QNullNode) {
-            child_ptr = qnodes_.size();
-            qnodes_.emplace_back(bbox.get_quadrant((Quadrant) q), 0);
-            qnodes_[head_ptr].children[q] = child_ptr;
+            child_ptr = new_qnode();
         }
-        
 
-        insert_rec(
+        qnodes_[head_ptr].children[q] = insert_rec(
             depth,
             child_ptr,
-            sub_dirs,
-            sublist
+            bbox.get_quadrant((Quadrant) q),
+            range_summary(parts[q], parts[q+1]),
+            parts[q],
+            parts[q+1]
         );
     }
 
+    return head_ptr;
+}
+
+
+template<typename T>
+template<typename F>
+void TSpatial<T>::remove_from_leaf(const qnode_id& leaf_ptr, F&& remove) {
+    QuadNode& leaf = qnodes_[leaf_ptr];
+    if (leaf.size == 0) return;
+
+    // a published copy may still be reading the block, so in concurrent
+    // mode the survivors go to a new one rather than being compacted
+    block_id from = leaf.block;
+    block_id to = concurrent_ ? leaves_.allocate(leaf.size_class) : from;
+
+    std::uint32_t kept = 0;
+    leaf.summary = NodeSummary{};
+    for (std::uint32_t i = 0; i < leaf.size; ++i) {
+        LeafEntry e = leaves_.get(from + i);
+        if (remove(e)) continue;
+
+        leaves_.set(to + kept, e);
+        leaf.summary.add(e.roads, e.streamline);
+        ++kept;
+    }
+
+    if (to != from) {
+        release_block(from, leaf.size_class);
+    }
+
+    leaf.block = to;
+    leaf.size = kept;
+
+    if (kept == 0) {
+        release_block(leaf.block, leaf.size_class);
+        leaf.block = NullBlock;
+        leaf.size_class = 0;
+    }
+}
+
+
+template<typename T>
+void TSpatial<T>::merge_children(const qnode_id& head_ptr) {
+    QuadNode& head = qnodes_[head_ptr];
+
+    head.summary = NodeSummary{};
+    std::uint32_t total = 0;
+    bool all_leaves = true;
+
+    for (qnode_id child_ptr : head.children) {
+        if (child_ptr == QNullNode) continue;
+
+        head.summary.add(qnodes_[child_ptr].summary);
+        all_leaves &= is_leaf(child_ptr);
+        total += qnodes_[child_ptr].size;
+    }
+
+    // half, so a node on the edge of splitting does not merge right back
+    if (!all_leaves || total > static_cast<std::uint32_t>(leaf_capacity_/2)) return;
+
+    subdivide_scratch_.clear();
+    for (qnode_id& child_ptr : head.children) {
+        if (child_ptr == QNullNode) continue;
+
+        const QuadNode& child = qnodes_[child_ptr];
+        for (std::uint32_t i = child.block; i < child.block + child.size; ++i) {
+            subdivide_scratch_.push_back(leaves_.get(i));
+        }
+        if (child.block != NullBlock) {
+            release_block(child.block, child.size_class);
+        }
+
+        release_qnode(child_ptr);
+        child_ptr = QNullNode;
+    }
+
+    LeafEntry* begin = subdivide_scratch_.data();
+    LeafEntry* end = begin + subdivide_scratch_.size();
+    append_leaf_data(head_ptr, range_summary(begin, end), begin, end);
+}
+
+
+template<typename T>
+qnode_id TSpatial<T>::remove_rec(qnode_id head_ptr,
+    const Box<T>& bbox,
+    LeafEntry* begin,
+    LeafEntry* end) 
+{
+    head_ptr = writable(head_ptr);
+
+    if (is_leaf(head_ptr)) {
+        // ranges that reach a leaf are short, so a scan per entry is fine
+        remove_from_leaf(head_ptr, [begin, end](const LeafEntry& e) {
+            for (const LeafEntry* it = begin; it != end; ++it) {
+                if (it->id == e.id) return true;
+            }
+            return false;
+        });
+    } else {
+        auto parts = partition(bbox, begin, end);
+
+        for (int q=0; q<4; ++q) {
+            qnode_id child_ptr = qnodes_[head_ptr].children[q];
+            if (parts[q] == parts[q+1] || child_ptr == QNullNode) continue;
+
+            qnodes_[head_ptr].children[q] = remove_rec(
+                child_ptr,
+                bbox.get_quadrant((Quadrant) q),
+                parts[q],
+                parts[q+1]
+            );
+        }
+
+        merge_children(head_ptr);
+    }
+
+    if (is_leaf(head_ptr) && qnodes_[head_ptr].size == 0) {
+        release_qnode(head_ptr);
+        return QNullNode;
+    }
+    return head_ptr;
+}
+
+
+template<typename T>
+qnode_id TSpatial<T>::remove_region_rec(qnode_id head_ptr,
+    const Box<T>& bbox,
+    const Box<T>& region,
+    const SpatialFilter& filter,
+    std::vector<node_id>& removed) 
+{
+    // partition sends entries on a split to the lower side, so a cell can
+    // hold entries on both its edges, while region is half open
+
+    // untouched subtrees are left alone, not even copied
+    bool touched = region.min.x <= bbox.max.x && bbox.min.x < region.max.x
+        && region.min.y <= bbox.max.y && bbox.min.y < region.max.y;
+    if (!touched || !filter.admits(qnodes_[head_ptr].summary)) {
+        return head_ptr;
+    }
+
+    // the whole subtree goes
+    bool inside = region.min.x <= bbox.min.x && bbox.max.x < region.max.x
+        && region.min.y <= bbox.min.y && bbox.max.y < region.max.y;
+    if (inside && filter.roads_only() && !(qnodes_[head_ptr].summary.roads & ~filter.roads)) {
+        release_subtree(head_ptr, removed);
+        return QNullNode;
+    }
+
+    head_ptr = writable(head_ptr);
+
+    if (is_leaf(head_ptr)) {
+        remove_from_leaf(head_ptr, [&](const LeafEntry& e) {
+            if (!region.contains(e.pos) || !filter.admits(e.roads, e.streamline)) return false;
+            removed.push_back(e.id);
+            return true;
+        });
+    } else {
+        for (int q=0; q<4; ++q) {
+            qnode_id child_ptr = qnodes_[head_ptr].children[q];
+            if (child_ptr == QNullNode) continue;
+
+            qnodes_[head_ptr].children[q] = remove_region_rec(
+                child_ptr,
+                bbox.get_quadrant((Quadrant) q),
+                region,
+                filter,
+                removed
+            );
+        }
+
+        merge_children(head_ptr);
+    }
+
+    if (is_leaf(head_ptr) && qnodes_[head_ptr].size == 0) {
+        release_qnode(head_ptr);
+        return QNullNode;
+    }
+    return head_ptr;
 }
 
 
+// the query recursions return true once the query is done: the visitor
+// stopped it, or with no visitor, anything was found at all
+template<typename T>
 bool 
-Spatial::in_circle_rec(const qnode_id& head_ptr, CircleQuery& query) const {
+TSpatial<T>::in_circle_rec(const qnode_id& head_ptr, const Box<T>& bbox, CircleQuery& query) const {
     const QuadNode& qnode = qnodes_[head_ptr];
 
-    // terminate if bboxes dont intersect, or no dirs to explore
-    if (!(qnode.dirs & query.dirs) || (query.outer_bbox & qnode.bbox).is_empty()) {
+    // terminate if bboxes dont intersect, or nothing below passes the filter
+    if (!query.filter.admits(qnode.summary) || (query.outer_bbox & bbox).is_empty()) {
         return false;
     }
 
-    // if query.inner_bbox ⊆ qnode.bbox
-    if ((qnode.bbox | query.inner_bbox) == query.inner_bbox) {
-        return in_bbox_rec(head_ptr, query);
+    // if bbox ⊆ query.inner_bbox
+    if ((bbox | query.inner_bbox) == query.inner_bbox) {
+        return in_bbox_rec(head_ptr, bbox, query);
     }
 
-    bool flag = false;
-
     if (is_leaf(head_ptr)) {
-        for (const node_id& id : qnode.data) {
-            if (!(node_to_dir(id) & query.dirs)) continue;
+        if (qnode.size == 0) return false;
 
-            DVector2 dist = query.centre - node_to_pos(id);
-            if (dot_product(dist, dist) > query.radius2) continue;
+        const T* xs = leaves_.xs(qnode.block);
+        const T* ys = leaves_.ys(qnode.block);
+        const road_mask* roads = leaves_.roads(qnode.block);
+        const int* streamlines = leaves_.streamlines(qnode.block);
 
-            if (query.gather) {
-                query.harvest.push_back(id);
-                flag = true;
-            } else {
-                return true;
-            }
+        for (std::uint32_t i = 0; i < qnode.size; ++i) {
+            if (!query.filter.admits(roads[i], streamlines[i])) continue;
+
+            T dx = query.centre.x - xs[i];
+            T dy = query.centre.y - ys[i];
+            if (dx*dx + dy*dy > query.radius2) continue;
+
+            if (!query.visitor || query.visitor(leaves_.ids(qnode.block)[i])) return true;
         }
-        return flag;
+        return false;
     }
 
 
@@ -195,60 +698,48 @@ Spatial::in_circle_rec(const qnode_id& head_ptr, CircleQuery& query) const {
         const qnode_id& child_ptr = qnode.children[q];
 
         if (child_ptr == QNullNode) continue;
-        const QuadNode& child_node = qnodes_[child_ptr];
 
-
-        if (in_circle_rec(child_ptr, query)) {
-            if (query.gather) {
-                flag = true;
-            } else {
-                return true;
-            }
-        }
+        if (in_circle_rec(child_ptr, bbox.get_quadrant((Quadrant) q), query)) return true;
     }
 
-    return flag;
+    return false;
 }
 
 
+template<typename T>
 bool 
-Spatial::in_bbox_rec(const qnode_id& head_ptr, BBoxQuery& query) const {
+TSpatial<T>::in_bbox_rec(const qnode_id& head_ptr, const Box<T>& bbox, BBoxQuery& query) const {
     const QuadNode& qnode = qnodes_[head_ptr];
 
-    if ((query.inner_bbox & qnode.bbox).is_empty() || !(qnode.dirs & query.dirs)) {
+    if ((query.inner_bbox & bbox).is_empty() || !query.filter.admits(qnode.summary)) {
         return false; // boxes dont intersect
     }
 
 
-    if ((query.inner_bbox | qnode.bbox) == query.inner_bbox) {
-        if (query.gather && !qnode.data.empty()) {
-            for (auto& id : qnode.data) {
-                if (!(node_to_dir(id) & query.dirs)) continue; 
-
-                query.harvest.push_back(id);
-            }
-
-            return !is_leaf(head_ptr) || !qnode.data.empty();
-        } else if (!query.gather) {
-            return !is_leaf(head_ptr) || !qnode.data.empty();
+    if ((query.inner_bbox | bbox) == query.inner_bbox) {
+        // the summary only proves a hit when roads are all that is filtered
+        if (!query.visitor && query.filter.roads_only()) {
+            return !is_leaf(head_ptr) || qnode.size;
         }
+        return visit_rec(head_ptr, query);
     }
 
 
-    bool flag = false;
-
     if (is_leaf(head_ptr)) {
-        for (const node_id& id : qnode.data) {
-            if (query.inner_bbox.contains(node_to_pos(id)) && (node_to_dir(id) & query.dirs)) {
-                if (query.gather) {
-                    query.harvest.push_back(id);
-                    flag = true;
-                } else {
-                    return true;
-                }
-            }
+        if (qnode.size == 0) return false;
+
+        const T* xs = leaves_.xs(qnode.block);
+        const T* ys = leaves_.ys(qnode.block);
+        const road_mask* roads = leaves_.roads(qnode.block);
+        const int* streamlines = leaves_.streamlines(qnode.block);
+
+        for (std::uint32_t i = 0; i < qnode.size; ++i) {
+            if (!query.filter.admits(roads[i], streamlines[i])) continue;
+            if (!query.inner_bbox.contains({xs[i], ys[i]})) continue;
+
+            if (!query.visitor || query.visitor(leaves_.ids(qnode.block)[i])) return true;
         }
-        return flag;
+        return false;
     }
 
     // otherwise, check children
@@ -257,75 +748,512 @@ Spatial::in_bbox_rec(const qnode_id& head_ptr, BBoxQuery& query) const {
         // node is null
         if (child_ptr == QNullNode) continue;
 
-        if (in_bbox_rec(child_ptr, query)) {
-            if (query.gather) {
-                flag = true;
-            } else {
-                return true;
-            }
+        if (in_bbox_rec(child_ptr, bbox.get_quadrant((Quadrant) i), query)) return true;
+    }
+
+    return false;
+}
+
+
+// visit the whole subtree, its box is inside the query
+template<typename T>
+bool
+TSpatial<T>::visit_rec(const qnode_id& head_ptr, BBoxQuery& query) const {
+    const QuadNode& qnode = qnodes_[head_ptr];
+
+    if (!query.filter.admits(qnode.summary)) return false;
+
+    if (qnode.size > 0) {
+        const road_mask* roads = leaves_.roads(qnode.block);
+        const int* streamlines = leaves_.streamlines(qnode.block);
+
+        for (std::uint32_t i = 0; i < qnode.size; ++i) {
+            if (!query.filter.admits(roads[i], streamlines[i])) continue; 
+
+            if (!query.visitor || query.visitor(leaves_.ids(qnode.block)[i])) return true;
         }
     }
 
-    return flag;
+    for (int i=0;i<4;++i) {
+        const qnode_id& child_ptr = qnode.children[i];
+        if (child_ptr == QNullNode) continue;
+
+        if (visit_rec(child_ptr, query)) return true;
+    }
+
+    return false;
 }
 
 
-Spatial::Spatial(const std::vector<StreamlineNode>* all_nodes, 
-    Box<double> dims, int depth, int leaf_capacity) :
-    all_nodes_(all_nodes),
+template<typename T>
+TSpatial<T>::TSpatial(const NodeStore* all_nodes, 
+    Box<T> dims, double min_cell_size, int leaf_capacity) :
+    TSpatialIndex<T>(all_nodes),
     dimensions_(dims),  
-    max_depth_(depth),
+    min_cell_size_(min_cell_size),
     leaf_capacity_(leaf_capacity)
 {
-    root_ = 0;
-    qnodes_.emplace_back(dimensions_, 0);
+    assert(min_cell_size_ > 0.0);
+    clear();
 }
 
 
-void Spatial::clear() {
+// nothing may be querying, ids from before are all invalid after
+template<typename T>
+void TSpatial<T>::clear() {
     qnodes_.clear();
-    root_ = 0;
-    qnodes_.emplace_back(dimensions_, std::numeric_limits<char>::max());
+    free_qnodes_.clear();
+    leaves_.clear();
+
+    unlinked_.qnodes.clear();
+    unlinked_.blocks.clear();
+    for (Retired& r : retired_) {
+        r.qnodes.clear();
+        r.blocks.clear();
+        spare_retired_.push_back(std::move(r));
+    }
+    retired_.clear();
+
+    bounds_ = dimensions_;
+    extents_.clear();
+    extents_.push_back(bounds_);
+
+    // halve the longer side until it fits in a leaf cell
+    max_depth_ = 0;
+    for (double side = std::max(bounds_.width(), bounds_.height()); side > min_cell_size_; side /= 2) {
+        ++max_depth_;
+    }
+
+    ++version_;
+    publish(new_qnode());
 }
 
 
-void Spatial::reset(Box<double> new_dims) {
+template<typename T>
+void TSpatial<T>::reset(Box<T> new_dims) {
     dimensions_ = new_dims;
     clear();
 }
 
-// copies the list.
-void Spatial::insert_streamline(Streamline s, const char& dir) {
-    if (s.size() == 0) return;
 
-    iter begin = s.begin();
-    iter end   = s.end();
+template<typename T>
+void TSpatial<T>::insert_streamline(const Streamline& s) {
+    if (s.size() == 0) return;
 
-    iter last_node = end;
-    std::advance(last_node, -1);
+    Streamline::const_iterator end = s.end();
 
-    // if the streamline is a circle
-    if (*begin == *last_node && s.size() > 2) {
+    // if the streamline is a circle, index the shared node once
+    if (s.front() == s.back() && s.size() > 2) {
         std::advance(end, -1);
     }
 
-    insert_rec(
+    insert_scratch_.clear();
+    Vec first = this->all_nodes_->pos(s.front());
+    Box<T> bounds(first, first);
+    for (auto it = s.begin(); it != end; ++it) {
+        insert_scratch_.push_back(node_to_entry(*it));
+        bounds |= insert_scratch_.back().pos;
+    }
+
+    qnode_id head = grow(root(), bounds);
+
+    LeafEntry* begin = insert_scratch_.data();
+
+    publish(insert_rec(
         0, 
-        root_,
-        dir,
-        s
-    );
+        head,
+        bounds_,
+        range_summary(begin, begin + insert_scratch_.size()),
+        begin,
+        begin + insert_scratch_.size()
+    ));
+}
+
+
+template<typename T>
+void TSpatial<T>::remove_nodes(std::span<const node_id> ids) {
+    if (ids.empty()) return;
+
+    insert_scratch_.clear();
+    for (node_id id : ids) {
+        insert_scratch_.push_back(node_to_entry(id));
+    }
+
+    LeafEntry* begin = insert_scratch_.data();
+    qnode_id head = remove_rec(root(), bounds_, begin, begin + insert_scratch_.size());
+
+    publish(head == QNullNode ? new_qnode() : head);
+}
+
+
+template<typename T>
+std::size_t TSpatial<T>::remove_region(const Box<T>& region, const SpatialFilter& filter, 
+    std::vector<node_id>& removed) 
+{
+    std::size_t before = removed.size();
+
+    qnode_id head = remove_region_rec(root(), bounds_, region, filter, removed);
+    publish(head == QNullNode ? new_qnode() : head);
+
+    return removed.size() - before;
+}
+
+
+template<typename T>
+bool TSpatial<T>::set_concurrent(bool concurrent) {
+    if (concurrent == concurrent_) return true;
+
+    concurrent_ = concurrent;
+
+    if (concurrent_) {
+        ++version_; // everything so far is now published
+    } else {
+        // no reader is left to hold anything retired
+        reclaim(std::numeric_limits<epoch_t>::max());
+    }
+
+    return true;
 }
 
 
-bool Spatial::has_nearby_point(const DVector2& centre, const double& radius, const char& dirs) const {
-    CircleQuery query(dirs, centre, radius, false);
-    return in_circle_rec(root_, query);
+template<typename T>
+qnode_id TSpatial<T>::root() const {
+    return static_cast<qnode_id>(published_.load());
 }
 
 
-std::list<node_id> Spatial::nearby_points(const DVector2& centre, const double& radius, const char& dirs) const {
-    CircleQuery query(dirs, centre, radius, true);
-    in_circle_rec(root_, query);
-    return query.harvest;
+template<typename T>
+const Box<T>& TSpatial<T>::dimensions() const {
+    return snapshot().bbox;
+}
+
+
+template<typename T>
+typename TSpatial<T>::Snapshot TSpatial<T>::snapshot() const {
+    std::uint64_t published = published_.load();
+    return {
+        static_cast<qnode_id>(published),
+        extents_[(published >> 32) & 0xff],
+        published >> 32
+    };
+}
+
+
+template<typename T>
+qnode_id TSpatial<T>::grow(qnode_id head_ptr, const Box<T>& bounds) {
+    constexpr T inf = std::numeric_limits<T>::infinity();
+
+    while (!(bounds_.min.x <= bounds.min.x && bounds.max.x <= bounds_.max.x
+        && bounds_.min.y <= bounds.min.y && bounds.max.y <= bounds_.max.y)) 
+    {
+        assert(extents_.size() <= kMaxGrowths);
+
+        bool left = bounds.min.x < bounds_.min.x;
+        bool up = bounds.min.y < bounds_.min.y;
+
+        // the old root's min edge becomes a split, which partition sends
+        // the other way, so what sits on it has to move across
+        std::vector<node_id> moved;
+        if (left) {
+            Box<T> edge({bounds_.min.x, -inf}, {std::nextafter(bounds_.min.x, inf), inf});
+            head_ptr = remove_region_rec(head_ptr, bounds_, edge, SpatialFilter(), moved);
+        }
+        if (up && head_ptr != QNullNode) {
+            Box<T> edge({-inf, bounds_.min.y}, {inf, std::nextafter(bounds_.min.y, inf)});
+            head_ptr = remove_region_rec(head_ptr, bounds_, edge, SpatialFilter(), moved);
+        }
+        for (node_id id : moved) {
+            insert_scratch_.push_back(node_to_entry(id));
+        }
+
+        Vec size = bounds_.max - bounds_.min;
+        if (left) bounds_.min.x -= size.x; else bounds_.max.x += size.x;
+        if (up) bounds_.min.y -= size.y; else bounds_.max.y += size.y;
+
+        extents_.push_back(bounds_);
+        ++max_depth_;
+
+        qnode_id grown = new_qnode();
+        if (head_ptr != QNullNode && is_leaf(head_ptr) && qnodes_[head_ptr].size == 0) {
+            release_qnode(head_ptr);
+        } else if (head_ptr != QNullNode) {
+            qnodes_[grown].children[left | (up << 1)] = head_ptr;
+            qnodes_[grown].summary = qnodes_[head_ptr].summary;
+        }
+        head_ptr = grown;
+    }
+
+    return head_ptr;
+}
+
+
+template<typename T>
+qnode_id TSpatial<T>::new_qnode() {
+    qnode_id id;
+    if (!free_qnodes_.empty()) {
+        id = free_qnodes_.back();
+        free_qnodes_.pop_back();
+        qnodes_[id] = QuadNode{};
+    } else {
+        id = qnodes_.size();
+        qnodes_.emplace_back();
+    }
+
+    qnodes_[id].version = version_;
+    return id;
 }
+
+
+// the node to write to in place of id. outside concurrent mode that is id
+// itself, otherwise published nodes are copied on first write
+template<typename T>
+qnode_id TSpatial<T>::writable(const qnode_id& id) {
+    if (!concurrent_ || qnodes_[id].version == version_) return id;
+
+    qnode_id copy = new_qnode();
+    qnodes_[copy] = qnodes_[id];
+    qnodes_[copy].version = version_;
+
+    unlinked_.qnodes.push_back(id);
+    return copy;
+}
+
+
+template<typename T>
+void TSpatial<T>::release_qnode(const qnode_id& id) {
+    if (!concurrent_) {
+        free_qnodes_.push_back(id);
+        reshaped_ = true;
+        return;
+    }
+    unlinked_.qnodes.push_back(id);
+}
+
+
+template<typename T>
+void TSpatial<T>::release_subtree(const qnode_id& id, std::vector<node_id>& removed) {
+    const QuadNode& qnode = qnodes_[id];
+
+    if (qnode.size > 0) {
+        const node_id* ids = leaves_.ids(qnode.block);
+        removed.insert(removed.end(), ids, ids + qnode.size);
+    }
+    if (qnode.block != NullBlock) {
+        release_block(qnode.block, qnode.size_class);
+    }
+
+    for (qnode_id child_ptr : qnode.children) {
+        if (child_ptr != QNullNode) release_subtree(child_ptr, removed);
+    }
+
+    release_qnode(id);
+}
+
+
+template<typename T>
+void TSpatial<T>::release_block(block_id block, int size_class) {
+    if (!concurrent_) {
+        leaves_.release(block, size_class);
+        return;
+    }
+    unlinked_.blocks.push_back({block, size_class});
+}
+
+
+// makes root the tree readers see. in concurrent mode what the insert
+// unlinked is retired under the epoch that ends here, and whatever no
+// reader can reach any more is reused
+template<typename T>
+void TSpatial<T>::publish(const qnode_id& root) {
+    // outside concurrent mode nodes are written in place, which a cursor's
+    // path survives. a node given back may come back as any other, though
+    if (reshaped_) {
+        ++version_;
+        reshaped_ = false;
+    }
+
+    std::uint64_t growths = extents_.size() - 1;
+    published_.store((static_cast<std::uint64_t>(version_) << 40) | (growths << 32) | root);
+
+    if (!concurrent_) return;
+
+    if (!unlinked_.qnodes.empty() || !unlinked_.blocks.empty()) {
+        unlinked_.epoch = advance_epoch();
+        retired_.push_back(std::move(unlinked_));
+
+        if (spare_retired_.empty()) {
+            unlinked_ = Retired{};
+        } else {
+            unlinked_ = std::move(spare_retired_.back());
+            spare_retired_.pop_back();
+        }
+    }
+    ++version_;
+
+    reclaim(safe_epoch());
+}
+
+
+template<typename T>
+void TSpatial<T>::reclaim(epoch_t safe) {
+    std::size_t n = 0;
+    for (; n < retired_.size() && retired_[n].epoch < safe; ++n) {
+        Retired& r = retired_[n];
+        free_qnodes_.insert(free_qnodes_.end(), r.qnodes.begin(), r.qnodes.end());
+        for (const RetiredBlock& b : r.blocks) {
+            leaves_.release(b.block, b.size_class);
+        }
+
+        r.qnodes.clear();
+        r.blocks.clear();
+        spare_retired_.push_back(std::move(r));
+    }
+    retired_.erase(retired_.begin(), retired_.begin() + n);
+}
+
+
+template<typename T>
+bool TSpatial<T>::visit_nearby(const Vec& centre, const T& radius, const SpatialFilter& filter, NodeVisitor visitor) const {
+    EpochGuard guard(concurrent_);
+
+    CircleQuery query(filter, centre, radius, visitor);
+
+    Snapshot tree = snapshot();
+    return in_circle_rec(tree.root, tree.bbox, query);
+}
+
+
+// strictly, so nothing in the query can sit on the cell's edge and have been
+// put in a neighbour when the points were partitioned
+template<typename T>
+static bool covers(const Box<T>& cell, const Box<T>& query) {
+    return cell.min.x < query.min.x && query.max.x < cell.max.x
+        && cell.min.y < query.min.y && query.max.y < cell.max.y;
+}
+
+
+template<typename T>
+bool TSpatial<T>::visit_nearby_from(SpatialCursor& cursor, const Vec& centre, const T& radius,
+    const SpatialFilter& filter, NodeVisitor visitor) const 
+{
+    EpochGuard guard(concurrent_);
+
+    CircleQuery query(filter, centre, radius, visitor);
+
+    // the path is only valid in the version it was recorded in
+    Snapshot tree = snapshot();
+    if (cursor.owner != this || cursor.revision != tree.revision) {
+        cursor.owner = this;
+        cursor.revision = tree.revision;
+        cursor.depth = 1;
+        cursor.path[0] = tree.root;
+        cursor.boxes[0] = tree.bbox;
+    }
+
+    // the root needs no check, starting there is the plain query
+    while (cursor.depth > 1 && !covers(cursor.boxes[cursor.depth-1], query.outer_bbox)) {
+        --cursor.depth;
+    }
+
+    while (cursor.depth < SpatialCursor::kMaxDepth) {
+        const qnode_id& head_ptr = cursor.path[cursor.depth-1];
+        const Box<T>& bbox = cursor.boxes[cursor.depth-1];
+        if (is_leaf(head_ptr)) break;
+
+        Vec mid = middle(bbox.min, bbox.max);
+        Quadrant q = static_cast<Quadrant>((centre.x >= mid.x) | ((centre.y >= mid.y) << 1));
+
+        Box<T> child_bbox = bbox.get_quadrant(q);
+        if (!covers(child_bbox, query.outer_bbox)) break;
+
+        // the query lies in a quadrant nothing was ever inserted into
+        const qnode_id& child_ptr = qnodes_[head_ptr].children[q];
+        if (child_ptr == QNullNode) return false;
+
+        cursor.path[cursor.depth] = child_ptr;
+        cursor.boxes[cursor.depth] = child_bbox;
+        ++cursor.depth;
+    }
+
+    return in_circle_rec(cursor.path[cursor.depth-1], cursor.boxes[cursor.depth-1], query);
+}
+
+
+template<typename T>
+std::size_t TSpatial<T>::visit_k_nearest(const Vec& centre, std::size_t k, const T& max_radius,
+    const SpatialFilter& filter, NodeVisitor predicate, node_id* out) const 
+{
+    if (k == 0) return 0;
+
+    std::vector<NearestCandidate>& best = nearest_best;
+    std::vector<NearestCell<T>>& cells = nearest_cells<T>;
+    best.clear();
+    cells.clear();
+
+    EpochGuard guard(concurrent_);
+
+    // anything further than this cannot make it into the result
+    double bound2 = max_radius*max_radius;
+
+    Snapshot tree = snapshot();
+    cells.push_back({tree.bbox.distance2(centre), tree.root, tree.bbox});
+
+    while (!cells.empty()) {
+        std::pop_heap(cells.begin(), cells.end());
+        NearestCell<T> cell = cells.back();
+        cells.pop_back();
+
+        if (cell.d2 > bound2) break; // every cell left is further still
+
+        const QuadNode& qnode = qnodes_[cell.id];
+
+        if (is_leaf(cell.id)) {
+            if (qnode.size == 0) continue;
+
+            const T* xs = leaves_.xs(qnode.block);
+            const T* ys = leaves_.ys(qnode.block);
+            const road_mask* roads = leaves_.roads(qnode.block);
+            const int* streamlines = leaves_.streamlines(qnode.block);
+
+            for (std::uint32_t i = 0; i < qnode.size; ++i) {
+                if (!filter.admits(roads[i], streamlines[i])) continue;
+
+                T dx = centre.x - xs[i];
+                T dy = centre.y - ys[i];
+                T d2 = dx*dx + dy*dy;
+                if (d2 > bound2) continue;
+
+                node_id id = leaves_.ids(qnode.block)[i];
+                if (predicate && !predicate(id)) continue;
+
+                offer(best, k, {d2, id});
+                if (best.size() == k) {
+                    bound2 = std::min(bound2, best.front().d2);
+                }
+            }
+            continue;
+        }
+
+        for (int q=0; q<4; ++q) {
+            qnode_id child_ptr = qnode.children[q];
+            if (child_ptr == QNullNode || !filter.admits(qnodes_[child_ptr].summary)) continue;
+
+            Box<T> child_bbox = cell.bbox.get_quadrant((Quadrant) q);
+            T d2 = child_bbox.distance2(centre);
+            if (d2 > bound2) continue;
+
+            cells.push_back({d2, child_ptr, child_bbox});
+            std::push_heap(cells.begin(), cells.end());
+        }
+    }
+
+    return write_nearest(best, out);
+}
+
+
+template class TLeafPool<float>;
+template class TLeafPool<double>;
+template class TSpatialIndex<float>;
+template class TSpatialIndex<double>;
+template class TSpatial<float>;
+template class TSpatial<double>;
@@ -1,37 +1,30 @@
 #ifndef NODE_STORAGE_H
 #define NODE_STORAGE_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
 #include <list>
+#include <optional>
+#include <span>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include "arena.h"
+#include "epoch.h"
 #include "integrator.h"
+#include "node_store.h"
+#include "stable_vector.h"
 #include "../types.h"
 #include "../const.h"
 
-enum RoadType {
-    Main,
-    HighStreet,
-    SideStreet
-};
-
-struct StreamlineNode {
-    DVector2 pos;
-    int streamline_id;
-    Direction dir;
-};
-
-
-
-
-// for clarity, type aliases for node_id (in wide node storage), 
-using node_id = std::uint32_t;
-static constexpr node_id NullNode = -1;
-
-using Streamline = std::list<node_id>;
+// node ids in order along the road. the generator keeps its own in an arena
+using Streamline = ArenaList<node_id>;
 
 class Streamlines {
     private:
@@ -49,50 +42,353 @@ class Streamlines {
 
 using qnode_id = node_id;                
 constexpr qnode_id QNullNode = node_id(-1); 
+
+// one bit per (RoadType, Direction): the Major/Minor bits of a road type,
+// shifted up by twice its value
+using road_mask = std::uint8_t;
+static constexpr road_mask AllRoads = 0x3f;
+
+inline road_mask road_bits(RoadType road, char dirs) {
+    return static_cast<road_mask>((dirs & (Major | Minor)) << 2*road);
+}
+
+inline road_mask all_roads(char dirs) {
+    return road_bits(Main, dirs) | road_bits(HighStreet, dirs) | road_bits(SideStreet, dirs);
+}
+
+// Major/Minor bits set on any road type in roads
+inline char road_dirs(road_mask roads) {
+    char dirs = 0;
+    if (roads & all_roads(Major)) dirs |= Major;
+    if (roads & all_roads(Minor)) dirs |= Minor;
+    return dirs;
+}
+
+
+// what a subtree holds, enough to skip it without looking inside
+struct NodeSummary {
+    road_mask roads = 0;
+    int min_streamline = std::numeric_limits<int>::max();
+    int max_streamline = std::numeric_limits<int>::min();
+
+    void add(road_mask entry_roads, int streamline) {
+        roads |= entry_roads;
+        min_streamline = std::min(min_streamline, streamline);
+        max_streamline = std::max(max_streamline, streamline);
+    }
+
+    void add(const NodeSummary& other) {
+        roads |= other.roads;
+        min_streamline = std::min(min_streamline, other.min_streamline);
+        max_streamline = std::max(max_streamline, other.max_streamline);
+    }
+};
+
+
+// which nodes a query considers. a plain Major/Minor mask converts to those
+// directions on every road type, with no streamline restriction.
+struct SpatialFilter {
+    road_mask roads = AllRoads;
+    int min_streamline = std::numeric_limits<int>::min(); // only streamlines in [min, max]
+    int max_streamline = std::numeric_limits<int>::max();
+    int exclude_streamline = -1;                          // and never this one
+
+    SpatialFilter() = default;
+    SpatialFilter(char dirs) : roads(all_roads(dirs)) {}
+
+    // whether anything in a subtree with this summary could pass
+    bool admits(const NodeSummary& summary) const {
+        return (summary.roads & roads)
+            && summary.max_streamline >= min_streamline
+            && summary.min_streamline <= max_streamline
+            && !(summary.min_streamline == exclude_streamline && summary.max_streamline == exclude_streamline);
+    }
+
+    bool admits(road_mask entry_roads, int streamline) const {
+        return (entry_roads & roads)
+            && streamline >= min_streamline
+            && streamline <= max_streamline
+            && streamline != exclude_streamline;
+    }
+
+    // true if only road bits are filtered, so a summary that admits is a hit
+    bool roads_only() const {
+        return min_streamline == std::numeric_limits<int>::min()
+            && max_streamline == std::numeric_limits<int>::max()
+            && exclude_streamline == -1;
+    }
+};
+
+
+// the spatial indexes are templated on the scalar type of positions and
+// radii, and instantiated for float and double. the plain names are the
+// double ones, and inside the templates they mean the same template at T
+
+
+// what gets indexed for each node, kept next to the id so leaf scans never
+// go back to the node array
+template<typename T>
+struct TLeafEntry {
+    TVector2<T> pos;
+    node_id id;
+    int streamline;
+    road_mask roads;
+};
+
+
+// a leaf's block of entries in a TLeafPool
+using block_id = std::uint32_t;
+static constexpr block_id NullBlock = -1;
+
+
+// pool that leaf entries live in, stored as structure of arrays so a leaf
+// scan is a linear pass over each field. each leaf owns one contiguous block
+// whose capacity is a power of two; released blocks are reused by size class.
+// the arrays are chunked and blocks never straddle chunks, so a block can be
+// read while others are allocated.
+template<typename T>
+class TLeafPool {
+public:
+    using LeafEntry = TLeafEntry<T>;
+
+    template<typename U>
+    using Array = StableVector<U, 14>;
+
+private:
+    static constexpr int kSizeClasses = 15; // up to one whole chunk
+
+    Array<T> xs_;
+    Array<T> ys_;
+    Array<node_id> ids_;
+    Array<int> streamlines_;
+    Array<road_mask> roads_;
+
+    void grow(std::size_t new_size);
+
+    std::array<std::vector<block_id>, kSizeClasses> free_;
+
+public:
+    // smallest k with 2^k >= n
+    static int size_class(std::uint32_t n);
+
+    block_id allocate(int size_class);
+    void release(block_id block, int size_class);
+    void clear();
+
+    void set(std::uint32_t i, const LeafEntry& entry);
+    LeafEntry get(std::uint32_t i) const;
+
+    // the fields of a block, index them from 0
+    const T* xs(block_id block) const { return &xs_[block]; }
+    const T* ys(block_id block) const { return &ys_[block]; }
+    const node_id* ids(block_id block) const { return &ids_[block]; }
+    const int* streamlines(block_id block) const { return &streamlines_[block]; }
+    const road_mask* roads(block_id block) const { return &roads_[block]; }
+};
+
                                             
+// boxes are not stored, they are derived from the parent's on the way down
 struct QuadNode {
-    Box<double> bbox;
-    std::list<node_id> data;
+    block_id block = NullBlock;   // leaf data
+    std::uint32_t size = 0;       // leaf entries in block
+    std::uint8_t size_class = 0;
+    std::uint32_t version = 0;    // the version that created it
+
+    NodeSummary summary; // roads and streamlines anywhere below
 
     qnode_id children[4] = {QNullNode, QNullNode, QNullNode, QNullNode};
+};
+
+
+// non owning reference to a callable taking a node_id. returning true from
+// it stops the query, a callable returning void never does. only valid for
+// as long as the callable it was made from.
+class NodeVisitor {
+private:
+    void* callable_ = nullptr;
+    bool (*invoke_)(void*, node_id) = nullptr;
+
+public:
+    // empty, queries stop at the first hit
+    NodeVisitor() = default;
+
+    template<typename F>
+        requires (!std::is_same_v<std::remove_cvref_t<F>, NodeVisitor>)
+    NodeVisitor(F& callable) :
+        callable_(const_cast<void*>(static_cast<const void*>(&callable))),
+        invoke_([](void* c, node_id id) {
+            if constexpr (std::is_void_v<std::invoke_result_t<F&, node_id>>) {
+                (*static_cast<F*>(c))(id);
+                return false;
+            } else {
+                return static_cast<bool>((*static_cast<F*>(c))(id));
+            }
+        })
+    {}
+
+    explicit operator bool() const { return invoke_ != nullptr; }
+
+    bool operator()(node_id id) const { return invoke_(callable_, id); }
+};
+
 
-    char dirs; // bit mask saying what direction (Major/Minor) children have
-    
-    QuadNode(Box<double> bounding_box, char directions) :
-        bbox(bounding_box),
-        dirs(directions)
+// remembers the cells the last query through it fitted inside, so the next
+// one close by can start from the lowest of them that still covers it rather
+// than from the root. only the index that last used it can make sense of it.
+template<typename T>
+struct TSpatialCursor {
+    static constexpr int kMaxDepth = 24;
+
+    const void* owner = nullptr;
+    std::uint64_t revision = 0;
+    int depth = 0; // cells in path, path[0] is the root
+    std::array<qnode_id, kMaxDepth> path;
+    std::array<Box<T>, kMaxDepth> boxes;
+};
+
+
+// what the generator needs from a spatial index over its nodes. every query
+// is a circle around a point, narrowed by a SpatialFilter. backends
+// only implement visit_nearby, the rest is built on it and never allocates
+// beyond what the caller hands in.
+template<typename T>
+class TSpatialIndex {
+public:
+    using Vec = TVector2<T>;
+    using SpatialCursor = TSpatialCursor<T>;
+    using NodeStore = TNodeStore<T>;
+
+protected:
+    const NodeStore* all_nodes_;
+
+    explicit TSpatialIndex(const NodeStore* all_nodes) :
+        all_nodes_(all_nodes)
     {}
+
+    // calls visitor on every node in the circle until it returns true, in
+    // which case this does too. an empty visitor stops at the first node.
+    virtual bool visit_nearby(const Vec& centre, const T& radius, const SpatialFilter& filter, NodeVisitor visitor) const = 0;
+
+    // visit_nearby, free to start from wherever cursor was left and to move
+    // it. the default ignores the cursor
+    virtual bool visit_nearby_from(SpatialCursor& cursor, const Vec& centre, const T& radius,
+        const SpatialFilter& filter, NodeVisitor visitor) const;
+
+    // writes the ids of up to k nodes within max_radius that predicate
+    // accepts (all of them if it is empty) to out, nearest first. returns how
+    // many were written. the default filters every node in the disk, backends
+    // that can search best-first should override it.
+    virtual std::size_t visit_k_nearest(const Vec& centre, std::size_t k, const T& max_radius,
+        const SpatialFilter& filter, NodeVisitor predicate, node_id* out) const;
+
+public:
+    virtual ~TSpatialIndex() = default;
+
+    virtual void insert_streamline(const Streamline& s) = 0;
+
+    // indexes nodes [first, last) of the store, e.g. a map being loaded. by
+    // default a run of one streamline's nodes at a time, as insert_streamline
+    // would have had them, backends that can build in bulk override it
+    virtual void insert_nodes(node_id first, node_id last);
+
+    // takes nodes back out by id, ids that were never inserted are ignored
+    virtual void remove_nodes(std::span<const node_id> ids) = 0;
+
+    // takes out every node inside region that filter admits, appending their
+    // ids to removed. returns how many there were
+    virtual std::size_t remove_region(const Box<T>& region, const SpatialFilter& filter, 
+        std::vector<node_id>& removed) = 0;
+
+    // undoes insert_streamline(s), so s as it was then, before any joins
+    void remove_streamline(const Streamline& s);
+
+    virtual void clear() = 0;
+    virtual void reset(Box<T> new_dims) = 0;
+
+    // lets queries run on any number of threads while one thread inserts,
+    // with no locking on either side. returns false if the backend cannot,
+    // in which case nothing changes. only switch while nothing is querying
+    virtual bool set_concurrent(bool concurrent) { return !concurrent; }
+
+    // visitor is called with each node_id in the circle, returns true if it
+    // stopped the query early
+    template<typename F>
+    bool visit_nearby_points(const Vec& centre, const T& radius, const SpatialFilter& filter, F&& visitor) const {
+        return visit_nearby(centre, radius, filter, NodeVisitor(visitor));
+    }
+
+    bool has_nearby_point(const Vec& centre, const T& radius, const SpatialFilter& filter) const;
+
+    // for runs of queries that each move a little, like the front of a
+    // streamline being traced. the cursor starts empty and stays with the run
+    bool has_nearby_point(const Vec& centre, const T& radius, const SpatialFilter& filter, SpatialCursor& cursor) const;
+
+    // has_nearby_point for every centre, out[i] answering centres[i]. they
+    // are queried in morton order through one cursor, so neighbours share
+    // most of their descent
+    void has_nearby_points(std::span<const Vec> centres, const T& radius, const SpatialFilter& filter, 
+        std::vector<bool>& out) const;
+
+    // overwrites out, reusing its capacity. returns the number of nodes found
+    std::size_t nearby_points(const Vec& centre, const T& radius, const SpatialFilter& filter, std::vector<node_id>& out) const;
+    std::list<node_id> nearby_points(const Vec& centre, const T& radius, const SpatialFilter& filter) const;
+
+    // nearest node within max_radius for which predicate(node_id) is true
+    template<typename F>
+    std::optional<node_id> nearest_point(const Vec& centre, const T& max_radius, const SpatialFilter& filter, F&& predicate) const {
+        node_id out;
+        if (!visit_k_nearest(centre, 1, max_radius, filter, NodeVisitor(predicate), &out)) return {};
+        return out;
+    }
+
+    std::optional<node_id> nearest_point(const Vec& centre, const T& max_radius, const SpatialFilter& filter) const;
+
+    // overwrites out with the k nearest accepted nodes within max_radius,
+    // nearest first. returns the number found
+    template<typename F>
+    std::size_t k_nearest_points(const Vec& centre, std::size_t k, const T& max_radius, const SpatialFilter& filter,
+        F&& predicate, std::vector<node_id>& out) const 
+    {
+        out.resize(k);
+        out.resize(visit_k_nearest(centre, k, max_radius, filter, NodeVisitor(predicate), out.data()));
+        return out.size();
+    }
 };
 
 
-class Spatial {
+template<typename T>
+class TSpatial : public TSpatialIndex<T> {
+public:
+    using typename TSpatialIndex<T>::Vec;
+    using typename TSpatialIndex<T>::SpatialCursor;
+    using typename TSpatialIndex<T>::NodeStore;
+    using LeafEntry = TLeafEntry<T>;
+    using LeafPool = TLeafPool<T>;
+
 private:
 #ifdef SPATIAL_TEST
 public:
 #endif
-    using iter = std::list<node_id>::iterator;
-
     struct BBoxQuery {
-        const char& dirs;
-        const bool& gather;
-        Box<double> inner_bbox;
-        std::list<node_id> harvest;
+        SpatialFilter filter;
+        NodeVisitor visitor; // empty if only asking whether anything is there
+        Box<T> inner_bbox;
     };
 
     struct CircleQuery : BBoxQuery {
-        const DVector2& centre;
-        const double& radius;
-        double radius2;
-        Box<double> outer_bbox;
-        CircleQuery(const char& dirs, const DVector2& centre, const double& radius, const bool& gather) : 
-            BBoxQuery({dirs, gather}),
+        const Vec& centre;
+        const T& radius;
+        T radius2;
+        Box<T> outer_bbox;
+        CircleQuery(const SpatialFilter& filter, const Vec& centre, const T& radius, NodeVisitor visitor) : 
+            BBoxQuery({filter, visitor}),
             centre(centre),
             radius(radius) 
         {
             radius2 = radius*radius;
 
-            DVector2 circumscribed_diag = {radius, radius};
-            DVector2 inscribed_diag = circumscribed_diag/M_SQRT2;
+            Vec circumscribed_diag = {radius, radius};
+            Vec inscribed_diag = circumscribed_diag/M_SQRT2;
 
             outer_bbox = Box (
                 centre - circumscribed_diag,
@@ -100,67 +396,188 @@ public:
             );
 
 
-            inner_bbox = Box(
+            this->inner_bbox = Box(
                 centre - inscribed_diag,
                 centre + inscribed_diag 
             );
         }
     };
 
-    const std::vector<StreamlineNode>* all_nodes_;
+    struct RetiredBlock {
+        block_id block;
+        int size_class;
+    };
+
+    // what one published insert unlinked, reusable once readers are past it
+    struct Retired {
+        epoch_t epoch;
+        std::vector<qnode_id> qnodes;
+        std::vector<RetiredBlock> blocks;
+    };
+
+    // what readers see, swapped in whole. root in the low 32 bits, then
+    // the growth count indexing extents_, then the low 24 bits of version_
+    std::atomic<std::uint64_t> published_ = 0;
+
+    // a snapshot of the tree, root and box read from one published_ load
+    struct Snapshot {
+        qnode_id root;
+        const Box<T>& bbox;
+        std::uint64_t revision;
+    };
+
+    Box<T> dimensions_; // the box the root starts as, after clear()
+    Box<T> bounds_;     // the root box inserts are working on
+
+    // the root box after each growth, so readers of an older root still
+    // find its box. StableVector, so growing never moves one being read
+    static constexpr int kMaxGrowths = 255;
+    StableVector<Box<T>, 4, 16> extents_;
+
+    // in concurrent mode published nodes are read only, inserts copy the
+    // path they touch into nodes stamped with version_ and then publish it
+    bool concurrent_ = false;
+    std::uint32_t version_ = 0;
+    bool reshaped_ = false; // a qnode was freed since the last publish
+
+    StableVector<QuadNode> qnodes_;
+    std::vector<qnode_id> free_qnodes_;
 
-    Box<double> dimensions_;
+    LeafPool leaves_;
 
-    qnode_id root_;
-    std::vector<QuadNode> qnodes_;
+    Retired unlinked_;                   // by the insert in progress
+    std::vector<Retired> retired_;       // oldest first, rarely more than a few
+    std::vector<Retired> spare_retired_; // reclaimed, kept for their capacity
 
-    int max_depth_;
+    // staging for insertion and removal, partitioned in place on the way down
+    std::vector<LeafEntry> insert_scratch_;
+    std::vector<LeafEntry> subdivide_scratch_;
+
+    double min_cell_size_; // leaves stop splitting once this small
+    int max_depth_;        // of the root box at min_cell_size_, +1 per growth
     int leaf_capacity_;
 
-    const DVector2& node_to_pos(const node_id& id) const;
-    char node_to_dir(const node_id& id) const;
+    LeafEntry node_to_entry(const node_id& id) const;
+    Snapshot snapshot() const;
 
-    std::array<std::pair<char, std::list<node_id>>, 4> 
-        partition(const Box<double>& bbox, std::list<node_id>& s);
+    // doubles the root away from its far corner until it takes in bounds.
+    // entries that would now partition to the other side of the old root's
+    // edge are taken out and appended to insert_scratch_ to go back in
+    qnode_id grow(qnode_id head_ptr, const Box<T>& bounds);
 
-    bool is_leaf(const qnode_id& id) const;
+    qnode_id new_qnode();
+    qnode_id writable(const qnode_id& id);
+    void release_qnode(const qnode_id& id);
+    void release_block(block_id block, int size_class);
+
+    // frees everything under id, id included, appending the ids of its
+    // entries to removed
+    void release_subtree(const qnode_id& id, std::vector<node_id>& removed);
 
-    // moves leaf data into subquadrant
-    // void promote_leaf_data(qnode_id head_ptr);
+    void publish(const qnode_id& root);
+    void reclaim(epoch_t safe);
+
+    // 4 way partition of [begin, end) into [TopLeft, TopRight, BottomLeft, BottomRight),
+    // returns the 5 range boundaries
+    std::array<LeafEntry*, 5> partition(const Box<T>& bbox, LeafEntry* begin, LeafEntry* end) const;
+    static NodeSummary range_summary(const LeafEntry* begin, const LeafEntry* end);
+
+    bool is_leaf(const qnode_id& id) const;
 
-    void subdivide(const qnode_id& head_ptr);
+    void subdivide(const qnode_id& head_ptr, const Box<T>& bbox);
 
-    // add leaf data onto existing node, updating bitmask
-    void append_leaf_data(const qnode_id& leaf_ptr, const char& dirs, std::list<node_id>& data);
+    // add leaf data onto existing node, updating its summary
+    void append_leaf_data(const qnode_id& leaf_ptr, const NodeSummary& summary, const LeafEntry* begin, const LeafEntry* end);
 
-    void insert_rec(
+    // returns the node now heading the subtree, a copy in concurrent mode
+    qnode_id insert_rec(
         int depth, 
-        const qnode_id& head_ptr,
-        const char& dirs,
-        std::list<node_id>& list
+        qnode_id head_ptr,
+        const Box<T>& bbox,
+        const NodeSummary& summary,
+        LeafEntry* begin,
+        LeafEntry* end
+    );
+
+    // drops the leaf entries remove(i) is true for and recomputes its summary
+    template<typename F>
+    void remove_from_leaf(const qnode_id& leaf_ptr, F&& remove);
+
+    // recomputes an inner node's summary from its children, and takes their
+    // entries back up if between them they fit in half a leaf
+    void merge_children(const qnode_id& head_ptr);
+
+    // like insert_rec, but QNullNode once nothing is left under the head
+    qnode_id remove_rec(
+        qnode_id head_ptr,
+        const Box<T>& bbox,
+        LeafEntry* begin,
+        LeafEntry* end
+    );
+
+    qnode_id remove_region_rec(
+        qnode_id head_ptr,
+        const Box<T>& bbox,
+        const Box<T>& region,
+        const SpatialFilter& filter,
+        std::vector<node_id>& removed
     );
 
     bool in_circle_rec(
         const qnode_id& head_ptr,
+        const Box<T>& bbox,
         CircleQuery& query
     ) const;
 
     bool in_bbox_rec(
+        const qnode_id& head_ptr,
+        const Box<T>& bbox,
+        BBoxQuery& query
+    ) const;
+
+    bool visit_rec(
         const qnode_id& head_ptr,
         BBoxQuery& query
     ) const;
 
 public:
-    Spatial(const std::vector<StreamlineNode>* all_nodes, Box<double> dims, int depth, int leaf_capacity);
+    // dims is only where the root starts, it grows to take in whatever is
+    // inserted outside it. leaves stop splitting at min_cell_size across
+    TSpatial(const NodeStore* all_nodes, Box<T> dims, double min_cell_size, int leaf_capacity);
 
-    void insert_streamline(Streamline s, const char& dirs);
+    void insert_streamline(const Streamline& s) override;
 
-    void clear();
-    void reset(Box<double> new_dims);
-    
-    bool has_nearby_point(const DVector2& centre, const double& radius, const char& dirs) const;
-    std::list<node_id> nearby_points(const DVector2& centre, const double& radius, const char& dirs) const;
+    void remove_nodes(std::span<const node_id> ids) override;
+    std::size_t remove_region(const Box<T>& region, const SpatialFilter& filter, 
+        std::vector<node_id>& removed) override;
+
+    void clear() override;
+    void reset(Box<T> new_dims) override;
+
+    bool set_concurrent(bool concurrent) override;
+
+    qnode_id root() const;
+    const Box<T>& dimensions() const;
+
+protected:
+    bool visit_nearby(const Vec& centre, const T& radius, const SpatialFilter& filter, NodeVisitor visitor) const override;
+
+    // resumes from the lowest cell on the cursor's path whose box still
+    // strictly contains the query's outer box, then walks down while a
+    // single child does
+    bool visit_nearby_from(SpatialCursor& cursor, const Vec& centre, const T& radius,
+        const SpatialFilter& filter, NodeVisitor visitor) const override;
+
+    // best-first over cells ordered by distance to their box, stopping once
+    // the next cell is further than the k-th best node so far
+    std::size_t visit_k_nearest(const Vec& centre, std::size_t k, const T& max_radius,
+        const SpatialFilter& filter, NodeVisitor predicate, node_id* out) const override;
 };
 
+using LeafEntry = TLeafEntry<double>;
+using LeafPool = TLeafPool<double>;
+using SpatialCursor = TSpatialCursor<double>;
+using SpatialIndex = TSpatialIndex<double>;
+using Spatial = TSpatial<double>;
 
 #endif
@@ -0,0 +1,192 @@
+#ifndef NODE_STORE_H
+#define NODE_STORE_H
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include "integrator.h"
+#include "stable_vector.h"
+#include "../types.h"
+#include "../const.h"
+
+enum RoadType {
+    Main,
+    HighStreet,
+    SideStreet
+};
+
+// one node, as handed to and read back whole from a NodeStore
+struct StreamlineNode {
+    DVector2 pos;
+    int streamline_id; // unique across road types and directions
+    Direction dir;
+    RoadType road;
+};
+
+// for clarity, type aliases for node_id (in wide node storage),
+using node_id = std::uint32_t;
+static constexpr node_id NullNode = -1;
+
+
+// how a NodeStore keeps positions. doubles are exact, the other two take
+// half the space by storing the offset from the store's origin, which keeps
+// them precise across a map wherever it sits in the world. all of them
+// decode to double, the store narrows that to its scalar type. kFormat
+// tells them apart in snapshot files, so it never changes
+
+struct DoublePositions {
+    using coord = double;
+    static constexpr std::uint32_t kFormat = 0;
+    static coord encode(double v, double) { return v; }
+    static double decode(coord c, double) { return c; }
+};
+
+struct FloatPositions {
+    using coord = float;
+    static constexpr std::uint32_t kFormat = 1;
+    static coord encode(double v, double origin) { return static_cast<float>(v - origin); }
+    static double decode(coord c, double origin) { return origin + c; }
+};
+
+// fixed point, kStep apart, so good to 8M units either side of the origin
+struct QuantisedPositions {
+    using coord = std::int32_t;
+    static constexpr std::uint32_t kFormat = 2;
+    static constexpr double kStep = 1.0/256;
+
+    static coord encode(double v, double origin) {
+        double q = std::round((v - origin)/kStep);
+        assert(std::abs(q) <= std::numeric_limits<coord>::max());
+        return static_cast<coord>(q);
+    }
+    static double decode(coord c, double origin) { return origin + c*kStep; }
+};
+
+
+// the position format is picked at build time, see const.h. a float
+// pipeline has no use for more than floats whatever is picked
+#if defined(NODE_POSITIONS_QUANTISED)
+template<typename T>
+using NodePositions = QuantisedPositions;
+#elif defined(NODE_POSITIONS_FLOAT)
+template<typename T>
+using NodePositions = FloatPositions;
+#else
+template<typename T>
+using NodePositions = std::conditional_t<std::is_same_v<T, float>, FloatPositions, DoublePositions>;
+#endif
+
+
+// the generator's nodes as structure of arrays, a node's fields at the same
+// index in each. queries mostly want positions alone, so those are packed
+// together, and a node costs 22 bytes with doubles, 14 with the others,
+// against 32 for a StreamlineNode. nodes never move once added, so they can
+// be read while more are appended.
+template<typename T>
+class TNodeStore {
+public:
+    using Positions = NodePositions<T>;
+    using coord = typename Positions::coord;
+
+private:
+    static constexpr int kChunkBits = 16;
+    static constexpr std::size_t kMaxChunks = 4096; // 268M nodes
+
+    template<typename U>
+    using Array = StableVector<U, kChunkBits, kMaxChunks>;
+
+    DVector2 origin_;
+
+    Array<coord> xs_;
+    Array<coord> ys_;
+    Array<int> streamlines_;
+    Array<Direction> dirs_;
+    Array<std::uint8_t> roads_;
+
+    std::atomic<std::size_t> size_ = 0; // stored once all the fields are
+
+public:
+    static constexpr std::size_t kBytesPerNode =
+        2*sizeof(coord) + sizeof(int) + sizeof(Direction) + sizeof(std::uint8_t);
+
+    TNodeStore() = default;
+    TNodeStore(const TNodeStore&) = delete;
+    TNodeStore& operator=(const TNodeStore&) = delete;
+
+    TVector2<T> pos(node_id id) const {
+        return {
+            static_cast<T>(Positions::decode(xs_[id], origin_.x)),
+            static_cast<T>(Positions::decode(ys_[id], origin_.y))
+        };
+    }
+
+    int streamline(node_id id) const { return streamlines_[id]; }
+    Direction dir(node_id id) const { return dirs_[id]; }
+    RoadType road(node_id id) const { return static_cast<RoadType>(roads_[id]); }
+
+    // every field, for when a node is wanted whole
+    StreamlineNode operator[](node_id id) const {
+        return {DVector2(pos(id)), streamline(id), dir(id), road(id)};
+    }
+
+    std::size_t size() const {
+        return size_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const DVector2& origin() const {
+        return origin_;
+    }
+
+    void push_back(const StreamlineNode& node) {
+        xs_.push_back(Positions::encode(node.pos.x, origin_.x));
+        ys_.push_back(Positions::encode(node.pos.y, origin_.y));
+        streamlines_.push_back(node.streamline_id);
+        dirs_.push_back(node.dir);
+        roads_.push_back(static_cast<std::uint8_t>(node.road));
+        size_.store(size_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // a position as it is kept, for copying a store exactly
+    coord stored_x(node_id id) const { return xs_[id]; }
+    coord stored_y(node_id id) const { return ys_[id]; }
+
+    void push_back_stored(coord x, coord y, int streamline, Direction dir, RoadType road) {
+        xs_.push_back(x);
+        ys_.push_back(y);
+        streamlines_.push_back(streamline);
+        dirs_.push_back(dir);
+        roads_.push_back(static_cast<std::uint8_t>(road));
+        size_.store(size_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // keeps the chunks for reuse, so nothing may be reading it
+    void clear() {
+        size_.store(0, std::memory_order_release);
+        xs_.clear();
+        ys_.clear();
+        streamlines_.clear();
+        dirs_.clear();
+        roads_.clear();
+    }
+
+    // clear, with positions measured from a new origin after
+    void reset(const DVector2& origin) {
+        clear();
+        origin_ = origin;
+    }
+};
+
+
+using NodeStore = TNodeStore<double>;
+
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// smallest amount of work worth a thread of its own
+static constexpr std::size_t kParallelGrain = 1 << 15;
+
+
+// how many chunks to split n items into, at most one per hardware thread
+inline int chunk_count(std::size_t n, std::size_t grain = kParallelGrain) {
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    return static_cast<int>(std::clamp<std::size_t>(n/grain, 1, threads));
+}
+
+
+// [begin, end) of the given chunk, chunks are contiguous and in order
+inline std::pair<std::size_t, std::size_t> chunk_range(std::size_t n, int chunks, int chunk) {
+    return {n*chunk/chunks, n*(chunk+1)/chunks};
+}
+
+
+// calls fn(chunk, begin, end) for every chunk of [0, n), the first on the
+// calling thread. returns once all chunks are done.
+template<typename F>
+void parallel_for(std::size_t n, int chunks, F&& fn) {
+    std::vector<std::thread> threads;
+    threads.reserve(chunks - 1);
+
+    for (int c = 1; c < chunks; ++c) {
+        auto [begin, end] = chunk_range(n, chunks, c);
+        threads.emplace_back([&fn, c, begin, end]() { fn(c, begin, end); });
+    }
+
+    auto [begin, end] = chunk_range(n, chunks, 0);
+    fn(0, begin, end);
+
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+#endif
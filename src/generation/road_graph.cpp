@@ -0,0 +1,597 @@
+#include "road_graph.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iterator>
+#include <optional>
+
+#include "parallel.h"
+
+
+namespace {
+
+using vertex_id = RoadGraph::vertex_id;
+
+constexpr vertex_id NullVertex = RoadGraph::NullVertex;
+
+// crossings this close to the end of a segment are at its end vertex
+constexpr double kEndSnap = 1e-9;
+
+// grid cells per thread when testing them for crossings
+constexpr std::size_t kCellGrain = 1 << 12;
+
+
+struct Segment {
+    vertex_id a;
+    vertex_id b;
+    RoadType road;
+};
+
+struct CellEntry {
+    std::uint64_t cell;
+    std::uint32_t segment;
+
+    bool operator<(const CellEntry& other) const {
+        return cell < other.cell || (cell == other.cell && segment < other.segment);
+    }
+};
+
+// where two segments cross, as the fraction along each
+struct Crossing {
+    std::uint32_t segments[2];
+    double t[2];
+    DVector2 pos;
+};
+
+// a vertex some way along a segment that it has to be split at
+struct Split {
+    std::uint32_t segment;
+    double t;
+    vertex_id v;
+
+    bool operator<(const Split& other) const {
+        return segment < other.segment || (segment == other.segment && t < other.t);
+    }
+};
+
+struct HalfEdge {
+    vertex_id from;
+    vertex_id to;
+    double length;
+    RoadType road;
+};
+
+// an edge of the graph being cleaned, both ends keep its index
+struct CleanEdge {
+    vertex_id a;
+    vertex_id b;
+    double length;
+    RoadType road;
+    bool alive;
+
+    vertex_id other(vertex_id v) const { return v == a ? b : a; }
+};
+
+
+// union-find any number of threads can unite in at once. roots are always
+// linked under the smaller id, so every set ends up rooted at its smallest
+// member whatever order the unions ran in
+class DisjointSets {
+private:
+    std::vector<std::atomic<vertex_id>> parent_;
+
+public:
+    explicit DisjointSets(std::size_t n) : parent_(n) {
+        for (std::size_t v = 0; v < n; ++v) {
+            parent_[v].store(v, std::memory_order_relaxed);
+        }
+    }
+
+    // halves the path on the way up
+    vertex_id find(vertex_id v) {
+        while (true) {
+            vertex_id p = parent_[v].load();
+            if (p == v) return v;
+
+            vertex_id grandparent = parent_[p].load();
+            if (grandparent != p) {
+                parent_[v].compare_exchange_weak(p, grandparent);
+            }
+            v = grandparent;
+        }
+    }
+
+    void unite(vertex_id a, vertex_id b) {
+        while (true) {
+            a = find(a);
+            b = find(b);
+            if (a == b) return;
+            if (b < a) std::swap(a, b);
+
+            // only links if b is still a root, otherwise go again
+            vertex_id expected = b;
+            if (parent_[b].compare_exchange_strong(expected, a)) return;
+        }
+    }
+};
+
+}
+
+
+//  SECTION: crossings
+
+
+static std::uint64_t cell_key(std::int64_t cx, std::int64_t cy) {
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(cx)) << 32)
+        | static_cast<std::uint32_t>(cy);
+}
+
+
+// the fractions along p0p1 and q0q1 where they cross, parallel segments
+// never do. pos is kept inside both bounding boxes, so it always falls in
+// a grid cell both segments were put in
+static std::optional<Crossing> intersect(const DVector2& p0, const DVector2& p1,
+    const DVector2& q0, const DVector2& q1)
+{
+    DVector2 r = p1 - p0;
+    DVector2 s = q1 - q0;
+
+    double denom = cross_product(r, s);
+    if (denom == 0.0) return {};
+
+    DVector2 pq = q0 - p0;
+    double t = cross_product(pq, s)/denom;
+    double u = cross_product(pq, r)/denom;
+    if (t < 0.0 || t > 1.0 || u < 0.0 || u > 1.0) return {};
+
+    DVector2 pos = p0 + r*t;
+    pos.x = std::clamp(pos.x,
+        std::max(std::min(p0.x, p1.x), std::min(q0.x, q1.x)),
+        std::min(std::max(p0.x, p1.x), std::max(q0.x, q1.x)));
+    pos.y = std::clamp(pos.y,
+        std::max(std::min(p0.y, p1.y), std::min(q0.y, q1.y)),
+        std::min(std::max(p0.y, p1.y), std::max(q0.y, q1.y)));
+
+    return Crossing{{}, {t, u}, pos};
+}
+
+
+static vertex_id end_vertex(const Segment& s, double t) {
+    if (t <= kEndSnap) return s.a;
+    if (t >= 1.0 - kEndSnap) return s.b;
+    return NullVertex;
+}
+
+
+//  SECTION: RoadGraph
+
+
+// by source, then target, then the more important road first
+static void sort_half_edges(std::vector<HalfEdge>& half_edges) {
+    std::sort(half_edges.begin(), half_edges.end(), [](const HalfEdge& a, const HalfEdge& b) {
+        if (a.from != b.from) return a.from < b.from;
+        if (a.to != b.to) return a.to < b.to;
+        if (a.road != b.road) return a.road < b.road;
+        return a.length < b.length;
+    });
+}
+
+
+// half_edges sorted, graph.vertices already filled in
+static void fill_csr(RoadGraph& graph, const std::vector<HalfEdge>& half_edges) {
+    graph.offsets.assign(graph.vertices.size() + 1, 0);
+    graph.targets.reserve(half_edges.size());
+    graph.lengths.reserve(half_edges.size());
+    graph.roads.reserve(half_edges.size());
+
+    for (const HalfEdge& e : half_edges) {
+        ++graph.offsets[e.from + 1];
+        graph.targets.push_back(e.to);
+        graph.lengths.push_back(e.length);
+        graph.roads.push_back(e.road);
+    }
+
+    for (std::size_t v = 0; v < graph.vertices.size(); ++v) {
+        graph.offsets[v+1] += graph.offsets[v];
+    }
+}
+
+
+template<typename T>
+RoadGraph build_road_graph(const TNodeStore<T>& nodes, std::span<const Streamline* const> streamlines) {
+    RoadGraph graph;
+
+    graph.vertices.reserve(nodes.size());
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+        graph.vertices.push_back(DVector2(nodes.pos(i)));
+    }
+    graph.first_junction = graph.vertices.size();
+
+    std::vector<Segment> segments;
+    double total_length = 0.0;
+
+    for (const Streamline* s : streamlines) {
+        if (s->size() < 2) continue;
+
+        // either end may be a join onto another road, the rest is its own
+        RoadType road = nodes.road(*std::next(s->begin()));
+
+        for (auto a = s->begin(), b = std::next(a); b != s->end(); ++a, ++b) {
+            DVector2 d = graph.vertices[*b] - graph.vertices[*a];
+            double length = std::sqrt(dot_product(d, d));
+            if (length == 0.0) continue;
+
+            segments.push_back({*a, *b, road});
+            total_length += length;
+        }
+    }
+
+    std::vector<Split> splits;
+
+    if (!segments.empty()) {
+        // twice the average segment, so most segments are in one to four cells
+        double inv_cell_size = segments.size()/(2.0*total_length);
+
+        auto cell_of = [inv_cell_size](const DVector2& pos) {
+            return cell_key(std::floor(pos.x*inv_cell_size), std::floor(pos.y*inv_cell_size));
+        };
+
+        std::vector<CellEntry> entries;
+        entries.reserve(2*segments.size());
+
+        for (std::uint32_t i = 0; i < segments.size(); ++i) {
+            const DVector2& a = graph.vertices[segments[i].a];
+            const DVector2& b = graph.vertices[segments[i].b];
+
+            std::int64_t x0 = std::floor(std::min(a.x, b.x)*inv_cell_size);
+            std::int64_t x1 = std::floor(std::max(a.x, b.x)*inv_cell_size);
+            std::int64_t y0 = std::floor(std::min(a.y, b.y)*inv_cell_size);
+            std::int64_t y1 = std::floor(std::max(a.y, b.y)*inv_cell_size);
+
+            for (std::int64_t cy = y0; cy <= y1; ++cy) {
+                for (std::int64_t cx = x0; cx <= x1; ++cx) {
+                    entries.push_back({cell_key(cx, cy), i});
+                }
+            }
+        }
+
+        std::sort(entries.begin(), entries.end());
+
+        // where each cell's run of entries starts, and one past the last
+        std::vector<std::uint32_t> runs;
+        for (std::uint32_t i = 0; i < entries.size(); ++i) {
+            if (i == 0 || entries[i].cell != entries[i-1].cell) runs.push_back(i);
+        }
+        runs.push_back(entries.size());
+
+        std::size_t cells = runs.size() - 1;
+        int chunks = chunk_count(cells, kCellGrain);
+
+        // chunks are in cell order, so the crossings come out the same
+        // however many threads found them
+        std::vector<std::vector<Crossing>> found(chunks);
+
+        parallel_for(cells, chunks, [&](int chunk, std::size_t begin, std::size_t end) {
+            for (std::size_t c = begin; c < end; ++c) {
+                for (std::uint32_t i = runs[c]; i < runs[c+1]; ++i) {
+                    const Segment& s0 = segments[entries[i].segment];
+
+                    for (std::uint32_t j = i+1; j < runs[c+1]; ++j) {
+                        const Segment& s1 = segments[entries[j].segment];
+
+                        // consecutive on a streamline, or joined at a node
+                        if (s0.a == s1.a || s0.a == s1.b || s0.b == s1.a || s0.b == s1.b) continue;
+
+                        std::optional<Crossing> crossing = intersect(
+                            graph.vertices[s0.a], graph.vertices[s0.b],
+                            graph.vertices[s1.a], graph.vertices[s1.b]
+                        );
+                        if (!crossing) continue;
+
+                        // every cell the two share finds it, only the one it is in keeps it
+                        if (cell_of(crossing->pos) != entries[i].cell) continue;
+
+                        crossing->segments[0] = entries[i].segment;
+                        crossing->segments[1] = entries[j].segment;
+                        found[chunk].push_back(*crossing);
+                    }
+                }
+            }
+        });
+
+        // a crossing at the end of either segment is at that end's vertex,
+        // anywhere else it is a new junction
+        for (const std::vector<Crossing>& chunk : found) {
+            for (const Crossing& crossing : chunk) {
+                const Segment& s0 = segments[crossing.segments[0]];
+                const Segment& s1 = segments[crossing.segments[1]];
+
+                vertex_id v = end_vertex(s0, crossing.t[0]);
+                if (v == NullVertex) v = end_vertex(s1, crossing.t[1]);
+                if (v == NullVertex) {
+                    v = graph.vertices.size();
+                    graph.vertices.push_back(crossing.pos);
+                }
+
+                for (int k = 0; k < 2; ++k) {
+                    const Segment& s = segments[crossing.segments[k]];
+                    if (v != s.a && v != s.b) splits.push_back({crossing.segments[k], crossing.t[k], v});
+                }
+            }
+        }
+
+        std::sort(splits.begin(), splits.end());
+    }
+
+    // every segment becomes the pieces between its splits
+    std::vector<HalfEdge> half_edges;
+    half_edges.reserve(2*(segments.size() + splits.size()));
+
+    auto add_edge = [&](vertex_id from, vertex_id to, RoadType road) {
+        if (from == to) return;
+
+        DVector2 d = graph.vertices[to] - graph.vertices[from];
+        double length = std::sqrt(dot_product(d, d));
+
+        half_edges.push_back({from, to, length, road});
+        half_edges.push_back({to, from, length, road});
+    };
+
+    std::size_t k = 0;
+    for (std::uint32_t i = 0; i < segments.size(); ++i) {
+        vertex_id from = segments[i].a;
+        for (; k < splits.size() && splits[k].segment == i; ++k) {
+            add_edge(from, splits[k].v, segments[i].road);
+            from = splits[k].v;
+        }
+        add_edge(from, segments[i].b, segments[i].road);
+    }
+
+    // an edge on two streamlines is kept once, as the more important road
+    sort_half_edges(half_edges);
+    half_edges.erase(std::unique(half_edges.begin(), half_edges.end(), [](const HalfEdge& a, const HalfEdge& b) {
+        return a.from == b.from && a.to == b.to;
+    }), half_edges.end());
+
+    fill_csr(graph, half_edges);
+    return graph;
+}
+
+template RoadGraph build_road_graph(const TNodeStore<float>&, std::span<const Streamline* const>);
+template RoadGraph build_road_graph(const TNodeStore<double>&, std::span<const Streamline* const>);
+
+
+//  SECTION: cleanup
+
+
+// every vertex is united with those within radius in its own and the 8
+// neighbouring cells of a hash grid with cells of radius
+static void merge_close_vertices(const RoadGraph& graph, double radius, DisjointSets& sets) {
+    std::size_t n = graph.vertex_count();
+    double inv_cell_size = 1.0/radius;
+    double radius2 = radius*radius;
+
+    auto cell_x = [inv_cell_size](const DVector2& pos) { return std::int64_t(std::floor(pos.x*inv_cell_size)); };
+    auto cell_y = [inv_cell_size](const DVector2& pos) { return std::int64_t(std::floor(pos.y*inv_cell_size)); };
+
+    std::vector<CellEntry> entries(n);
+    for (vertex_id v = 0; v < n; ++v) {
+        const DVector2& pos = graph.vertices[v];
+        entries[v] = {cell_key(cell_x(pos), cell_y(pos)), v};
+    }
+    std::sort(entries.begin(), entries.end());
+
+    parallel_for(n, chunk_count(n), [&](int, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            vertex_id v = entries[i].segment;
+            const DVector2& pos = graph.vertices[v];
+            std::int64_t cx = cell_x(pos);
+            std::int64_t cy = cell_y(pos);
+
+            for (std::int64_t y = cy - 1; y <= cy + 1; ++y) {
+                for (std::int64_t x = cx - 1; x <= cx + 1; ++x) {
+                    auto it = std::lower_bound(entries.begin(), entries.end(), CellEntry{cell_key(x, y), 0});
+
+                    // each pair once, from its smaller vertex
+                    for (; it != entries.end() && it->cell == cell_key(x, y); ++it) {
+                        vertex_id w = it->segment;
+                        if (w <= v) continue;
+
+                        DVector2 diff = graph.vertices[w] - pos;
+                        if (dot_product(diff, diff) <= radius2) sets.unite(v, w);
+                    }
+                }
+            }
+        }
+    });
+}
+
+
+// cuts dead ends shorter than min_length off where they meet a junction.
+// degree is as it was before any cut, so what a cut leaves behind is never
+// mistaken for a road running on
+static void cut_stubs(std::vector<CleanEdge>& edges, const std::vector<std::vector<std::uint32_t>>& incident,
+    const std::vector<std::uint32_t>& degree, double min_length)
+{
+    auto next_edge = [&](vertex_id v, std::uint32_t from) {
+        for (std::uint32_t e : incident[v]) {
+            if (e != from) return e;
+        }
+        return from;
+    };
+
+    std::vector<std::uint32_t> path;
+    for (vertex_id v = 0; v < incident.size(); ++v) {
+        if (degree[v] != 1) continue;
+
+        path.clear();
+        double length = 0.0;
+        vertex_id at = v;
+        std::uint32_t e = incident[v][0];
+
+        // along the road until it reaches a junction or another end
+        while (true) {
+            path.push_back(e);
+            length += edges[e].length;
+            at = edges[e].other(at);
+
+            if (degree[at] != 2 || length >= min_length) break;
+            e = next_edge(at, e);
+        }
+
+        if (degree[at] < 3 || length >= min_length) continue;
+
+        for (std::uint32_t dead : path) {
+            edges[dead].alive = false;
+        }
+    }
+}
+
+
+// replaces every run of edges of one road through vertices with nothing
+// else on them by a single edge as long as the run. loops without any such
+// end are left as they are
+static void collapse_chains(std::vector<CleanEdge>& edges, std::vector<std::vector<std::uint32_t>>& incident) {
+    std::vector<std::uint32_t> alive;
+    auto find_alive = [&](vertex_id v) {
+        alive.clear();
+        for (std::uint32_t e : incident[v]) {
+            if (edges[e].alive) alive.push_back(e);
+        }
+    };
+
+    // where a run has to stop, leaves alive holding v's edges
+    auto is_end = [&](vertex_id v) {
+        find_alive(v);
+        return alive.size() != 2 || edges[alive[0]].road != edges[alive[1]].road;
+    };
+
+    std::vector<bool> walked(edges.size(), false);
+    std::vector<std::uint32_t> starts;
+    std::vector<std::uint32_t> path;
+
+    for (vertex_id v = 0; v < incident.size(); ++v) {
+        if (!is_end(v)) continue;
+        starts = alive;
+
+        for (std::uint32_t first : starts) {
+            if (walked[first]) continue;
+
+            path.clear();
+            double length = 0.0;
+            vertex_id at = v;
+            std::uint32_t e = first;
+
+            while (true) {
+                walked[e] = true;
+                path.push_back(e);
+                length += edges[e].length;
+                at = edges[e].other(at);
+
+                if (at == v || is_end(at)) break;
+                e = alive[0] == e ? alive[1] : alive[0];
+            }
+
+            if (path.size() < 2 || at == v) continue;
+
+            for (std::uint32_t dead : path) {
+                edges[dead].alive = false;
+            }
+            incident[v].push_back(edges.size());
+            incident[at].push_back(edges.size());
+            edges.push_back({v, at, length, edges[first].road, true});
+            walked.push_back(true);
+        }
+    }
+}
+
+
+RoadGraph clean_road_graph(const RoadGraph& graph, const GraphCleanup& cleanup,
+    std::vector<vertex_id>& remap)
+{
+    std::size_t n = graph.vertex_count();
+
+    DisjointSets sets(n);
+    if (cleanup.merge_radius > 0.0) {
+        merge_close_vertices(graph, cleanup.merge_radius, sets);
+    }
+
+    // a set takes its smallest vertex's place, and the edges between two
+    // sets are one, the more important road first
+    std::vector<HalfEdge> merged;
+    for (vertex_id v = 0; v < n; ++v) {
+        vertex_id rv = sets.find(v);
+
+        for (std::uint32_t i = graph.offsets[v]; i < graph.offsets[v+1]; ++i) {
+            vertex_id rw = sets.find(graph.targets[i]);
+            if (rv >= rw) continue;
+
+            double length = graph.lengths[i];
+            if (rv != v || rw != graph.targets[i]) {
+                DVector2 d = graph.vertices[rw] - graph.vertices[rv];
+                length = std::sqrt(dot_product(d, d));
+            }
+            merged.push_back({rv, rw, length, graph.roads[i]});
+        }
+    }
+    sort_half_edges(merged);
+    merged.erase(std::unique(merged.begin(), merged.end(), [](const HalfEdge& a, const HalfEdge& b) {
+        return a.from == b.from && a.to == b.to;
+    }), merged.end());
+
+    std::vector<CleanEdge> edges;
+    edges.reserve(merged.size());
+    std::vector<std::vector<std::uint32_t>> incident(n);
+
+    for (const HalfEdge& e : merged) {
+        incident[e.from].push_back(edges.size());
+        incident[e.to].push_back(edges.size());
+        edges.push_back({e.from, e.to, e.length, e.road, true});
+    }
+
+    if (cleanup.min_stub_length > 0.0) {
+        std::vector<std::uint32_t> degree(n);
+        for (vertex_id v = 0; v < n; ++v) {
+            degree[v] = incident[v].size();
+        }
+        cut_stubs(edges, incident, degree, cleanup.min_stub_length);
+    }
+    if (cleanup.collapse_chains) {
+        collapse_chains(edges, incident);
+    }
+
+    // whatever still has an edge, renumbered in order
+    std::vector<std::uint32_t> live_degree(n, 0);
+    for (const CleanEdge& e : edges) {
+        if (!e.alive) continue;
+        ++live_degree[e.a];
+        ++live_degree[e.b];
+    }
+
+    RoadGraph out;
+    remap.assign(n, NullVertex);
+    for (vertex_id v = 0; v < n; ++v) {
+        if (live_degree[v] == 0) continue;
+
+        remap[v] = out.vertices.size();
+        out.vertices.push_back(graph.vertices[v]);
+        if (v < graph.first_junction) out.first_junction = out.vertices.size();
+    }
+
+    // merged sets map to wherever their root went
+    for (vertex_id v = 0; v < n; ++v) {
+        remap[v] = remap[sets.find(v)];
+    }
+
+    std::vector<HalfEdge> half_edges;
+    for (const CleanEdge& e : edges) {
+        if (!e.alive) continue;
+        half_edges.push_back({remap[e.a], remap[e.b], e.length, e.road});
+        half_edges.push_back({remap[e.b], remap[e.a], e.length, e.road});
+    }
+    sort_half_edges(half_edges);
+
+    fill_csr(out, half_edges);
+    return out;
+}
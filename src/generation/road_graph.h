@@ -0,0 +1,67 @@
+#ifndef ROAD_GRAPH_H
+#define ROAD_GRAPH_H
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "../types.h"
+#include "node_storage.h"
+
+
+// the road network as a planar graph in compressed sparse row form. vertex
+// v's edges are [offsets[v], offsets[v+1]) into targets, lengths and roads,
+// and every edge is stored once from each end. the first vertices come from
+// the generator's nodes, junctions added where roads cross come after them,
+// from first_junction on. straight out of build_road_graph the node ones
+// still have their node ids, cleaning up renumbers them.
+struct RoadGraph {
+    using vertex_id = std::uint32_t;
+    static constexpr vertex_id NullVertex = -1;
+
+    std::vector<DVector2> vertices;
+    vertex_id first_junction = 0;
+
+    std::vector<std::uint32_t> offsets; // vertex_count() + 1 of them
+    std::vector<vertex_id> targets;
+    std::vector<double> lengths;
+    std::vector<RoadType> roads;        // the most important road on the edge
+
+    std::size_t vertex_count() const { return vertices.size(); }
+    std::size_t edge_count() const { return targets.size()/2; }
+    std::size_t junction_count() const { return vertices.size() - first_junction; }
+
+    std::uint32_t degree(vertex_id v) const { return offsets[v+1] - offsets[v]; }
+
+    std::span<const vertex_id> neighbours(vertex_id v) const {
+        return {targets.data() + offsets[v], degree(v)};
+    }
+};
+
+
+// what clean_road_graph tidies away
+struct GraphCleanup {
+    double merge_radius = 0.5;     // vertices this close become one
+    double min_stub_length = 0.0;  // shorter dead ends off a junction go
+    bool collapse_chains = true;   // vertices between two edges of one road go, the edges joined
+};
+
+
+// splits every segment of the streamlines where it crosses another, so that
+// crossing roads share a junction vertex, and builds the graph of the pieces.
+// segments are bucketed in a uniform grid sized to their average length and
+// only tested against those sharing a cell, which is O((n + k) log n) for n
+// segments and k crossings on road maps, where no cell gets crowded.
+// the graph is in doubles whatever the nodes are kept in
+template<typename T>
+RoadGraph build_road_graph(const TNodeStore<T>& nodes, std::span<const Streamline* const> streamlines);
+
+// a smaller copy of graph with contiguous ids. near duplicate vertices are
+// merged with a union-find that runs over hash grid buckets on every thread,
+// then short stubs are cut and chains collapsed. remap[v] is where vertex v
+// went, NullVertex if it is gone
+RoadGraph clean_road_graph(const RoadGraph& graph, const GraphCleanup& cleanup,
+    std::vector<RoadGraph::vertex_id>& remap);
+
+
+#endif
@@ -0,0 +1,181 @@
+#include "segment_grid.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+
+
+//  SECTION: distances
+
+
+template<typename T>
+T segment_distance2(const TVector2<T>& p, const TVector2<T>& a, const TVector2<T>& b) {
+    TVector2<T> ab = b - a;
+    TVector2<T> ap = p - a;
+
+    T l2 = dot_product(ab, ab);
+    T t = l2 > 0 ? std::clamp(dot_product(ap, ab)/l2, T(0), T(1)) : T(0);
+
+    TVector2<T> diff = ap - ab*t;
+    return dot_product(diff, diff);
+}
+
+
+template<typename T>
+T segment_distance2(const TVector2<T>& a, const TVector2<T>& b, const TVector2<T>& c, const TVector2<T>& d) {
+    TVector2<T> ab = b - a;
+    TVector2<T> cd = d - c;
+    TVector2<T> ac = c - a;
+
+    // crossing, the endpoint distances below would all miss that
+    T denom = cross_product(ab, cd);
+    if (denom != 0) {
+        T t = cross_product(ac, cd)/denom;
+        T u = cross_product(ac, ab)/denom;
+        if (0 <= t && t <= 1 && 0 <= u && u <= 1) return 0;
+    }
+
+    return std::min({
+        segment_distance2(a, c, d),
+        segment_distance2(b, c, d),
+        segment_distance2(c, a, b),
+        segment_distance2(d, a, b)
+    });
+}
+
+
+//  SECTION: SegmentGrid
+
+
+template<typename T>
+TSegmentGrid<T>::TSegmentGrid(const NodeStore* all_nodes, std::vector<double> cell_sizes) :
+    all_nodes_(all_nodes)
+{
+    assert(!cell_sizes.empty());
+
+    std::sort(cell_sizes.begin(), cell_sizes.end());
+    cell_sizes.erase(std::unique(cell_sizes.begin(), cell_sizes.end()), cell_sizes.end());
+
+    for (double size : cell_sizes) {
+        assert(size > 0.0);
+        levels_.push_back(GridLevel{size, 1.0/size, {}, {}});
+    }
+}
+
+
+template<typename T>
+std::uint64_t TSegmentGrid<T>::cell_key(std::int64_t cx, std::int64_t cy) {
+    return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(cx)) << 32)
+        | static_cast<std::uint32_t>(cy);
+}
+
+
+template<typename T>
+const typename TSegmentGrid<T>::GridLevel& TSegmentGrid<T>::level_for(double radius) const {
+    // levels_ is ascending, take the last one that fits inside the radius
+    for (std::size_t i = levels_.size(); i-- > 1;) {
+        if (levels_[i].cell_size <= radius) return levels_[i];
+    }
+    return levels_.front();
+}
+
+
+template<typename T>
+void TSegmentGrid<T>::insert_streamline(const Streamline& s) {
+    if (s.size() < 2) return;
+
+    for (GridLevel& level : levels_) {
+        for (auto a = s.begin(), b = std::next(a); b != s.end(); ++a, ++b) {
+            Vec from = all_nodes_->pos(*a);
+            Vec to = all_nodes_->pos(*b);
+
+            road_mask roads = road_bits(all_nodes_->road(*a), all_nodes_->dir(*a));
+            SegmentEntry entry{from, to, all_nodes_->streamline(*a), roads};
+
+            // every cell the segment's box touches, segments are rarely
+            // longer than a cell so that is only a few
+            std::int64_t x0 = std::floor(std::min(from.x, to.x)*level.inv_cell_size);
+            std::int64_t x1 = std::floor(std::max(from.x, to.x)*level.inv_cell_size);
+            std::int64_t y0 = std::floor(std::min(from.y, to.y)*level.inv_cell_size);
+            std::int64_t y1 = std::floor(std::max(from.y, to.y)*level.inv_cell_size);
+
+            for (std::int64_t cy = y0; cy <= y1; ++cy) {
+                for (std::int64_t cx = x0; cx <= x1; ++cx) {
+                    auto [found, inserted] = level.lookup.try_emplace(cell_key(cx, cy), level.cells.size());
+                    if (inserted) level.cells.emplace_back();
+
+                    GridCell& cell = level.cells[found->second];
+                    cell.entries.push_back(entry);
+                    cell.summary.add(roads, entry.streamline);
+                }
+            }
+        }
+    }
+}
+
+
+template<typename T>
+void TSegmentGrid<T>::clear() {
+    for (GridLevel& level : levels_) {
+        level.lookup.clear();
+        level.cells.clear();
+    }
+}
+
+
+// a segment in several cells may be tested more than once, which costs
+// less than remembering which were
+template<typename T>
+bool TSegmentGrid<T>::any_within(const Vec& a, const Vec& b, T radius, const SpatialFilter& filter) const {
+    const GridLevel& level = level_for(radius);
+    T radius2 = radius*radius;
+
+    std::int64_t x0 = std::floor((std::min(a.x, b.x) - radius)*level.inv_cell_size);
+    std::int64_t x1 = std::floor((std::max(a.x, b.x) + radius)*level.inv_cell_size);
+    std::int64_t y0 = std::floor((std::min(a.y, b.y) - radius)*level.inv_cell_size);
+    std::int64_t y1 = std::floor((std::max(a.y, b.y) + radius)*level.inv_cell_size);
+
+    bool point = a == b;
+
+    for (std::int64_t cy = y0; cy <= y1; ++cy) {
+        for (std::int64_t cx = x0; cx <= x1; ++cx) {
+            auto found = level.lookup.find(cell_key(cx, cy));
+            if (found == level.lookup.end()) continue;
+
+            const GridCell& cell = level.cells[found->second];
+            if (!filter.admits(cell.summary)) continue;
+
+            for (const SegmentEntry& e : cell.entries) {
+                if (!filter.admits(e.roads, e.streamline)) continue;
+
+                T d2 = point
+                    ? segment_distance2(a, e.a, e.b)
+                    : segment_distance2(a, b, e.a, e.b);
+                if (d2 <= radius2) return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+template<typename T>
+bool TSegmentGrid<T>::has_nearby_segment(const Vec& centre, T radius, const SpatialFilter& filter) const {
+    return any_within(centre, centre, radius, filter);
+}
+
+
+template<typename T>
+bool TSegmentGrid<T>::capsule_hits(const Vec& a, const Vec& b, T radius, const SpatialFilter& filter) const {
+    return any_within(a, b, radius, filter);
+}
+
+
+template float segment_distance2(const FVector2&, const FVector2&, const FVector2&);
+template double segment_distance2(const DVector2&, const DVector2&, const DVector2&);
+template float segment_distance2(const FVector2&, const FVector2&, const FVector2&, const FVector2&);
+template double segment_distance2(const DVector2&, const DVector2&, const DVector2&, const DVector2&);
+template class TSegmentGrid<float>;
+template class TSegmentGrid<double>;
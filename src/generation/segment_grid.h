@@ -0,0 +1,79 @@
+#ifndef SEGMENT_GRID_H
+#define SEGMENT_GRID_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "../types.h"
+#include "node_storage.h"
+
+
+// distance from p to the segment ab
+template<typename T>
+T segment_distance2(const TVector2<T>& p, const TVector2<T>& a, const TVector2<T>& b);
+
+// distance between the segments ab and cd, 0 if they cross
+template<typename T>
+T segment_distance2(const TVector2<T>& a, const TVector2<T>& b, const TVector2<T>& c, const TVector2<T>& d);
+
+
+// sparse uniform grid over the segments between consecutive streamline
+// nodes, with one level per radius class like HashGrid. nodes only sample a
+// road, and after simplification a straight stretch has none in its middle,
+// so tests against the segments keep their spacing however coarse that is.
+// a query is a capsule: everything within radius of a point or a segment.
+template<typename T>
+class TSegmentGrid {
+public:
+    using Vec = TVector2<T>;
+    using NodeStore = TNodeStore<T>;
+
+private:
+    struct SegmentEntry {
+        Vec a;
+        Vec b;
+        int streamline;
+        road_mask roads;
+    };
+
+    struct GridCell {
+        std::vector<SegmentEntry> entries;
+        NodeSummary summary;
+    };
+
+    struct GridLevel {
+        double cell_size;
+        double inv_cell_size;
+        std::unordered_map<std::uint64_t, std::uint32_t> lookup; // cell key -> cells index
+        std::vector<GridCell> cells;
+    };
+
+    const NodeStore* all_nodes_;
+    std::vector<GridLevel> levels_; // ascending cell size
+
+    static std::uint64_t cell_key(std::int64_t cx, std::int64_t cy);
+    const GridLevel& level_for(double radius) const;
+
+    // true if any admitted segment is within radius of the segment ab
+    bool any_within(const Vec& a, const Vec& b, T radius, const SpatialFilter& filter) const;
+
+public:
+    TSegmentGrid(const NodeStore* all_nodes, std::vector<double> cell_sizes);
+
+    // a segment between each pair of consecutive nodes
+    void insert_streamline(const Streamline& s);
+
+    void clear();
+
+    bool has_nearby_segment(const Vec& centre, T radius, const SpatialFilter& filter) const;
+
+    // whether the capsule of radius around ab holds any segment
+    bool capsule_hits(const Vec& a, const Vec& b, T radius, const SpatialFilter& filter) const;
+};
+
+
+using SegmentGrid = TSegmentGrid<double>;
+
+
+#endif
@@ -0,0 +1,230 @@
+#include "snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+//  SECTION: SnapshotWriter
+
+SnapshotWriter::SnapshotWriter() :
+    bytes_(sizeof(SnapshotHeader))
+{
+    SnapshotHeader& h = header();
+    std::memcpy(h.magic, kSnapshotMagic, sizeof(h.magic));
+    h.version = kSnapshotVersion;
+}
+
+
+SnapshotHeader& SnapshotWriter::header() {
+    return *reinterpret_cast<SnapshotHeader*>(bytes_.data());
+}
+
+
+SnapshotSection SnapshotWriter::add_bytes(const void* data, std::size_t size) {
+    std::size_t offset = (bytes_.size() + kSnapshotAlign - 1) & ~(kSnapshotAlign - 1);
+    bytes_.resize(offset + size);
+    if (size) std::memcpy(bytes_.data() + offset, data, size);
+    return {offset, size};
+}
+
+
+bool SnapshotWriter::write(const std::string& path) const {
+    std::string partial = path + ".partial";
+    {
+        std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(bytes_.data()), bytes_.size());
+        if (!out) {
+            std::cout << "could not write snapshot " << partial << std::endl;
+            return false;
+        }
+    }
+
+    if (std::rename(partial.c_str(), path.c_str()) != 0) {
+        std::cout << "could not move snapshot into " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+
+//  SECTION: GeneratorSnapshot
+
+GeneratorSnapshot::GeneratorSnapshot(const std::byte* data, std::size_t size) :
+    data_(data),
+    size_(size)
+{}
+
+
+GeneratorSnapshot::GeneratorSnapshot(GeneratorSnapshot&& other) noexcept :
+    data_(other.data_),
+    size_(other.size_)
+{
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+
+GeneratorSnapshot& GeneratorSnapshot::operator=(GeneratorSnapshot&& other) noexcept {
+    if (this != &other) {
+        if (data_) munmap(const_cast<std::byte*>(data_), size_);
+        data_ = other.data_;
+        size_ = other.size_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+
+GeneratorSnapshot::~GeneratorSnapshot() {
+    if (data_) munmap(const_cast<std::byte*>(data_), size_);
+}
+
+
+std::optional<GeneratorSnapshot> GeneratorSnapshot::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return {};
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return {};
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file
+    if (data == MAP_FAILED) return {};
+
+    GeneratorSnapshot out(static_cast<const std::byte*>(data), st.st_size);
+    if (!out.valid()) {
+        std::cout << "not a usable snapshot: " << path << std::endl;
+        return {};
+    }
+    return out;
+}
+
+
+// the header is what it says, every section lies inside the file, and the
+// arrays agree on how many nodes there are
+bool GeneratorSnapshot::valid() const {
+    const SnapshotHeader& h = header();
+    if (std::memcmp(h.magic, kSnapshotMagic, sizeof(h.magic)) != 0) return false;
+    if (h.version != kSnapshotVersion) return false;
+
+    std::size_t coord_size;
+    switch (h.position_format) {
+        case DoublePositions::kFormat:    coord_size = sizeof(DoublePositions::coord); break;
+        case FloatPositions::kFormat:     coord_size = sizeof(FloatPositions::coord); break;
+        case QuantisedPositions::kFormat: coord_size = sizeof(QuantisedPositions::coord); break;
+        default: return false;
+    }
+
+    const SnapshotSection* sections[] = {
+        &h.xs, &h.ys, &h.node_streamlines, &h.node_dirs, &h.node_roads,
+        &h.streamlines, &h.ids, &h.recipes, &h.major_seeds, &h.minor_seeds, &h.random
+    };
+    for (const SnapshotSection* s : sections) {
+        if (s->offset % kSnapshotAlign != 0) return false;
+        if (s->offset > size_ || s->size > size_ - s->offset) return false;
+    }
+
+    std::uint64_t n = h.node_count;
+    if (h.xs.size != n*coord_size || h.ys.size != n*coord_size) return false;
+    if (h.node_streamlines.size != n*sizeof(int)) return false;
+    if (h.node_dirs.size != n*sizeof(Direction) || h.node_roads.size != n*sizeof(std::uint8_t)) return false;
+
+    std::span<const node_id> all_ids = section<node_id>(h.ids);
+    for (const SnapshotStreamline& s : streamlines()) {
+        if (s.first > all_ids.size() || s.size > all_ids.size() - s.first) return false;
+    }
+    for (node_id id : all_ids) {
+        if (id >= n) return false;
+    }
+
+    return true;
+}
+
+
+const SnapshotHeader& GeneratorSnapshot::header() const {
+    return *reinterpret_cast<const SnapshotHeader*>(data_);
+}
+
+
+std::size_t GeneratorSnapshot::node_count() const {
+    return header().node_count;
+}
+
+
+DVector2 GeneratorSnapshot::pos(node_id id) const {
+    const SnapshotHeader& h = header();
+
+    auto decode = [&]<typename Positions>(Positions) -> DVector2 {
+        return {
+            Positions::decode(stored_xs<Positions>()[id], h.origin.x),
+            Positions::decode(stored_ys<Positions>()[id], h.origin.y)
+        };
+    };
+
+    switch (h.position_format) {
+        case FloatPositions::kFormat:     return decode(FloatPositions{});
+        case QuantisedPositions::kFormat: return decode(QuantisedPositions{});
+        default:                          return decode(DoublePositions{});
+    }
+}
+
+
+int GeneratorSnapshot::streamline(node_id id) const {
+    return section<int>(header().node_streamlines)[id];
+}
+
+
+Direction GeneratorSnapshot::dir(node_id id) const {
+    return section<Direction>(header().node_dirs)[id];
+}
+
+
+RoadType GeneratorSnapshot::road(node_id id) const {
+    return static_cast<RoadType>(section<std::uint8_t>(header().node_roads)[id]);
+}
+
+
+std::span<const SnapshotStreamline> GeneratorSnapshot::streamlines() const {
+    return section<SnapshotStreamline>(header().streamlines);
+}
+
+
+std::span<const node_id> GeneratorSnapshot::ids(const SnapshotStreamline& s) const {
+    return section<node_id>(header().ids).subspan(s.first, s.size);
+}
+
+
+std::span<const StreamlineRecipe> GeneratorSnapshot::recipes() const {
+    return section<StreamlineRecipe>(header().recipes);
+}
+
+
+std::span<const DVector2> GeneratorSnapshot::seeds(Direction dir) const {
+    return section<DVector2>(dir == Major ? header().major_seeds : header().minor_seeds);
+}
+
+
+std::string_view GeneratorSnapshot::random_state() const {
+    std::span<const char> text = section<char>(header().random);
+    return {text.data(), text.size()};
+}
+
+
+void GeneratorSnapshot::polyline(const SnapshotStreamline& s, std::vector<DVector2>& out) const {
+    out.clear();
+    for (node_id id : ids(s)) {
+        out.push_back(pos(id));
+    }
+}
@@ -0,0 +1,161 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "../types.h"
+#include "generator.h"
+#include "integrator.h"
+#include "node_store.h"
+
+
+// a generator's state as one flat file: a header, then arrays at offsets
+// from the start of the file, each aligned to kSnapshotAlign. nothing in it
+// points anywhere, so it can be mapped at any address and read in place.
+// native byte order, it is not meant to move between machines.
+
+static constexpr char kSnapshotMagic[8] = {'R', 'O', 'A', 'D', 'S', 'N', 'A', 'P'};
+static constexpr std::uint32_t kSnapshotVersion = 1;
+static constexpr std::size_t kSnapshotAlign = 16;
+
+
+struct SnapshotSection {
+    std::uint64_t offset; // bytes from the start of the file
+    std::uint64_t size;   // bytes
+};
+
+
+// one streamline, its node ids at [first, first + size) of the id section
+struct SnapshotStreamline {
+    std::uint64_t first;
+    std::uint32_t size;
+    RoadType road;
+    Direction dir;
+};
+
+
+struct SnapshotHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t scalar_size;      // sizeof the generator's T
+    std::uint32_t position_format;  // NodePositions<T>::kFormat
+    std::uint32_t road_count;
+
+    Box<double> viewport;
+    DVector2 origin;                // of the node store
+    std::uint64_t node_count;
+
+    // where generation had got to
+    std::int32_t road_idx;
+    std::int32_t committed;
+    Direction dir;
+    bool started;
+    bool done;
+
+    SnapshotSection xs;             // positions as the node store keeps them
+    SnapshotSection ys;
+    SnapshotSection node_streamlines;
+    SnapshotSection node_dirs;
+    SnapshotSection node_roads;
+    SnapshotSection streamlines;    // SnapshotStreamline, by road type, direction, index
+    SnapshotSection ids;            // node_id
+    SnapshotSection recipes;        // StreamlineRecipe, by streamline id
+    SnapshotSection major_seeds;    // DVector2, in queue order
+    SnapshotSection minor_seeds;
+    SnapshotSection random;         // the random engine and distribution, as text
+};
+
+static_assert(std::is_trivially_copyable_v<SnapshotHeader>);
+static_assert(std::is_trivially_copyable_v<SnapshotStreamline>);
+static_assert(std::is_trivially_copyable_v<StreamlineRecipe>);
+
+
+// lays sections out one after another behind a header, for writing
+class SnapshotWriter {
+private:
+    std::vector<std::byte> bytes_;
+
+public:
+    SnapshotWriter();
+
+    SnapshotHeader& header();
+
+    template<typename U>
+    SnapshotSection add(std::span<const U> items) {
+        static_assert(std::is_trivially_copyable_v<U>);
+        return add_bytes(items.data(), items.size_bytes());
+    }
+
+    SnapshotSection add_bytes(const void* data, std::size_t size);
+
+    // the file is written whole under another name and renamed over path,
+    // so a crash midway leaves the last checkpoint as it was
+    bool write(const std::string& path) const;
+};
+
+
+// a snapshot file mapped read only. everything it hands out points into
+// the mapping, so opening one reads nothing but the header, and it is only
+// paged in as it is used. fine to read from any number of threads
+class GeneratorSnapshot {
+private:
+    const std::byte* data_ = nullptr;
+    std::size_t size_ = 0;
+
+    GeneratorSnapshot(const std::byte* data, std::size_t size);
+
+    template<typename U>
+    std::span<const U> section(const SnapshotSection& s) const {
+        return {reinterpret_cast<const U*>(data_ + s.offset), s.size/sizeof(U)};
+    }
+
+    bool valid() const;
+
+public:
+    // nothing if the file is missing, short or not a snapshot of this version
+    static std::optional<GeneratorSnapshot> open(const std::string& path);
+
+    GeneratorSnapshot(GeneratorSnapshot&& other) noexcept;
+    GeneratorSnapshot& operator=(GeneratorSnapshot&& other) noexcept;
+    GeneratorSnapshot(const GeneratorSnapshot&) = delete;
+    GeneratorSnapshot& operator=(const GeneratorSnapshot&) = delete;
+    ~GeneratorSnapshot();
+
+    const SnapshotHeader& header() const;
+
+    std::size_t node_count() const;
+    DVector2 pos(node_id id) const;
+    int streamline(node_id id) const;
+    Direction dir(node_id id) const;
+    RoadType road(node_id id) const;
+
+    // positions as kept, for a store of the matching format
+    template<typename Positions>
+    std::span<const typename Positions::coord> stored_xs() const {
+        return section<typename Positions::coord>(header().xs);
+    }
+
+    template<typename Positions>
+    std::span<const typename Positions::coord> stored_ys() const {
+        return section<typename Positions::coord>(header().ys);
+    }
+
+    std::span<const SnapshotStreamline> streamlines() const;
+    std::span<const node_id> ids(const SnapshotStreamline& s) const;
+    std::span<const StreamlineRecipe> recipes() const;
+    std::span<const DVector2> seeds(Direction dir) const;
+    std::string_view random_state() const;
+
+    // a streamline's node positions, joins included
+    void polyline(const SnapshotStreamline& s, std::vector<DVector2>& out) const;
+};
+
+
+#endif
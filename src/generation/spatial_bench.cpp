@@ -0,0 +1,1011 @@
+#include "spatial_bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iterator>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "compressed_polylines.h"
+#include "hash_grid.h"
+#include "integrator.h"
+#include "lazy_streamlines.h"
+#include "node_storage.h"
+#include "snapshot.h"
+#include "tensor_field.h"
+
+
+using bench_clock = std::chrono::steady_clock;
+
+static constexpr int kBenchQueries = 200000;
+static constexpr int kBenchGatherQueries = 20000;
+static constexpr int kBenchTraceRepeats = 20;
+static constexpr int kBenchPrecisionRuns = 3;
+static constexpr int kBenchRegenerations = 4;
+static constexpr int kBenchChunks = 4;          // across and down the viewport
+static constexpr std::size_t kBenchLazyCache = 128;
+static constexpr int kBenchDecodeRepeats = 20;
+static constexpr int kBenchBackends = 3;
+static constexpr int kBenchReaders = 4;
+
+
+static double elapsed_ms(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+
+//  SECTION: fixture
+
+static void add_bench_field(TensorField& tf, const Box<double>& viewport) {
+    DVector2 size = viewport.max - viewport.min;
+
+    tf.add_basis_field(std::make_unique<Grid>(0.3, viewport.min));
+    tf.add_basis_field(std::make_unique<Radial>(viewport.min + size*0.45, 400, 2));
+    tf.add_basis_field(std::make_unique<Grid>(1.1, viewport.min + DVector2{size.x*0.8, size.y*0.3}, 500, 2));
+}
+
+
+// streamlines as inserted, joins add nodes owned by other streamlines so
+// keep only the first streamline to claim each node
+template<typename T>
+static std::vector<Streamline> indexed_streamlines(TRoadGenerator<T>& generator) {
+    std::vector<Streamline> out;
+    std::vector<bool> seen(generator.node_count(), false);
+
+    for (RoadType road : generator.get_road_types()) {
+        for (Direction dir : {Major, Minor}) {
+            for (const Streamline& s : generator.get_streamlines(road, dir)) {
+                Streamline owned;
+                for (node_id id : s) {
+                    if (seen[id]) continue;
+                    seen[id] = true;
+                    owned.push_back(id);
+                }
+                out.push_back(std::move(owned));
+            }
+        }
+    }
+
+    return out;
+}
+
+
+// the fastest of a few runs of a fresh generator in T. leaves the last one's
+// nodes in nodes, in doubles, and its streamlines as indexed_streamlines
+template<typename T>
+static double generate_map(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport, const TTensorField<T>& field,
+    NodeStore& nodes, std::vector<Streamline>& streamlines,
+    bool pipelined = false, bool segments = false)
+{
+    double best = std::numeric_limits<double>::max();
+
+    for (int run = 0; run < kBenchPrecisionRuns; ++run) {
+        std::unique_ptr<TNumericalFieldIntegrator<T>> integrator = std::make_unique<TRK4<T>>(&field);
+        TRoadGenerator<T> generator(integrator, params, viewport);
+        generator.set_pipelined(pipelined);
+        generator.set_segment_separation(segments);
+
+        bench_clock::time_point start = bench_clock::now();
+        generator.generate();
+        best = std::min(best, elapsed_ms(start));
+
+        if (run + 1 < kBenchPrecisionRuns) continue;
+
+        nodes.reset(middle(viewport.min, viewport.max));
+        for (int i = 0; i < generator.node_count(); ++i) {
+            nodes.push_back(generator.get_node(i));
+        }
+        streamlines = indexed_streamlines(generator);
+    }
+
+    return best;
+}
+
+
+// a streamline's own nodes are consecutive ids, so its ends are where the
+// streamline id changes
+static bool is_end(const NodeStore& nodes, node_id id) {
+    return id == 0 || id + 1 == nodes.size()
+        || nodes.streamline(id - 1) != nodes.streamline(id)
+        || nodes.streamline(id + 1) != nodes.streamline(id);
+}
+
+
+// nodes inside d_test of an earlier streamline in the same direction, which
+// tracing should have stopped at. the ends are where it did, so are left out
+static int spacing_violations(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    const NodeStore& nodes, const SpatialIndex& index)
+{
+    int violations = 0;
+
+    for (node_id id = 0; id < nodes.size(); ++id) {
+        if (is_end(nodes, id)) continue;
+
+        SpatialFilter filter(nodes.dir(id));
+        filter.max_streamline = nodes.streamline(id) - 1;
+
+        // as the generator clamps it
+        const GeneratorParameters& p = params.at(nodes.road(id));
+        violations += index.has_nearby_point(nodes.pos(id), std::min(p.d_test, p.d_sep), filter);
+    }
+
+    return violations;
+}
+
+
+// the map traced sequentially and pipelined, with node and with segment
+// separation. a pipelined commit has to keep to the spacing a sequential
+// trace would have, however far in flight it was
+static int compare_pipelined_spacing(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport, const TensorField& tf)
+{
+    std::vector<double> cell_sizes;
+    for (const auto& [_, p] : params) {
+        cell_sizes.push_back(p.d_test);
+    }
+
+    int mismatches = 0;
+    for (bool segments : {false, true}) {
+        int violations[2];
+        for (bool pipelined : {false, true}) {
+            NodeStore nodes;
+            std::vector<Streamline> streamlines;
+            generate_map<double>(params, viewport, tf, nodes, streamlines, pipelined, segments);
+
+            HashGrid index(&nodes, cell_sizes);
+            for (const Streamline& s : streamlines) {
+                index.insert_streamline(s);
+            }
+            violations[pipelined] = spacing_violations(params, nodes, index);
+        }
+
+        std::cout << (segments ? "segment" : "node") << " separation: spacing violations sequential "
+                  << violations[0] << ", pipelined " << violations[1] << std::endl;
+
+        if (violations[1] > violations[0]) {
+            std::cout << "  mismatch: pipelined map breaks spacing more often" << std::endl;
+            ++mismatches;
+        }
+    }
+
+    return mismatches;
+}
+
+
+// the float map traced against the double one. every float node is matched
+// to the nearest double road of its type and direction within d_test, and
+// its distance to that road's polyline is its deviation. nodes with no road
+// near them are where the two maps went different ways
+static int compare_precision(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport, const TensorField& tf)
+{
+    NodeStore nodes[2];
+    std::vector<Streamline> streamlines[2];
+    double ms[2] = {
+        generate_map<double>(params, viewport, tf, nodes[0], streamlines[0]),
+        generate_map<float>(params, viewport, TTensorField<float>(tf), nodes[1], streamlines[1])
+    };
+
+    std::vector<double> cell_sizes;
+    for (const auto& [_, p] : params) {
+        cell_sizes.push_back(p.d_test);
+    }
+
+    HashGrid indices[2] = {HashGrid(&nodes[0], cell_sizes), HashGrid(&nodes[1], cell_sizes)};
+    int violations[2];
+
+    const char* names[2] = {"double", "float"};
+    for (int b = 0; b < 2; ++b) {
+        for (const Streamline& s : streamlines[b]) {
+            indices[b].insert_streamline(s);
+        }
+        violations[b] = spacing_violations(params, nodes[b], indices[b]);
+
+        std::cout << names[b] << ": generate " << ms[b] << "ms, " << nodes[b].size() << " nodes, "
+                  << streamlines[b].size() << " streamlines, " << violations[b] << " spacing violations" << std::endl;
+    }
+
+    const NodeStore& exact = nodes[0];
+    std::size_t matched = 0, unmatched = 0;
+    double total = 0.0, worst = 0.0;
+
+    for (node_id id = 0; id < nodes[1].size(); ++id) {
+        DVector2 p = nodes[1].pos(id);
+        RoadType road = nodes[1].road(id);
+
+        SpatialFilter filter;
+        filter.roads = road_bits(road, nodes[1].dir(id));
+
+        std::optional<node_id> nearest = indices[0].nearest_point(p, params.at(road).d_test, filter);
+        if (!nearest.has_value()) {
+            ++unmatched;
+            continue;
+        }
+
+        node_id n = nearest.value();
+        double d2 = dot_product(p - exact.pos(n), p - exact.pos(n));
+        for (node_id m : {n - 1, n + 1}) {
+            if (m >= exact.size() || exact.streamline(m) != exact.streamline(n)) continue;
+            d2 = std::min(d2, segment_distance2(p, exact.pos(n), exact.pos(m)));
+        }
+
+        double d = std::sqrt(d2);
+        total += d;
+        worst = std::max(worst, d);
+        ++matched;
+    }
+
+    std::cout << "float against double: " << matched << " nodes matched, mean deviation "
+              << (matched ? total/matched : 0.0) << ", max " << worst << ", "
+              << unmatched << " unmatched" << std::endl;
+
+    // float may trace different roads, but never closer ones
+    if (violations[1] > violations[0]) {
+        std::cout << "  mismatch: float map breaks spacing more often" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+//  SECTION: allocations
+
+#ifdef SPATIAL_BENCH
+// every allocation in the process is counted, so the bench can tell whether
+// regenerating allocates at all. only in bench builds
+static std::atomic<long> allocations = 0;
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+
+
+// the same map regenerated by one generator, batch and pipelined. after the
+// first run a batch regeneration should find all the storage it needs kept
+// from the last. the pipelined one starts its stage threads and queues anew
+// for every road type, so only that much is expected of it
+static int count_regeneration_allocations(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport, const TensorField& tf)
+{
+#ifdef SPATIAL_BENCH
+    std::unique_ptr<NumericalFieldIntegrator> integrator = std::make_unique<RK4>(&tf);
+    RoadGenerator generator(integrator, params, viewport);
+    int mismatches = 0;
+
+    for (bool pipelined : {false, true}) {
+        generator.set_pipelined(pipelined);
+
+        long counts[kBenchRegenerations];
+        int nodes[kBenchRegenerations];
+        for (int run = 0; run < kBenchRegenerations; ++run) {
+            generator.set_seed(1);
+
+            long before = allocations.load(std::memory_order_relaxed);
+            generator.generate();
+            counts[run] = allocations.load(std::memory_order_relaxed) - before;
+            nodes[run] = generator.node_count();
+        }
+
+        std::cout << (pipelined ? "pipelined" : "batch") << ": allocations per regeneration";
+        for (long count : counts) {
+            std::cout << " " << count;
+        }
+        std::cout << std::endl;
+
+        if (!pipelined && counts[kBenchRegenerations - 1] != 0) {
+            std::cout << "  mismatch: regenerating still allocates" << std::endl;
+            ++mismatches;
+        }
+
+        // batch runs after the same seed are the same map, pipelined ones
+        // may commit differently
+        if (!pipelined && std::count(nodes, nodes + kBenchRegenerations, nodes[0]) != kBenchRegenerations) {
+            std::cout << "  mismatch: same seed, different maps" << std::endl;
+            ++mismatches;
+        }
+    }
+
+    return mismatches;
+#else
+    return 0;
+#endif
+}
+
+
+//  SECTION: lazy streamlines
+
+// the map generated batch and pipelined, then kept as recipes and traced
+// again: every streamline has to come back node for node. then the viewport
+// is drawn a chunk at a time, twice, through a small cache
+static int check_lazy_streamlines(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport, const TensorField& tf)
+{
+    std::shared_ptr<const TensorField> field = tf.snapshot();
+    int mismatches = 0;
+
+    for (bool pipelined : {false, true}) {
+        std::unique_ptr<NumericalFieldIntegrator> integrator = std::make_unique<RK4>(field.get());
+        RoadGenerator generator(integrator, params, viewport);
+        generator.set_pipelined(pipelined);
+        generator.generate();
+
+        LazyStreamlines lazy(generator, field, kBenchLazyCache);
+
+        std::size_t ids = 0;
+        for (RoadType road : generator.get_road_types()) {
+            for (Direction dir : {Major, Minor}) {
+                for (const Streamline& s : generator.get_streamlines(road, dir)) {
+                    ids += s.size();
+                }
+            }
+        }
+        // a list node is its id and two links
+        std::size_t node_bytes = generator.node_count()*NodeStore::kBytesPerNode
+            + ids*(sizeof(node_id) + 2*sizeof(void*));
+
+        const char* name = pipelined ? "pipelined" : "batch";
+        std::cout << name << ": lazy " << lazy.size() << " streamlines in " << lazy.stored_bytes()
+                  << " bytes, against " << node_bytes << " as nodes" << std::endl;
+
+        int wrong = 0;
+        std::map<std::pair<RoadType, Direction>, int> index;
+        bench_clock::time_point start = bench_clock::now();
+        for (std::size_t id = 0; id < lazy.size(); ++id) {
+            const StreamlineRecipe& r = lazy.recipe(id);
+            std::vector<DVector2> stored = generator.get_polyline(r.road, r.dir, index[{r.road, r.dir}]++);
+            wrong += *lazy.polyline(id) != stored;
+        }
+        std::cout << name << ": traced every streamline again in " << elapsed_ms(start) << "ms, "
+                  << wrong << " differ" << std::endl;
+
+        if (wrong) {
+            std::cout << "  mismatch: replayed streamlines differ" << std::endl;
+            ++mismatches;
+        }
+
+        lazy.clear_cache();
+        LazyStreamlines::CacheStats before = lazy.get_cache_stats();
+        DVector2 chunk = (viewport.max - viewport.min)*(1.0/kBenchChunks);
+        std::vector<std::size_t> found;
+
+        for (int pass = 0; pass < 2; ++pass) {
+            start = bench_clock::now();
+            for (int cy = 0; cy < kBenchChunks; ++cy) {
+                for (int cx = 0; cx < kBenchChunks; ++cx) {
+                    DVector2 min = viewport.min + DVector2{chunk.x*cx, chunk.y*cy};
+                    found.clear();
+                    lazy.streamlines_in(Box<double>(min, min + chunk), found);
+                    for (std::size_t id : found) {
+                        lazy.polyline(id);
+                    }
+                }
+            }
+            std::cout << name << ": chunked draw pass " << pass << " " << elapsed_ms(start) << "ms" << std::endl;
+        }
+
+        const LazyStreamlines::CacheStats& after = lazy.get_cache_stats();
+        std::cout << name << ": cache of " << kBenchLazyCache << ", " << after.hits - before.hits
+                  << " hits, " << after.misses - before.misses << " misses" << std::endl;
+    }
+
+    return mismatches;
+}
+
+
+//  SECTION: compressed polylines
+
+// the map's streamlines packed and unpacked again. every node has to come
+// back within half a step on each axis, and read alone it has to match the
+// whole streamline decoded
+static int check_compressed_polylines(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport, const TensorField& tf)
+{
+    std::unique_ptr<NumericalFieldIntegrator> integrator = std::make_unique<RK4>(&tf);
+    RoadGenerator generator(integrator, params, viewport);
+    generator.generate();
+
+    bench_clock::time_point start = bench_clock::now();
+    CompressedPolylines packed = compress_streamlines(generator, viewport);
+    double encode_ms = elapsed_ms(start);
+
+    std::size_t ids = 0;
+    for (std::size_t i = 0; i < packed.size(); ++i) {
+        ids += packed.info(i).size;
+    }
+    std::size_t node_bytes = generator.node_count()*NodeStore::kBytesPerNode
+        + ids*(sizeof(node_id) + 2*sizeof(void*));
+
+    std::cout << "compressed: " << packed.size() << " streamlines, " << ids << " nodes in "
+              << packed.memory_bytes() << " bytes (" << double(packed.memory_bytes())/ids
+              << " a node), against " << node_bytes << ", packed in " << encode_ms << "ms" << std::endl;
+
+    int mismatches = 0;
+    double worst = 0.0;
+    std::vector<DVector2> decoded;
+    for (std::size_t i = 0; i < packed.size(); ++i) {
+        const CompressedPolylines::Info& info = packed.info(i);
+        std::vector<DVector2> exact = generator.get_polyline(info.road, info.dir, info.index);
+        packed.decode(i, decoded);
+
+        if (decoded.size() != exact.size()) {
+            ++mismatches;
+            continue;
+        }
+        for (std::size_t k = 0; k < exact.size(); ++k) {
+            worst = std::max({worst, std::abs(decoded[k].x - exact[k].x), std::abs(decoded[k].y - exact[k].y)});
+            mismatches += packed.node(i, k) != decoded[k];
+        }
+    }
+
+    std::vector<FVector2> drawn;
+    start = bench_clock::now();
+    for (int rep = 0; rep < kBenchDecodeRepeats; ++rep) {
+        for (std::size_t i = 0; i < packed.size(); ++i) {
+            packed.decode(i, drawn);
+        }
+    }
+    double decode_ns = elapsed_ms(start)*1e6/(ids*kBenchDecodeRepeats);
+
+    std::cout << "compressed: decode " << decode_ns << "ns a node, worst error " << worst
+              << ", step " << packed.step() << std::endl;
+
+    if (mismatches || worst > packed.step()/2) {
+        std::cout << "  mismatch: " << mismatches << " nodes decoded wrong" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+//  SECTION: snapshots
+
+static bool same_map(RoadGenerator& a, RoadGenerator& b) {
+    if (a.node_count() != b.node_count()) return false;
+
+    for (RoadType road : a.get_road_types()) {
+        for (Direction dir : {Major, Minor}) {
+            int count = a.get_streamlines(road, dir).size();
+            if (count != b.get_streamlines(road, dir).size()) return false;
+            for (int i = 0; i < count; ++i) {
+                if (a.get_polyline(road, dir, i) != b.get_polyline(road, dir, i)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// a generation saved halfway and carried on by a fresh generator from the
+// file has to come out as the one left to finish, whether it loads into a
+// quadtree or in bulk into a linear quadtree, and the finished map read
+// straight from its snapshot has to be the generator's
+static int check_snapshots(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport, const TensorField& tf)
+{
+    std::string path = (std::filesystem::temp_directory_path() / "road_bench.snapshot").string();
+    std::unique_ptr<NumericalFieldIntegrator> integrators[3] = {
+        std::make_unique<RK4>(&tf), std::make_unique<RK4>(&tf), std::make_unique<RK4>(&tf)
+    };
+    RoadGenerator whole(integrators[0], params, viewport);
+    RoadGenerator resumed(integrators[1], params, viewport);
+    RoadGenerator bulk(integrators[2], params, viewport);
+    bulk.set_spatial_backend(LinearQuadTreeIndex);
+    int mismatches = 0;
+
+    whole.set_seed(1);
+    whole.generate();
+    int halfway = whole.get_progress().streamlines/2;
+
+    whole.set_seed(1);
+    whole.clear();
+    while (whole.get_progress().streamlines < halfway) {
+        whole.generation_step();
+    }
+
+    bench_clock::time_point start = bench_clock::now();
+    bool saved = whole.save(path);
+    double save_ms = elapsed_ms(start);
+    while (whole.generation_step().has_value());
+
+    start = bench_clock::now();
+    std::optional<GeneratorSnapshot> halfway_snapshot = GeneratorSnapshot::open(path);
+    double open_ms = elapsed_ms(start);
+
+    start = bench_clock::now();
+    bool loaded = saved && halfway_snapshot.has_value() && resumed.load(halfway_snapshot.value());
+    double load_ms = elapsed_ms(start);
+    while (loaded && resumed.generation_step().has_value());
+
+    start = bench_clock::now();
+    bool bulk_loaded = loaded && bulk.load(halfway_snapshot.value());
+    double bulk_ms = elapsed_ms(start);
+    while (bulk_loaded && bulk.generation_step().has_value());
+
+    std::cout << "snapshot: saved after " << halfway << " streamlines in " << save_ms << "ms, opened in "
+              << open_ms << "ms, loaded in " << load_ms << "ms, " << bulk_ms << "ms in bulk" << std::endl;
+
+    if (!loaded || !same_map(whole, resumed)) {
+        std::cout << "  mismatch: resumed generation differs" << std::endl;
+        ++mismatches;
+    }
+    if (!bulk_loaded || !same_map(whole, bulk)) {
+        std::cout << "  mismatch: generation resumed in bulk differs" << std::endl;
+        ++mismatches;
+    }
+
+    whole.save(path);
+    std::optional<GeneratorSnapshot> finished = GeneratorSnapshot::open(path);
+    int index[3][3] = {};
+    int wrong = 0;
+    std::vector<DVector2> polyline;
+    if (finished.has_value()) {
+        for (const SnapshotStreamline& s : finished->streamlines()) {
+            finished->polyline(s, polyline);
+            wrong += polyline != whole.get_polyline(s.road, s.dir, index[s.road][s.dir]++);
+        }
+        std::cout << "snapshot: finished map " << std::filesystem::file_size(path) << " bytes, "
+                  << finished->streamlines().size() << " streamlines read in place, " << wrong << " differ" << std::endl;
+    }
+
+    if (!finished.has_value() || wrong) {
+        std::cout << "  mismatch: snapshot does not read back as the map" << std::endl;
+        ++mismatches;
+    }
+
+    std::filesystem::remove(path);
+    return mismatches;
+}
+
+
+//  SECTION: cursors
+
+// one cursor kept through queries along each streamline of the first half
+// while it is taken out of the quadtree, by region or by id, and put back.
+// that frees and merges cells on the cursor's path, and a streamline of the
+// second half, left out until then, goes in first so the freed cells are
+// reused elsewhere. every answer through the cursor is checked against the
+// same query from the root. the radius is the finest cell, so the cursor
+// gets as deep as it can
+static int check_cursor_removals(
+    const NodeStore& nodes, const std::vector<Streamline>& streamlines,
+    Box<double> viewport, double cell_size)
+{
+    std::size_t half = streamlines.size()/2;
+
+    Spatial index(&nodes, viewport, cell_size, 10);
+    for (std::size_t i = 0; i < half; ++i) {
+        index.insert_streamline(streamlines[i]);
+    }
+
+    SpatialCursor cursor;
+    SpatialFilter filter(Major | Minor);
+    long queries = 0;
+    long wrong = 0;
+
+    auto query_at = [&](node_id id) {
+        bool through = index.has_nearby_point(nodes.pos(id), cell_size, filter, cursor);
+        wrong += through != index.has_nearby_point(nodes.pos(id), cell_size, filter);
+        ++queries;
+    };
+
+    std::vector<node_id> removed;
+    for (std::size_t i = 0; i < half; ++i) {
+        const Streamline& s = streamlines[i];
+        if (s.empty()) continue;
+
+        // leaving the cursor in the middle
+        node_id mid = *std::next(s.begin(), s.size()/2);
+        for (node_id id : s) {
+            query_at(id);
+        }
+        query_at(mid);
+
+        removed.clear();
+        if (i % 2 == 0) {
+            DVector2 reach{cell_size*8, cell_size*8};
+            index.remove_region({nodes.pos(mid) - reach, nodes.pos(mid) + reach}, SpatialFilter(nodes.dir(mid)), removed);
+        } else {
+            removed.assign(s.begin(), s.end());
+            index.remove_nodes(removed);
+        }
+
+        index.insert_streamline(streamlines[half + i]);
+        index.insert_streamline(Streamline(removed.begin(), removed.end()));
+
+        query_at(mid);
+        for (node_id id : s) {
+            query_at(id);
+        }
+    }
+
+    std::cout << "quadtree: " << queries << " cursor queries among removals, " << wrong << " differ" << std::endl;
+
+    if (wrong) {
+        std::cout << "  mismatch: cursor answers stale after removals" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+
+//  SECTION: concurrent readers
+
+// readers querying the quadtree in concurrent mode while one thread inserts
+// the second half of the streamlines into it. inserts only add nodes, so a
+// query has to find something wherever the first half alone had something,
+// and nothing where the whole map has nothing. once the writer is done every
+// answer has to match a quadtree that was built without readers
+static int check_concurrent_readers(
+    const NodeStore& nodes, const std::vector<Streamline>& streamlines,
+    Box<double> viewport, double cell_size, std::span<const DVector2> points, double radius)
+{
+    std::size_t half = streamlines.size()/2;
+
+    Spatial before(&nodes, viewport, cell_size, 10);
+    Spatial after(&nodes, viewport, cell_size, 10);
+    Spatial index(&nodes, viewport, cell_size, 10);
+    for (std::size_t i = 0; i < streamlines.size(); ++i) {
+        if (i < half) {
+            before.insert_streamline(streamlines[i]);
+            index.insert_streamline(streamlines[i]);
+        }
+        after.insert_streamline(streamlines[i]);
+    }
+
+    SpatialFilter filter(Major | Minor);
+    std::vector<bool> lower(points.size());
+    std::vector<bool> upper(points.size());
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        lower[i] = before.has_nearby_point(points[i], radius, filter);
+        upper[i] = after.has_nearby_point(points[i], radius, filter);
+    }
+
+    if (!index.set_concurrent(true)) {
+        std::cout << "  mismatch: quadtree refused concurrent mode" << std::endl;
+        return 1;
+    }
+
+    std::atomic<bool> writing = true;
+    std::atomic<long> queries = 0;
+    std::atomic<long> wrong = 0;
+
+    // half the readers go through a cursor, each starts somewhere else
+    auto read = [&](int reader) {
+        SpatialCursor cursor;
+        long n = 0;
+        long w = 0;
+        for (std::size_t i = reader*points.size()/kBenchReaders; writing.load(std::memory_order_relaxed); ++i) {
+            std::size_t k = i % points.size();
+            bool hit = reader % 2
+                ? index.has_nearby_point(points[k], radius, filter, cursor)
+                : index.has_nearby_point(points[k], radius, filter);
+            w += (lower[k] && !hit) || (!upper[k] && hit);
+            ++n;
+        }
+        queries += n;
+        wrong += w;
+    };
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < kBenchReaders; ++r) {
+        readers.emplace_back(read, r);
+    }
+
+    bench_clock::time_point start = bench_clock::now();
+    for (std::size_t i = half; i < streamlines.size(); ++i) {
+        index.insert_streamline(streamlines[i]);
+    }
+    double insert_ms = elapsed_ms(start);
+
+    writing.store(false);
+    for (std::thread& t : readers) {
+        t.join();
+    }
+    index.set_concurrent(false);
+
+    long settled = 0;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        settled += index.has_nearby_point(points[i], radius, filter) != upper[i];
+    }
+
+    std::cout << "quadtree: inserted " << streamlines.size() - half << " streamlines in " << insert_ms << "ms under "
+              << kBenchReaders << " readers, " << queries << " queries, " << wrong << " out of bounds, "
+              << settled << " differ after" << std::endl;
+
+    if (wrong || settled) {
+        std::cout << "  mismatch: concurrent readers saw a tree no sequential insert makes" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+
+//  SECTION: bench
+
+int run_spatial_bench(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport)
+{
+    TensorField tf;
+    add_bench_field(tf, viewport);
+
+    // end to end, the index is most of what generation waits on. each run
+    // gets a fresh generator so all see the same seeds.
+    const char* names[kBenchBackends] = {"quadtree", "hash grid", "linear quadtree"};
+    SpatialBackend backends[kBenchBackends] = {QuadTreeIndex, HashGridIndex, LinearQuadTreeIndex};
+    std::unique_ptr<RoadGenerator> generators[kBenchBackends];
+    int mismatches = 0;
+
+    for (int b = 0; b < kBenchBackends; ++b) {
+        std::unique_ptr<NumericalFieldIntegrator> integrator = std::make_unique<RK4>(&tf);
+        generators[b] = std::make_unique<RoadGenerator>(integrator, params, viewport);
+        generators[b]->set_spatial_backend(backends[b]);
+
+        bench_clock::time_point start = bench_clock::now();
+        generators[b]->generate();
+        double ms = elapsed_ms(start);
+
+        std::cout << names[b] << ": generate " << ms << "ms, "
+                  << generators[b]->node_count() << " nodes" << std::endl;
+    }
+
+    for (int b = 1; b < kBenchBackends; ++b) {
+        if (generators[0]->node_count() != generators[b]->node_count()) {
+            std::cout << "  mismatch: " << names[b] << " generated a different map" << std::endl;
+            ++mismatches;
+        }
+    }
+
+    RoadGenerator& generator = *generators[0];
+
+    // the map as the generator left it, indexed by every backend
+    NodeStore nodes;
+    for (int i = 0; i < generator.node_count(); ++i) {
+        nodes.push_back(generator.get_node(i));
+    }
+
+    std::vector<Streamline> streamlines = indexed_streamlines(generator);
+
+    std::vector<double> cell_sizes;
+    for (const auto& [_, p] : generator.get_parameters()) {
+        cell_sizes.push_back(p.d_test);
+    }
+
+    auto make_index = [&](int b) -> std::unique_ptr<SpatialIndex> {
+        switch (backends[b]) {
+            case HashGridIndex:
+                return std::make_unique<HashGrid>(&nodes, cell_sizes);
+            case LinearQuadTreeIndex:
+                return std::make_unique<LinearQuadtree>(&nodes, viewport, 16, 10);
+            case QuadTreeIndex:
+            default:
+                return std::make_unique<Spatial>(&nodes, viewport, generator.quadtree_cell_size(), 10);
+        }
+    };
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> ux(viewport.min.x, viewport.max.x);
+    std::uniform_real_distribution<double> uy(viewport.min.y, viewport.max.y);
+
+    std::vector<DVector2> points(kBenchQueries);
+    for (DVector2& p : points) {
+        p = {ux(rng), uy(rng)};
+    }
+
+    // a streamline at a time as generation does, and all at once as loading
+    // does. either way the index has to hold the same nodes
+    double widest = *std::max_element(cell_sizes.begin(), cell_sizes.end());
+    std::unique_ptr<SpatialIndex> indices[kBenchBackends];
+    for (int b = 0; b < kBenchBackends; ++b) {
+        indices[b] = make_index(b);
+        bench_clock::time_point start = bench_clock::now();
+        for (const Streamline& s : streamlines) {
+            indices[b]->insert_streamline(s);
+        }
+        double build_ms = elapsed_ms(start);
+
+        std::unique_ptr<SpatialIndex> loaded = make_index(b);
+        start = bench_clock::now();
+        loaded->insert_nodes(0, nodes.size());
+        double load_ms = elapsed_ms(start);
+
+        std::cout << names[b] << ": build " << build_ms << "ms, bulk " << load_ms << "ms" << std::endl;
+
+        long found[2] = {0, 0};
+        for (int i = 0; i < kBenchGatherQueries; ++i) {
+            found[0] += indices[b]->nearby_points(points[i], widest, Major | Minor).size();
+            found[1] += loaded->nearby_points(points[i], widest, Major | Minor).size();
+        }
+        if (found[0] != found[1]) {
+            std::cout << "  mismatch: bulk found " << found[1] << " of " << found[0] << std::endl;
+            ++mismatches;
+        }
+    }
+
+    for (RoadType road : generator.get_road_types()) {
+        const GeneratorParameters& p = generator.get_parameters().at(road);
+
+        for (double radius : {p.d_test, p.d_sep, p.d_lookahead}) {
+            long hits[kBenchBackends] = {};
+            long found[kBenchBackends] = {};
+
+            std::cout << "r=" << radius;
+
+            for (int b = 0; b < kBenchBackends; ++b) {
+                bench_clock::time_point start = bench_clock::now();
+                for (const DVector2& q : points) {
+                    hits[b] += indices[b]->has_nearby_point(q, radius, Major);
+                }
+                double has_ns = elapsed_ms(start)*1e6/kBenchQueries;
+
+                start = bench_clock::now();
+                for (int i = 0; i < kBenchGatherQueries; ++i) {
+                    found[b] += indices[b]->nearby_points(points[i], radius, Major | Minor).size();
+                }
+                double gather_ns = elapsed_ms(start)*1e6/kBenchGatherQueries;
+
+                std::cout << "  " << names[b] << " has " << has_ns << "ns, nearby " << gather_ns << "ns";
+            }
+            std::cout << std::endl;
+
+            for (int b = 1; b < kBenchBackends; ++b) {
+                if (hits[0] != hits[b] || found[0] != found[b]) {
+                    std::cout << "  mismatch: " << names[b] << " hits " << hits[0] << "/" << hits[b]
+                              << ", found " << found[0] << "/" << found[b] << std::endl;
+                    ++mismatches;
+                }
+            }
+        }
+    }
+
+    // tracing replayed: each streamline's nodes in order at its d_test, as
+    // extend_streamline asked, against only the streamlines that came before
+    // it. from the root, through one cursor per streamline, and as a batch.
+    struct Trace {
+        std::vector<DVector2> points;
+        double d_test;
+        SpatialFilter filter;
+    };
+
+    std::vector<Trace> traces;
+    std::size_t trace_queries = 0;
+    for (const Streamline& s : streamlines) {
+        if (s.size() < 2) continue;
+
+        StreamlineNode owner = nodes[*std::next(s.begin())];
+        Trace& t = traces.emplace_back();
+        t.d_test = generator.get_parameters().at(owner.road).d_test;
+        t.filter = SpatialFilter(owner.dir);
+        t.filter.max_streamline = owner.streamline_id - 1;
+
+        for (node_id id : s) {
+            t.points.push_back(nodes.pos(id));
+        }
+        trace_queries += s.size();
+    }
+
+    std::vector<bool> batch_hits;
+
+    auto run_traces = [&](const SpatialIndex& index, int method) {
+        long hits = 0;
+        for (const Trace& t : traces) {
+            if (method == 0) {
+                for (const DVector2& p : t.points) {
+                    hits += index.has_nearby_point(p, t.d_test, t.filter);
+                }
+            } else if (method == 1) {
+                SpatialCursor cursor;
+                for (const DVector2& p : t.points) {
+                    hits += index.has_nearby_point(p, t.d_test, t.filter, cursor);
+                }
+            } else {
+                index.has_nearby_points(t.points, t.d_test, t.filter, batch_hits);
+                for (bool hit : batch_hits) {
+                    hits += hit;
+                }
+            }
+        }
+        return hits;
+    };
+
+    for (int b = 0; b < kBenchBackends; ++b) {
+        long hits[3];
+        double ns[3];
+
+        for (int method = 0; method < 3; ++method) {
+            hits[method] = run_traces(*indices[b], method); // warm up
+
+            bench_clock::time_point start = bench_clock::now();
+            for (int rep = 0; rep < kBenchTraceRepeats; ++rep) {
+                run_traces(*indices[b], method);
+            }
+            ns[method] = elapsed_ms(start)*1e6/(trace_queries*kBenchTraceRepeats);
+        }
+
+        std::cout << names[b] << ": trace " << trace_queries << " queries, root " << ns[0] 
+                  << "ns, cursor " << ns[1] << "ns, batch " << ns[2] << "ns" << std::endl;
+
+        if (hits[0] != hits[1] || hits[0] != hits[2]) {
+            std::cout << "  mismatch: hits " << hits[0] << "/" << hits[1] << "/" << hits[2] << std::endl;
+            ++mismatches;
+        }
+    }
+
+    mismatches += check_cursor_removals(nodes, streamlines, viewport, generator.quadtree_cell_size());
+    mismatches += check_concurrent_readers(
+        nodes, streamlines, viewport, generator.quadtree_cell_size(),
+        std::span(points).first(kBenchGatherQueries), widest
+    );
+
+    // seeding: candidates are scattered, so the batch sorts them first
+    for (RoadType road : generator.get_road_types()) {
+        double d_sep = generator.get_parameters().at(road).d_sep;
+
+        for (int b = 0; b < kBenchBackends; ++b) {
+            long hits[2] = {0, 0};
+
+            indices[b]->has_nearby_points(points, d_sep, Major, batch_hits); // warm up
+
+            bench_clock::time_point start = bench_clock::now();
+            for (const DVector2& q : points) {
+                hits[0] += indices[b]->has_nearby_point(q, d_sep, Major);
+            }
+            double root_ns = elapsed_ms(start)*1e6/kBenchQueries;
+
+            start = bench_clock::now();
+            indices[b]->has_nearby_points(points, d_sep, Major, batch_hits);
+            double batch_ns = elapsed_ms(start)*1e6/kBenchQueries;
+            for (bool hit : batch_hits) {
+                hits[1] += hit;
+            }
+
+            std::cout << names[b] << ": seeds at r=" << d_sep << ", root " << root_ns << "ns, batch " << batch_ns << "ns" << std::endl;
+
+            if (hits[0] != hits[1]) {
+                std::cout << "  mismatch: hits " << hits[0] << "/" << hits[1] << std::endl;
+                ++mismatches;
+            }
+        }
+    }
+
+    mismatches += compare_precision(params, viewport, tf);
+    mismatches += compare_pipelined_spacing(params, viewport, tf);
+    mismatches += count_regeneration_allocations(params, viewport, tf);
+    mismatches += check_lazy_streamlines(params, viewport, tf);
+    mismatches += check_compressed_polylines(params, viewport, tf);
+    mismatches += check_snapshots(params, viewport, tf);
+
+    return mismatches ? 1 : 0;
+}
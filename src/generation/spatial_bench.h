@@ -0,0 +1,27 @@
+#ifndef SPATIAL_BENCH_H
+#define SPATIAL_BENCH_H
+
+#include <unordered_map>
+
+#include "../types.h"
+#include "generator.h"
+
+
+// generates a fixed map with each SpatialBackend and times them against each
+// other, both end to end and on the generator's own query radii, then replays
+// the map's streamlines as tracing queries with and without a SpatialCursor.
+// the map is traced in float as well, and measured against the double one,
+// then regenerated a few times over, counting allocations, kept as streamline
+// recipes and traced again, compressed, and last saved halfway and resumed.
+// prints to std::cout and returns non zero if any two answers disagree, the
+// float map breaks road spacing where the double one does not, regenerating
+// the map in batch still allocates once the generator has warmed up, a
+// replayed streamline differs, a compressed one does not decode to where its
+// nodes were, or a snapshot does not carry on or read back as its map.
+int run_spatial_bench(
+    const std::unordered_map<RoadType, GeneratorParameters>& params,
+    Box<double> viewport
+);
+
+
+#endif
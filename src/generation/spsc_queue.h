@@ -0,0 +1,74 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+
+// bounded lock-free ring buffer for exactly one producer and one consumer
+// thread. capacity is rounded up to a power of two.
+template<typename T>
+class SPSCQueue {
+private:
+    static constexpr std::size_t kCacheLine = 64;
+
+    std::vector<T> buffer_;
+    std::size_t mask_;
+
+    alignas(kCacheLine) std::atomic<std::size_t> head_ = 0; // next slot to pop
+    alignas(kCacheLine) std::atomic<std::size_t> tail_ = 0; // next slot to push
+
+    static std::size_t round_up(std::size_t n) {
+        std::size_t out = 1;
+        while (out < n) out <<= 1;
+        return out;
+    }
+
+public:
+    explicit SPSCQueue(std::size_t capacity) :
+        buffer_(round_up(capacity)),
+        mask_(buffer_.size() - 1)
+    {}
+
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    // producer only. false if the queue is full
+    bool push(T&& value) {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail - head_.load(std::memory_order_acquire) == buffer_.size()) {
+            return false;
+        }
+
+        buffer_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only. false if the queue is empty
+    bool pop(T& out) {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        out = std::move(buffer_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // approximate when called while the other side is running
+    std::size_t size() const {
+        return tail_.load(std::memory_order_acquire)
+            - head_.load(std::memory_order_acquire);
+    }
+
+    std::size_t capacity() const {
+        return buffer_.size();
+    }
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef STABLE_VECTOR_H
+#define STABLE_VECTOR_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+
+// growable array that never moves its elements. they live in fixed size
+// chunks reached through a directory allocated up front, so references stay
+// valid as it grows, and a reader on another thread can index anything the
+// writer published to it before growing it further.
+template<typename T, int ChunkBits = 12, std::size_t MaxChunks = 4096>
+class StableVector {
+public:
+    static constexpr std::size_t kChunkSize = std::size_t(1) << ChunkBits;
+    static constexpr std::size_t kMaxSize = kChunkSize*MaxChunks;
+
+private:
+    static constexpr std::size_t kChunkMask = kChunkSize - 1;
+
+    std::unique_ptr<std::unique_ptr<T[]>[]> chunks_;
+    std::size_t chunk_count_ = 0;     // allocated, kept across clear()
+    std::atomic<std::size_t> size_ = 0;
+
+    void reserve_chunks(std::size_t n) {
+        assert(n <= kMaxSize);
+        while (chunk_count_*kChunkSize < n) {
+            chunks_[chunk_count_++] = std::make_unique<T[]>(kChunkSize);
+        }
+    }
+
+public:
+    StableVector() :
+        chunks_(std::make_unique<std::unique_ptr<T[]>[]>(MaxChunks))
+    {}
+
+    StableVector(const StableVector&) = delete;
+    StableVector& operator=(const StableVector&) = delete;
+
+    T& operator[](std::size_t i) {
+        return chunks_[i >> ChunkBits][i & kChunkMask];
+    }
+
+    const T& operator[](std::size_t i) const {
+        return chunks_[i >> ChunkBits][i & kChunkMask];
+    }
+
+    std::size_t size() const {
+        return size_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void push_back(const T& value) {
+        std::size_t n = size_.load(std::memory_order_relaxed);
+        reserve_chunks(n + 1);
+        (*this)[n] = value;
+        size_.store(n + 1, std::memory_order_release);
+    }
+
+    T& emplace_back() {
+        std::size_t n = size_.load(std::memory_order_relaxed);
+        reserve_chunks(n + 1);
+        (*this)[n] = T{};
+        size_.store(n + 1, std::memory_order_release);
+        return (*this)[n];
+    }
+
+    // new elements hold whatever was there before, if anything
+    void resize(std::size_t n) {
+        reserve_chunks(n);
+        size_.store(n, std::memory_order_release);
+    }
+
+    // keeps the chunks for reuse, so nothing may be reading it
+    void clear() {
+        size_.store(0, std::memory_order_release);
+    }
+};
+
+
+#endif
@@ -3,26 +3,29 @@
 
 // ****** Tensor ******
 
-Tensor Tensor::from_a_b(const double& a, const double& b) {
-    Tensor out = Tensor {a, b};
+template<typename T>
+TTensor<T> TTensor<T>::from_a_b(const T& a, const T& b) {
+    TTensor out = TTensor {a, b};
     out.set_r_theta();
     return out;
 }
 
 
-void Tensor::set_r_theta() {
+template<typename T>
+void TTensor<T>::set_r_theta() {
     r = std::hypot(a, b);
     if (is_degenerate()) {
         theta = 0;
     }
     else {
-        theta = std::atan2(b/r, a/r)/2.0;
+        theta = std::atan2(b/r, a/r)/T(2);
     }
 }
 
 
-Tensor Tensor::from_r_theta(const double& r, const double& theta) {
-    return Tensor {
+template<typename T>
+TTensor<T> TTensor<T>::from_r_theta(const T& r, const T& theta) {
+    return TTensor {
         r*std::cos(2*theta),
         r*std::sin(2*theta),
         r,
@@ -31,21 +34,24 @@ Tensor Tensor::from_r_theta(const double& r, const double& theta) {
 }
 
 
-Tensor Tensor::from_xy(const DVector2& xy) {
-    const double& x = xy.x;
-    const double& y = xy.y;
+template<typename T>
+TTensor<T> TTensor<T>::from_xy(const TVector2<T>& xy) {
+    const T& x = xy.x;
+    const T& y = xy.y;
 
     return from_a_b(y*y - x*x, -2*x*y);
 }
 
 
-bool Tensor::is_degenerate() const {
-    return std::abs(r) <= d_epsilon;
+template<typename T>
+bool TTensor<T>::is_degenerate() const {
+    return std::abs(r) <= epsilon;
 }
 
 
 
-DVector2 Tensor::get_major_eigenvector() const {
+template<typename T>
+TVector2<T> TTensor<T>::get_major_eigenvector() const {
     if (is_degenerate()) return {0.0, 0.0};
 
     return {
@@ -54,91 +60,104 @@ DVector2 Tensor::get_major_eigenvector() const {
     };
 }
 
-DVector2 Tensor::get_minor_eigenvector() const {
+template<typename T>
+TVector2<T> TTensor<T>::get_minor_eigenvector() const {
     if (is_degenerate()) return {0.0, 0.0};
     return {
         std::sin(theta),
-        std::cos(theta)*-1.0
+        std::cos(theta)*T(-1)
     };
 }
 
 
-Tensor Tensor::rotate(const double& angle) const {
-    return Tensor::from_r_theta(
+template<typename T>
+TTensor<T> TTensor<T>::rotate(const T& angle) const {
+    return TTensor::from_r_theta(
         r,
         std::fmodf(theta + angle, 2.0f*M_PI)
     );
 }
 
 
-Tensor Tensor::operator+(const Tensor& other) const {
-    return Tensor(a + other.a, b + other.b);
+template<typename T>
+TTensor<T> TTensor<T>::operator+(const TTensor& other) const {
+    return TTensor(a + other.a, b + other.b);
 }
 
 
-Tensor Tensor::operator*(const double& right) const {
-    return Tensor(right*a, right*b);
+template<typename T>
+TTensor<T> TTensor<T>::operator*(const T& right) const {
+    return TTensor(right*a, right*b);
 }
 
 
-Tensor operator*(double left, const Tensor& right) {
-    return Tensor(left*right.a, left*right.b);
+template<typename T>
+TTensor<T> operator*(const T& left, const TTensor<T>& right) {
+    return TTensor<T>(left*right.a, left*right.b);
 }
 
 
 
 // ****** BasisField ******
 
-BasisField::BasisField(DVector2 centre) 
+template<typename T>
+TBasisField<T>::TBasisField(TVector2<T> centre)
     : centre_(centre), size_(0), decay_(0) {}
 
 
-BasisField::BasisField(DVector2 centre, double size, double decay) 
+template<typename T>
+TBasisField<T>::TBasisField(TVector2<T> centre, T size, T decay)
     : centre_(centre), size_(size), decay_(decay) {}
 
 
-const DVector2& BasisField::get_centre() const {
+template<typename T>
+const TVector2<T>& TBasisField<T>::get_centre() const {
     return centre_;
 }
 
 
-void BasisField::set_centre(DVector2 centre) {
+template<typename T>
+void TBasisField<T>::set_centre(TVector2<T> centre) {
     centre_ = centre;
 }
 
-void BasisField::set_size(double size) {
+template<typename T>
+void TBasisField<T>::set_size(T size) {
     size_ = size;
 }
 
-void BasisField::set_decay(double decay) {
+template<typename T>
+void TBasisField<T>::set_decay(T decay) {
     decay_ = decay;
 }
 
 
-bool BasisField::force_degenerate(const DVector2& pos) {
+template<typename T>
+bool TBasisField<T>::force_degenerate(const TVector2<T>& pos) {
     return false;
 }
 
 
-double BasisField::get_tensor_weight(const DVector2& pos) const {
+template<typename T>
+T TBasisField<T>::get_tensor_weight(const TVector2<T>& pos) const {
     if (size_ == 0) {
         return 1;
     }
 
-    DVector2 from_centre = pos - centre_;
-    double norm_dist_to_centre =
+    TVector2<T> from_centre = pos - centre_;
+    T norm_dist_to_centre =
         std::hypot(from_centre.x, from_centre.y) / size_;
-    
+
     if (decay_ == 0 && norm_dist_to_centre >= 1 ) {
         return 0;
     }
-    
-    double out = std::pow(
-        std::max(0.0, 1.0-norm_dist_to_centre),
+
+    T out = std::pow(
+        std::max(T(0), T(1)-norm_dist_to_centre),
         decay_
     );
 
-    if (std::abs(out) < d_epsilon) {
+    if (std::abs(out) < TTensor<T>::epsilon) {
         return 0;
     }
 
@@ -146,43 +165,74 @@ double BasisField::get_tensor_weight(const DVector2& pos) const {
 }
 
 
-Tensor BasisField::get_weighted_tensor(const DVector2& pos) const {
+template<typename T>
+TTensor<T> TBasisField<T>::get_weighted_tensor(const TVector2<T>& pos) const {
     return get_tensor(pos)*get_tensor_weight(pos);
 }
 
 
 
 // ****** BasisField : Grid ******
-Grid::Grid(double _theta, DVector2 _centre) 
-    : BasisField(_centre), theta(_theta) {}
+template<typename T>
+TGrid<T>::TGrid(T _theta, TVector2<T> _centre)
+    : TBasisField<T>(_centre), theta(_theta) {}
+
+template<typename T>
+TGrid<T>::TGrid(T _theta, TVector2<T> _centre, T _size, T _decay)
+    : TBasisField<T>(_centre, _size, _decay), theta(_theta) {}
 
-Grid::Grid(double _theta, DVector2 _centre, double _size, double _decay) 
-    : BasisField(_centre, _size, _decay), theta(_theta) {}
+
+template<typename T>
+std::unique_ptr<TBasisField<float>> TGrid<T>::clone_float() const {
+    return std::make_unique<TGrid<float>>(theta, FVector2(this->centre_), this->size_, this->decay_);
+}
 
 
-void Grid::set_theta(double _theta) {
+template<typename T>
+std::unique_ptr<TBasisField<double>> TGrid<T>::clone_double() const {
+    return std::make_unique<TGrid<double>>(theta, DVector2(this->centre_), this->size_, this->decay_);
+}
+
+
+template<typename T>
+void TGrid<T>::set_theta(T _theta) {
     theta = _theta;
 }
 
 
-Tensor Grid::get_tensor(const DVector2& pos) const {
-    return Tensor::from_r_theta(1, theta);
+template<typename T>
+TTensor<T> TGrid<T>::get_tensor(const TVector2<T>& pos) const {
+    return TTensor<T>::from_r_theta(1, theta);
 }
 
 
 
 // ****** BasisField : Radial ******
 
-Radial::Radial(DVector2 _centre) 
-    : BasisField(_centre) {}
+template<typename T>
+TRadial<T>::TRadial(TVector2<T> _centre)
+    : TBasisField<T>(_centre) {}
+
+template<typename T>
+TRadial<T>::TRadial(TVector2<T> _centre, T _size, T _decay)
+    : TBasisField<T>(_centre, _size, _decay) {}
+
+
+template<typename T>
+std::unique_ptr<TBasisField<float>> TRadial<T>::clone_float() const {
+    return std::make_unique<TRadial<float>>(FVector2(this->centre_), this->size_, this->decay_);
+}
 
-Radial::Radial(DVector2 _centre, double _size, double _decay) 
-    : BasisField(_centre, _size, _decay) {}
 
+template<typename T>
+std::unique_ptr<TBasisField<double>> TRadial<T>::clone_double() const {
+    return std::make_unique<TRadial<double>>(DVector2(this->centre_), this->size_, this->decay_);
+}
 
 
-Tensor Radial::get_tensor(const DVector2& pos) const {
-    return Tensor::from_xy(pos - centre_);
+template<typename T>
+TTensor<T> TRadial<T>::get_tensor(const TVector2<T>& pos) const {
+    return TTensor<T>::from_xy(pos - this->centre_);
 }
 
 
@@ -190,28 +240,46 @@ Tensor Radial::get_tensor(const DVector2& pos) const {
 // ****** TensorField ******
 
 
-TensorField::TensorField() {}
+template<typename T>
+TTensorField<T>::TTensorField() {}
 
 
-void TensorField::clear() {
+template<typename T>
+void TTensorField<T>::clear() {
     basis_fields.clear();
 }
 
 
-TensorField::TensorField(std::vector<std::unique_ptr<BasisField>>&& _basis_fields) 
+template<typename T>
+TTensorField<T>::TTensorField(std::vector<std::unique_ptr<TBasisField<T>>>&& _basis_fields)
     : basis_fields(std::move(_basis_fields)) {}
 
 
-void TensorField::add_basis_field(std::unique_ptr<BasisField> bf) {
+template<typename T>
+void TTensorField<T>::add_basis_field(std::unique_ptr<TBasisField<T>> bf) {
     basis_fields.push_back(std::move(bf));
 }
 
 
-Tensor TensorField::sample(const DVector2& pos) const {
-    Tensor out; // new degenerate tensor
+template<typename T>
+std::shared_ptr<const TTensorField<T>> TTensorField<T>::snapshot() const {
+    std::vector<std::unique_ptr<TBasisField<T>>> copies;
+    copies.reserve(basis_fields.size());
+
+    for (auto& basis : basis_fields) {
+        copies.push_back(basis->clone());
+    }
+
+    return std::make_shared<const TTensorField>(std::move(copies));
+}
+
+
+template<typename T>
+TTensor<T> TTensorField<T>::sample(const TVector2<T>& pos) const {
+    TTensor<T> out{}; // new degenerate tensor
 
     for (auto& x : basis_fields) {
-        Tensor basis_field_tensor = x->get_weighted_tensor(pos);
+        TTensor<T> basis_field_tensor = x->get_weighted_tensor(pos);
         out = out + basis_field_tensor;
     }
 
@@ -221,11 +289,26 @@ Tensor TensorField::sample(const DVector2& pos) const {
 }
 
 
-std::vector<DVector2> TensorField::get_basis_centres() const {
-    std::vector<DVector2> out;
+template<typename T>
+std::vector<TVector2<T>> TTensorField<T>::get_basis_centres() const {
+    std::vector<TVector2<T>> out;
     for (auto& basis : basis_fields) {
         out.push_back(basis->get_centre());
     }
 
     return out;
 }
+
+
+template struct TTensor<float>;
+template struct TTensor<double>;
+template TTensor<float> operator*(const float&, const TTensor<float>&);
+template TTensor<double> operator*(const double&, const TTensor<double>&);
+template class TBasisField<float>;
+template class TBasisField<double>;
+template class TGrid<float>;
+template class TGrid<double>;
+template class TRadial<float>;
+template class TRadial<double>;
+template class TTensorField<float>;
+template class TTensorField<double>;
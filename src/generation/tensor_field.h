@@ -1,106 +1,155 @@
 #pragma once
 
 #include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 #include "../types.h"
 
-static constexpr double d_epsilon = std::numeric_limits<double>::epsilon();
+// everything here is templated on the scalar type, instantiated for float
+// and double in tensor_field.cpp. the plain names are the double ones
+
+template<typename T>
+struct TTensor {
+    static constexpr T epsilon = std::numeric_limits<T>::epsilon();
 
-struct Tensor {
     // 2x2 symmetric, traceless matrix represented as
     // R * | cos(2θ)  sin(2θ) | --> | a  b |
     //     | sin(2θ) -cos(2θ) |     | _  _ |
-    double a;
-    double b;
-    double r;
-    double theta;
+    T a;
+    T b;
+    T r;
+    T theta;
 
-    static Tensor from_a_b(const double& a, const double& b);
-    static Tensor from_r_theta(const double& r, const double& theta);
-    static Tensor from_xy(const DVector2& xy);
+    static TTensor from_a_b(const T& a, const T& b);
+    static TTensor from_r_theta(const T& r, const T& theta);
+    static TTensor from_xy(const TVector2<T>& xy);
 
     void set_r_theta();
 
     bool is_degenerate() const;
-    DVector2 get_major_eigenvector() const;
-    DVector2 get_minor_eigenvector() const;
+    TVector2<T> get_major_eigenvector() const;
+    TVector2<T> get_minor_eigenvector() const;
 
-    Tensor rotate(const double& angle) const;
+    TTensor rotate(const T& angle) const;
 
-    Tensor operator+(const Tensor& other) const;
+    TTensor operator+(const TTensor& other) const;
 
     // right scalar mult
-    Tensor operator*(const double& right) const;
+    TTensor operator*(const T& right) const;
 
 
     // left scalar mult
-    friend Tensor operator*(const double& left, const Tensor& right);
+    template<typename U>
+    friend TTensor<U> operator*(const U& left, const TTensor<U>& right);
 };
 
 
-class BasisField {
+template<typename T>
+class TBasisField {
     protected:
-        DVector2 centre_;
-        double size_;
-        double decay_;
+        TVector2<T> centre_;
+        T size_;
+        T decay_;
 
-        virtual Tensor get_tensor(const DVector2& pos) const = 0;
-        virtual bool force_degenerate(const DVector2& pos);
-        double get_tensor_weight(const DVector2& pos) const;
+        virtual TTensor<T> get_tensor(const TVector2<T>& pos) const = 0;
+        virtual bool force_degenerate(const TVector2<T>& pos);
+        T get_tensor_weight(const TVector2<T>& pos) const;
 
     public:
-        BasisField(DVector2 centre);
-        BasisField(DVector2 centre, double size, double decay);
-        virtual ~BasisField() = default;
+        TBasisField(TVector2<T> centre);
+        TBasisField(TVector2<T> centre, T size, T decay);
+        virtual ~TBasisField() = default;
+
+        // copies at either precision, so a float field can be made from
+        // the double one being edited
+        virtual std::unique_ptr<TBasisField<float>> clone_float() const = 0;
+        virtual std::unique_ptr<TBasisField<double>> clone_double() const = 0;
+
+        template<typename U>
+        std::unique_ptr<TBasisField<U>> clone_as() const {
+            if constexpr (std::is_same_v<U, float>) return clone_float();
+            else return clone_double();
+        }
 
-        const DVector2& get_centre() const;
-        void set_centre(DVector2 centre);
-        void set_size(double size);
-        void set_decay(double decay);
+        std::unique_ptr<TBasisField> clone() const { return clone_as<T>(); }
 
+        const TVector2<T>& get_centre() const;
+        void set_centre(TVector2<T> centre);
+        void set_size(T size);
+        void set_decay(T decay);
 
-        Tensor get_weighted_tensor(const DVector2& pos) const;
+
+        TTensor<T> get_weighted_tensor(const TVector2<T>& pos) const;
 };
 
 
-class Grid : public BasisField {
+template<typename T>
+class TGrid : public TBasisField<T> {
     private:
-        double theta;
+        T theta;
 
 
     public:
-        Grid(double theta, DVector2 centre);
-        Grid(double theta, DVector2 centre, double size, double decay);
+        TGrid(T theta, TVector2<T> centre);
+        TGrid(T theta, TVector2<T> centre, T size, T decay);
 
-        Tensor get_tensor(const DVector2& pos) const override;
-        void set_theta(double _theta);
+        std::unique_ptr<TBasisField<float>> clone_float() const override;
+        std::unique_ptr<TBasisField<double>> clone_double() const override;
+        TTensor<T> get_tensor(const TVector2<T>& pos) const override;
+        void set_theta(T _theta);
 };
 
-class Radial : public BasisField {
+template<typename T>
+class TRadial : public TBasisField<T> {
     public:
-        Radial(DVector2 centre);
-        Radial(DVector2 centre, double size, double decay);
+        TRadial(TVector2<T> centre);
+        TRadial(TVector2<T> centre, T size, T decay);
 
+        std::unique_ptr<TBasisField<float>> clone_float() const override;
+        std::unique_ptr<TBasisField<double>> clone_double() const override;
 
-        Tensor get_tensor(const DVector2& pos) const override;
+        TTensor<T> get_tensor(const TVector2<T>& pos) const override;
 };
 
 
-class TensorField {
+template<typename T>
+class TTensorField {
     private:
-        std::vector<std::unique_ptr<BasisField>> basis_fields;
+        template<typename U>
+        friend class TTensorField;
+
+        std::vector<std::unique_ptr<TBasisField<T>>> basis_fields;
 
     public:
-        TensorField();
+        TTensorField();
         void clear();
         
-        TensorField(std::vector<std::unique_ptr<BasisField>>&& _basis_fields);
+        TTensorField(std::vector<std::unique_ptr<TBasisField<T>>>&& _basis_fields);
 
-        void add_basis_field(std::unique_ptr<BasisField> ptr);
-        
+        // deep copy at another precision
+        template<typename U>
+        explicit TTensorField(const TTensorField<U>& other) {
+            for (auto& basis : other.basis_fields) {
+                basis_fields.push_back(basis->template clone_as<T>());
+            }
+        }
+
+        void add_basis_field(std::unique_ptr<TBasisField<T>> ptr);
+
+        // deep copy that generation can keep sampling while this field is edited
+        std::shared_ptr<const TTensorField> snapshot() const;
 
-        Tensor sample(const DVector2& pos) const;
-        std::vector<DVector2> get_basis_centres() const;
+        TTensor<T> sample(const TVector2<T>& pos) const;
+        std::vector<TVector2<T>> get_basis_centres() const;
 };
 
 
+using Tensor = TTensor<double>;
+using BasisField = TBasisField<double>;
+using Grid = TGrid<double>;
+using Radial = TRadial<double>;
+using TensorField = TTensorField<double>;
+
+
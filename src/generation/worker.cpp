@@ -0,0 +1,65 @@
+#include "worker.h"
+
+#include "integrator.h"
+
+
+GenerationWorker::GenerationWorker(
+        const TensorField& field,
+        const std::unordered_map<RoadType, GeneratorParameters>& params,
+        Box<double> viewport
+    ) :
+    field_(field.snapshot()),
+    queue_(kQueueCapacity)
+{
+    std::unique_ptr<NumericalFieldIntegrator> integrator =
+        std::make_unique<RK4>(field_.get());
+
+    generator_ = std::make_unique<RoadGenerator>(integrator, params, viewport);
+
+    thread_ = std::thread(&GenerationWorker::run, this);
+}
+
+
+GenerationWorker::~GenerationWorker() {
+    cancel();
+    if (thread_.joinable()) thread_.join();
+}
+
+
+void GenerationWorker::run() {
+    while (!cancelled_.load(std::memory_order_relaxed)) {
+        std::optional<CommittedStreamline> committed = generator_->generation_step();
+        if (!committed.has_value()) break;
+
+        const CommittedStreamline& c = committed.value();
+        PublishedStreamline out {
+            c.road,
+            c.dir,
+            c.index,
+            generator_->get_polyline(c.road, c.dir, c.index)
+        };
+
+        // back off while the renderer catches up
+        while (!queue_.push(std::move(out))) {
+            if (cancelled_.load(std::memory_order_relaxed)) return;
+            std::this_thread::yield();
+        }
+    }
+
+    finished_.store(true, std::memory_order_release);
+}
+
+
+void GenerationWorker::cancel() {
+    cancelled_.store(true, std::memory_order_relaxed);
+}
+
+
+bool GenerationWorker::finished() const {
+    return finished_.load(std::memory_order_acquire);
+}
+
+
+bool GenerationWorker::poll(PublishedStreamline& out) {
+    return queue_.pop(out);
+}
@@ -0,0 +1,62 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../types.h"
+#include "generator.h"
+#include "spsc_queue.h"
+#include "tensor_field.h"
+
+
+// copy of a committed streamline, safe to hand to another thread. a
+// streamline is published again with its full polyline once it is joined.
+struct PublishedStreamline {
+    RoadType road;
+    Direction dir;
+    int index;
+    std::vector<DVector2> points;
+};
+
+
+// runs the generation pipeline on its own thread against a snapshot of the
+// tensor field, publishing streamlines to a single consumer as they commit.
+class GenerationWorker {
+private:
+    static constexpr int kQueueCapacity = 1024;
+
+    std::shared_ptr<const TensorField> field_;
+    std::unique_ptr<RoadGenerator> generator_;
+
+    SPSCQueue<PublishedStreamline> queue_;
+    std::atomic<bool> cancelled_ = false;
+    std::atomic<bool> finished_ = false;
+    std::thread thread_;
+
+    void run();
+
+public:
+    GenerationWorker(
+        const TensorField& field,
+        const std::unordered_map<RoadType, GeneratorParameters>& params,
+        Box<double> viewport
+    );
+    ~GenerationWorker();
+
+    GenerationWorker(const GenerationWorker&) = delete;
+    GenerationWorker& operator=(const GenerationWorker&) = delete;
+
+    void cancel();
+
+    // true once everything has been published, check before draining
+    bool finished() const;
+
+    // consumer side, false when there is nothing new
+    bool poll(PublishedStreamline& out);
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include "ui.h"
 
 #include "generation/generator.h"
+#include "generation/spatial_bench.h"
 #include "generation/tensor_field.h"
 
 #include "const.h"
@@ -33,6 +34,10 @@ int main(int argc, char** argv)
         Box({0.0, 0.0}, DVector2(SCREEN_WIDTH, SCREEN_HEIGHT))
     };
 
+#ifdef SPATIAL_BENCH
+    return run_spatial_bench(params, ctx.viewport);
+#endif
+
 
     TensorField tf;
     std::unique_ptr<NumericalFieldIntegrator> itg =
@@ -94,6 +99,7 @@ int main(int argc, char** argv)
             } EndDrawing(); ctx.is_drawing = false;
         }
 
+        renderer.release_meshes();
         CloseWindow();
 
         return 0;
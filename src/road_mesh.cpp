@@ -0,0 +1,173 @@
+#include "road_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "raymath.h"
+#include "rlgl.h"
+
+
+static constexpr float f_epsilon = std::numeric_limits<float>::epsilon();
+
+// corners sharper than this are cut short rather than mitred out to a spike
+static constexpr float kMinMiterCos = 0.5f;
+
+
+//  SECTION: tessellation
+
+static Vector2 segment_normal(const Vector2& a, const Vector2& b) {
+    Vector2 d = {b.x - a.x, b.y - a.y};
+    float l = std::hypot(d.x, d.y);
+    return {-d.y/l, d.x/l};
+}
+
+
+void tessellate_polyline(const std::vector<Vector2>& polyline, float width, std::vector<Vector2>& out) {
+    // repeated points have no direction to offset from
+    std::vector<Vector2> points;
+    points.reserve(polyline.size());
+    for (const Vector2& p : polyline) {
+        if (points.empty() || p.x != points.back().x || p.y != points.back().y) {
+            points.push_back(p);
+        }
+    }
+    if (points.size() < 2) return;
+
+    float half = width/2.0f;
+    std::size_t n = points.size();
+
+    // each side of the line at every point
+    std::vector<Vector2> left(n), right(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        Vector2 offset;
+        if (i == 0) {
+            offset = Vector2Scale(segment_normal(points[0], points[1]), half);
+        } else if (i == n - 1) {
+            offset = Vector2Scale(segment_normal(points[n-2], points[n-1]), half);
+        } else {
+            Vector2 before = segment_normal(points[i-1], points[i]);
+            Vector2 after = segment_normal(points[i], points[i+1]);
+            Vector2 miter = Vector2Add(before, after);
+            float l = std::hypot(miter.x, miter.y);
+
+            if (l < f_epsilon) {
+                offset = Vector2Scale(after, half); // doubles straight back
+            } else {
+                miter = Vector2Scale(miter, 1.0f/l);
+                float cos = std::max(Vector2DotProduct(miter, after), kMinMiterCos);
+                offset = Vector2Scale(miter, half/cos);
+            }
+        }
+
+        left[i] = Vector2Add(points[i], offset);
+        right[i] = Vector2Subtract(points[i], offset);
+    }
+
+    for (std::size_t i = 0; i + 1 < n; ++i) {
+        out.insert(out.end(), {
+            left[i], right[i], left[i+1],
+            left[i+1], right[i], right[i+1]
+        });
+    }
+}
+
+
+
+//  SECTION: RoadMesh
+
+RoadMesh::RoadMesh(Color colour, float width, Color outline_colour, float outline_width) :
+    colour_(colour),
+    outline_colour_(outline_colour),
+    width_(width),
+    outline_width_(outline_width)
+{}
+
+
+RoadMesh::~RoadMesh() {
+    unload();
+    if (material_) UnloadMaterial(material_.value());
+}
+
+
+void RoadMesh::set(Direction dir, int index, const std::vector<Vector2>& polyline) {
+    std::vector<Tessellated>& sls = streamlines_[dir];
+    if (sls.size() <= index) {
+        sls.resize(index + 1);
+    }
+
+    Tessellated& t = sls[index];
+    t.outline.clear();
+    t.fill.clear();
+    tessellate_polyline(polyline, width_ + outline_width_, t.outline);
+    tessellate_polyline(polyline, width_, t.fill);
+
+    dirty_ = true;
+}
+
+
+void RoadMesh::unload() {
+    // UnloadMesh frees the vertex arrays as well
+    if (outline_) UnloadMesh(outline_.value());
+    if (fill_) UnloadMesh(fill_.value());
+    outline_.reset();
+    fill_.reset();
+}
+
+
+// every streamline's triangles into one mesh per layer, owned by raylib
+void RoadMesh::upload() {
+    unload();
+
+    auto build = [this](std::vector<Vector2> Tessellated::* layer, Color colour) -> std::optional<Mesh> {
+        std::size_t count = 0;
+        for (const auto& [_, sls] : streamlines_) {
+            for (const Tessellated& t : sls) {
+                count += (t.*layer).size();
+            }
+        }
+        if (count == 0) return {};
+
+        Mesh mesh = {0};
+        mesh.vertexCount = count;
+        mesh.triangleCount = count/3;
+        mesh.vertices = static_cast<float*>(MemAlloc(count*3*sizeof(float)));
+        mesh.colors = static_cast<unsigned char*>(MemAlloc(count*4*sizeof(unsigned char)));
+
+        std::size_t v = 0;
+        for (const auto& [_, sls] : streamlines_) {
+            for (const Tessellated& t : sls) {
+                for (const Vector2& p : t.*layer) {
+                    mesh.vertices[3*v] = p.x;
+                    mesh.vertices[3*v + 1] = p.y;
+                    mesh.vertices[3*v + 2] = 0.0f;
+                    std::memcpy(mesh.colors + 4*v, &colour, 4);
+                    ++v;
+                }
+            }
+        }
+
+        UploadMesh(&mesh, false);
+        return mesh;
+    };
+
+    outline_ = build(&Tessellated::outline, outline_colour_);
+    fill_ = build(&Tessellated::fill, colour_);
+    dirty_ = false;
+}
+
+
+void RoadMesh::draw() {
+    if (!material_) material_ = LoadMaterialDefault();
+    if (dirty_) upload();
+
+    // whatever is batched so far goes under the roads
+    rlDrawRenderBatchActive();
+
+    // the 2d camera flips y, and with it which way the triangles wind
+    rlDisableBackfaceCulling();
+    if (outline_) DrawMesh(outline_.value(), material_.value(), MatrixIdentity());
+    if (fill_) DrawMesh(fill_.value(), material_.value(), MatrixIdentity());
+    rlEnableBackfaceCulling();
+}
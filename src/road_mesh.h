@@ -0,0 +1,60 @@
+#ifndef ROAD_MESH_H
+#define ROAD_MESH_H
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "raylib.h"
+
+#include "generation/integrator.h"
+
+
+// one road type's streamlines as triangles, its outlines under its fills.
+// each streamline is tessellated once, when it is set, and the meshes are
+// put back together and uploaded from those at most once a frame, when
+// something changed. drawing the finished map is two draw calls per road
+// type whatever its size. the meshes live on the gpu, so one has to go
+// before the window does
+class RoadMesh {
+private:
+    struct Tessellated {
+        std::vector<Vector2> outline; // triangles
+        std::vector<Vector2> fill;
+    };
+
+    Color colour_;
+    Color outline_colour_;
+    float width_;
+    float outline_width_;
+
+    std::unordered_map<Direction, std::vector<Tessellated>> streamlines_;
+    bool dirty_ = false;
+
+    std::optional<Mesh> outline_;
+    std::optional<Mesh> fill_;
+    std::optional<Material> material_;
+
+    void upload();
+    void unload();
+
+public:
+    RoadMesh(Color colour, float width, Color outline_colour, float outline_width);
+    RoadMesh(const RoadMesh&) = delete;
+    RoadMesh& operator=(const RoadMesh&) = delete;
+    ~RoadMesh();
+
+    // sets, or replaces once its ends are joined, get_streamlines(road, dir)[index]
+    void set(Direction dir, int index, const std::vector<Vector2>& polyline);
+
+    // in 2d mode
+    void draw();
+};
+
+
+// a thick line along polyline as triangles appended to out, mitred at the
+// corners. what DrawSplineLinear would draw
+void tessellate_polyline(const std::vector<Vector2>& polyline, float width, std::vector<Vector2>& out);
+
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef TYPES_H 
 #define TYPES_H 
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <limits>
@@ -21,6 +22,13 @@ struct TVector2 {
         y(static_cast<double>(v.y)) 
     {}
 
+    // between scalar types, like float and double pipelines
+    template<typename U>
+    explicit TVector2(const TVector2<U>& v) :
+        x(static_cast<T>(v.x)),
+        y(static_cast<T>(v.y))
+    {}
+
     operator Vector2() const {
         return Vector2 {
             static_cast<float>(x),
@@ -49,16 +57,16 @@ struct TVector2 {
     template<typename U>
     TVector2 operator*(const U& scalar) const {
         return {
-            scalar*x,
-            scalar*y
+            static_cast<T>(scalar*x),
+            static_cast<T>(scalar*y)
         };
     };
 
     template<typename U>
     TVector2 operator/(const U& scalar) const {
         return {
-            x/scalar,
-            y/scalar
+            static_cast<T>(x/scalar),
+            static_cast<T>(y/scalar)
         };
     }
 
@@ -77,6 +85,13 @@ T dot_product(const TVector2<T>& a, const TVector2<T>& b) {
 }
 
 
+// z of the 3d cross product, positive if b is anticlockwise of a
+template<typename T>
+T cross_product(const TVector2<T>& a, const TVector2<T>& b) {
+    return a.x*b.y - a.y*b.x;
+}
+
+
 template<typename T>
 TVector2<T> middle(TVector2<T> const& p1, TVector2<T> const& p2) {
     return (p1 + p2)/2.0;
@@ -133,9 +148,15 @@ struct Box {
         max(_max)
     {}
 
+    template<typename U>
+    explicit Box(const Box<U>& other) :
+        min(other.min),
+        max(other.max)
+    {}
+
     bool is_empty() const {
         return min.x >= max.x
-            && min.y >= max.y;
+            || min.y >= max.y;
     }
 
     bool contains(const TVector2<T>& vec) const {
@@ -146,6 +167,13 @@ struct Box {
             && vec.y < max.y;
     }
 
+    // squared distance from vec to the nearest point of the box, 0 inside
+    T distance2(const TVector2<T>& vec) const {
+        T dx = std::max({min.x - vec.x, T(0), vec.x - max.x});
+        T dy = std::max({min.y - vec.y, T(0), vec.y - max.y});
+        return dx*dx + dy*dy;
+    }
+
     T width() const {
         return max.x - min.x;
     }
@@ -155,7 +183,7 @@ struct Box {
     }
 
     std::tuple<Box, Box, Box, Box> // TL TR BL BR
-    quadrants() {
+    quadrants() const {
         TVector2<T> mid = middle(min, max);
 
         return {
@@ -167,7 +195,7 @@ struct Box {
     }
 
 
-    Box get_quadrant(Quadrant q) {
+    Box get_quadrant(Quadrant q) const {
         TVector2<T> mid = middle(min, max);
         switch (q) {
             case TopLeft:
@@ -181,7 +209,7 @@ struct Box {
         }
     }
 
-    Quadrant which_quadrant(TVector2<T> pos) {
+    Quadrant which_quadrant(TVector2<T> pos) const {
         TVector2<T> mid = middle(min, max);
 
         for (Quadrant q : {TopLeft, TopRight, BottomLeft, BottomRight}) {
@@ -318,6 +346,7 @@ public:
 
 // useful type aliases
 using DVector2 = TVector2<double>;
+using FVector2 = TVector2<float>;
 using IVector2 = TVector2<int>;
 
 #endif
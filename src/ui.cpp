@@ -144,10 +144,10 @@ void Renderer::test_spatial() {
         Color col = BLACK;
 
         std::list<node_id> majors = 
-            generator_ptr_->spatial_.nearby_points(ctx_.mouse_world_pos, 100, Major);
+            generator_ptr_->spatial_->nearby_points(ctx_.mouse_world_pos, 100, Major);
         
         std::list<node_id> minors =
-            generator_ptr_->spatial_.nearby_points(ctx_.mouse_world_pos, 100, Minor);
+            generator_ptr_->spatial_->nearby_points(ctx_.mouse_world_pos, 100, Minor);
 
         int a = majors.size();
         int b = minors.size();
@@ -196,22 +196,22 @@ void Renderer::test_spatial() {
     }
 }
 
-void Renderer::test_draw_spatial(qnode_id head_ptr) {
-    auto& s = generator_ptr_->spatial_;
+void Renderer::test_draw_spatial(qnode_id head_ptr, Box<double> bbox) {
+    auto& s = static_cast<Spatial&>(*generator_ptr_->spatial_);
 
     if (head_ptr == QNullNode) return;
     QuadNode node = s.qnodes_[head_ptr];
 
-    Box<double> bbox = node.bbox;
     Vector2 pos = bbox.min;
 
     Color col = BLACK;
 
-    if (node.dirs & Major && node.dirs & Minor) {
+    char dirs = road_dirs(node.summary.roads);
+    if (dirs & Major && dirs & Minor) {
         col = GREEN;
-    } else if (node.dirs & Major) {
+    } else if (dirs & Major) {
         col = RED;
-    } else if (node.dirs & Minor) {
+    } else if (dirs & Minor) {
         col = BLUE;
     }
     Vector2 dims = bbox.max - bbox.min;
@@ -221,74 +221,53 @@ void Renderer::test_draw_spatial(qnode_id head_ptr) {
     DrawRectangleLinesEx(rect, 2.0f, col);
 
     if (s.is_leaf(head_ptr)) {
-        for (auto id: node.data) {
-            std::optional<StreamlineNode> n = generator_ptr_->get_node(id);
-            assert(n);
-            DrawCircleV(n.value().pos, 1.0, n.value().dir == Major ? RED : BLUE);
+        for (std::uint32_t i = node.block; i < node.block + node.size; ++i) {
+            LeafEntry e = s.leaves_.get(i);
+            DrawCircleV(e.pos, 1.0, road_dirs(e.roads) == Major ? RED : BLUE);
         }
     }
     else {
         for (auto q : {TopLeft, TopRight, BottomLeft, BottomRight}) {
-            test_draw_spatial(node.children[q]);
+            test_draw_spatial(node.children[q], bbox.get_quadrant(q));
         }
     }
 }
 #endif
 
-void Renderer::draw_streamlines(RoadType road, Direction dir) const {
-    const std::vector<Streamline>& sls = generator_ptr_->get_streamlines(road, dir);
+void Renderer::publish(const PublishedStreamline& s) {
+    std::vector<std::vector<Vector2>>& sls = roads_[s.road][s.dir];
 
-    const RoadStyle& style = road_styles_.at(road);
-
-    for (const Streamline& sl : sls) {
-        assert(sl.size() > 1);
-
-        int extra_edge = 0; // to join circles
-
-        if (sl.front() == sl.back()) {
-            assert(sl.size() > 2);
-            extra_edge = 1;
-
-        }
+    if (sls.size() <= s.index) {
+        sls.resize(s.index + 1);
+    }
 
+    sls[s.index].assign(s.points.begin(), s.points.end());
 
-        Vector2* positions = new Vector2[sl.size() + extra_edge];
+    const RoadStyle& style = road_styles_.at(s.road);
+    RoadMesh& mesh = meshes_.try_emplace(
+        s.road, style.colour, style.width, style.outline_colour, style.outline_width
+    ).first->second;
+    mesh.set(s.dir, s.index, sls[s.index]);
+}
 
-        int i = 0;
-        for (const node_id& id: sl) {
-            std::optional<StreamlineNode> maybe_node = generator_ptr_->get_node(id);
-            assert(maybe_node);
-            positions[i] = maybe_node.value().pos;
-            i++;
-        }
 
-        if (extra_edge) {
-            positions[sl.size()] = positions[0];
-        }
+void Renderer::draw_streamlines(RoadType road) {
+    if (!meshes_.contains(road)) return;
+    meshes_.at(road).draw();
+}
 
-        DrawSplineLinear(
-            positions, 
-            sl.size() + extra_edge, 
-            style.outline_width+style.width,
-            style.outline_colour
-        );
 
-        DrawSplineLinear(
-            positions,
-            sl.size() + extra_edge,
-            style.width,
-            style.colour
-        );
+void Renderer::draw_debug_overlay(RoadType road, Direction dir) const {
+    if (!roads_.contains(road) || !roads_.at(road).contains(dir)) return;
 
+    for (const std::vector<Vector2>& positions : roads_.at(road).at(dir)) {
         Color col = dir == Major ? RED : BLUE;
-        for (int i=0; i < sl.size() + extra_edge; ++i) {
+        for (int i=0; i < positions.size(); ++i) {
             DrawCircleV(positions[i], 1, col);
             if (i>0) {
                 DrawLineV(positions[i-1], positions[i], col);
             }
         }
-        
-        delete[] positions;
     }
 
 }
@@ -299,28 +278,65 @@ void Renderer::render_map() {
 
     if (!generated_) {
         generator_ptr_->set_viewport(ctx_.viewport);
+        generator_ptr_->clear();
+        roads_.clear();
+        meshes_.clear();
+
+        if (!step_mode_) {
+            worker_ = std::make_unique<GenerationWorker>(
+                *tf_ptr_,
+                generator_ptr_->get_parameters(),
+                ctx_.viewport
+            );
+            generated_ = true;
+        }
     }
-    if (!generated_ && !step_mode_) {
-        generator_ptr_->generate();
-        generated_ = true;
 
+    if (worker_) {
+        // anything published before finishing is drained below
+        bool finished = worker_->finished();
+
+        PublishedStreamline s;
+        while (worker_->poll(s)) {
+            publish(s);
+        }
+
+        if (finished) worker_.reset();
     } else if (step_mode_ && IsKeyPressed(KEY_SPACE)) {
         generated_ = true;
-        if (generator_ptr_->generation_step(generator_ptr_->get_road_types()[road_idx_], dir_)) {
-            dir_ = flip(dir_);
-        }
-        else if (road_idx_ < generator_ptr_->get_road_types().size()-1) {
-            road_idx_ += 1;
+
+        std::optional<CommittedStreamline> c = generator_ptr_->generation_step();
+        if (c.has_value()) {
+            publish(PublishedStreamline {
+                c->road,
+                c->dir,
+                c->index,
+                generator_ptr_->get_polyline(c->road, c->dir, c->index)
+            });
         }
     }
 
+    if (IsKeyPressed(KEY_O)) {
+        debug_overlay_ = !debug_overlay_;
+    }
+
     const std::vector<RoadType>& road_types = generator_ptr_->get_road_types();
     for (int i=road_types.size()-1; i>=0; --i) {
-        draw_streamlines(road_types[i], Major);
-        draw_streamlines(road_types[i], Minor);
+        draw_streamlines(road_types[i]);
+    }
+
+    if (!debug_overlay_) return;
+    for (RoadType road : road_types) {
+        draw_debug_overlay(road, Major);
+        draw_debug_overlay(road, Minor);
     }
 }
 
+bool Renderer::is_generating() const {
+    return mode_ == Map && worker_ != nullptr;
+}
+
+
 void Renderer::render_generating_popup() const {
     Vector2 mid = {ctx_.width/2.0f, ctx_.height/2.0f};
 
@@ -395,11 +411,12 @@ void Renderer::handle_tool_click(const Tool& t) {
         step_mode_ = true;
         mode_ = Map;
     } else if (t == BackToEditor) {
+        worker_.reset();
         step_mode_ = false;
         generated_ = false;
-        road_idx_ = 0;
         mode_ = FieldEditor;
     } else if (t == Regenerate) {
+        worker_.reset();
         generated_ = false;
         will_generate = true;
     }
@@ -430,6 +447,11 @@ Renderer::Renderer(
 }
 
 
+void Renderer::release_meshes() {
+    meshes_.clear();
+}
+
+
 void Renderer::main_loop() {
     assert(ctx_.is_drawing);
 
@@ -438,7 +460,10 @@ void Renderer::main_loop() {
     #ifdef SPATIAL_TEST
         BeginMode2D(ctx_.camera); ctx_.is_2d_mode = true; {
             test_spatial();
-            test_draw_spatial(generator_ptr_->spatial_.root_);
+            // only the quadtree has cells to draw
+            if (auto* s = dynamic_cast<Spatial*>(generator_ptr_->spatial_.get())) {
+                test_draw_spatial(s->root(), s->dimensions());
+            }
         } EndMode2D(); ctx_.is_2d_mode = false;
         // draw current dir
         
@@ -452,6 +477,7 @@ void Renderer::main_loop() {
         if (mode_ == Map) render_map();
         editor();
     } EndMode2D(); ctx_.is_2d_mode = false;
+    if (is_generating()) render_generating_popup();
     render_hud();
     // DrawTextEx(
     //     GetFontDefault(), 
@@ -8,6 +8,8 @@
 
 #include "generation/tensor_field.h"
 #include "generation/generator.h"
+#include "generation/worker.h"
+#include "road_mesh.h"
 #include "const.h"
 
 struct RenderContext {
@@ -121,7 +123,7 @@ private:
     std::list<DVector2> points_;
 
     void test_spatial();
-    void test_draw_spatial(qnode_id head_ptr);
+    void test_draw_spatial(qnode_id head_ptr, Box<double> bbox);
     #endif
 
     UIMode mode_ = FieldEditor;
@@ -132,16 +134,29 @@ private:
 
     bool generated_;
     bool step_mode_ = false;
-    int road_idx_ = 0;
+
+    // batch generation runs here, off the render thread
+    std::unique_ptr<GenerationWorker> worker_;
+
+    // renderer side copy of the road network, filled in as streamlines are published
+    std::unordered_map<RoadType, std::unordered_map<Direction, std::vector<std::vector<Vector2>>>> roads_;
+    std::unordered_map<RoadType, RoadMesh> meshes_;
+
+    // every node and segment over the roads, toggled with O
+    bool debug_overlay_ = false;
+
+    void publish(const PublishedStreamline& s);
 
     bool mouse_in_viewport();
     
     void draw_vector_line(const Vector2& vec, const Vector2& world_pos, Color col) const;
     void render_tensorfield() const;
 
+    bool is_generating() const;
     void render_generating_popup() const;
 
-    void draw_streamlines(RoadType road, Direction dir) const;
+    void draw_streamlines(RoadType road);
+    void draw_debug_overlay(RoadType road, Direction dir) const;
     void render_map();
 
     void editor();
@@ -155,6 +170,9 @@ private:
 public:
     Renderer(RenderContext& ctx, TensorField* tf_ptr, RoadGenerator* gen_ptr);
     void main_loop();
+
+    // the road meshes are on the gpu, so they go before the window
+    void release_meshes();
 };
 
 #endif